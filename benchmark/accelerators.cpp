@@ -0,0 +1,199 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "imagetracer.h"
+#include "render.h"
+#include "scene.h"
+#include "../test/random_scene.h"
+#include "catch_amalgamated.hpp"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#define CATCH_CONFIG_MAIN
+
+// Run from the build directory with: ./accelbenchmark --benchmark-samples 10
+
+// A dense, uniform field of small spheres of the same size
+RandomScene sphere_field() {
+  RandomScene scene;
+  scene.min_corner = Point(-10, -10, -10);
+  scene.max_corner = Point(10, 10, 10);
+  scene.min_size = scene.max_size = 0.1;
+  scene.rotate = false;
+  scene.boxes = false;
+  return scene;
+}
+
+// Primary rays of a small image of the scene
+vector<Ray> camera_rays(shared_ptr<Camera> camera, int width, int height) {
+  vector<Ray> rays;
+  for (int row{}; row < height; ++row)
+    for (int col{}; col < width; ++col)
+      rays.push_back(camera->fire_ray((col + 0.5) / width, 1. - (row + 0.5) / height));
+  return rays;
+}
+
+int trace_all(World &world, vector<Ray> &rays) {
+  int n_hits = 0;
+  for (auto &ray : rays)
+    n_hits += world.ray_intersection(ray).init;
+  return n_hits;
+}
+
+// Compare the linear scan of the shapes with all the acceleration structures
+void benchmark_world(string name, World world, vector<Ray> &rays) {
+
+  World linear;
+  for (auto shape : world.shapes)
+    linear.add_shape(shape);
+  BENCHMARK(name + ", linear scan") { return trace_all(linear, rays); };
+
+  for (AcceleratorType type :
+       {AcceleratorType::BVH, AcceleratorType::WIDE_BVH, AcceleratorType::GRID, AcceleratorType::HASHED_GRID}) {
+    World accelerated = linear;
+    accelerated.build_accelerator(type);
+    cout << name << ", " << accelerator_name(type) << ": " << accelerated.accelerator->memory_footprint() << " bytes"
+         << endl;
+    BENCHMARK(name + ", " + accelerator_name(type)) { return trace_all(accelerated, rays); };
+  }
+
+  // The binary hierarchy over sets of spheres, intersected with SIMD instructions
+  World packed = linear;
+  packed.pack_spheres = true;
+  packed.build_accelerator(AcceleratorType::BVH);
+  if (packed.sphere_sets.empty()) return;
+  cout << name << ", " << packed.sphere_sets.size() << " sphere sets (" << simd_level_name(best_simd_level()) << ")"
+       << endl;
+  BENCHMARK(name + ", bvh with sphere sets") { return trace_all(packed, rays); };
+}
+
+TEST_CASE("Accelerators: example scenes", "[benchmark]") {
+
+  for (string file : {"cornell_box.txt", "fireflies.txt", "sunset.txt", "demo.txt", "demo_pointlight.txt",
+                      "chess.txt", "image.txt", "solar_system.txt"}) {
+    ifstream in(string(EXAMPLES_DIR) + "/" + file);
+    Scene scene;
+    try {
+      InputStream scene_stream(in, file);
+      scene = scene_stream.parse_scene({});
+    } catch (runtime_error &e) {
+      // Scenes with textures need the images, whose paths are relative to where the renderer is run
+      cout << "Skipping " << file << ": " << e.what() << endl;
+      continue;
+    }
+    if (!scene.camera) continue;
+
+    vector<Ray> rays = camera_rays(scene.camera, 160, 120);
+    benchmark_world(file, scene.world, rays);
+  }
+}
+
+TEST_CASE("Accelerators: random spheres", "[benchmark]") {
+
+  PCG pcg;
+  World world = random_world(5000, pcg, sphere_field());
+  shared_ptr<Camera> camera = make_shared<PerspectiveCamera>(1., 4. / 3., translation(Vec(-30., 0., 0.)));
+  vector<Ray> rays = camera_rays(camera, 80, 60);
+
+  benchmark_world("5000 spheres", world, rays);
+}
+
+// Compare the flat and on-off renderers tracing single rays or blocks of 8x8 pixels
+void benchmark_packets(string name, World world, shared_ptr<Camera> camera) {
+
+  ImageTracer tracer(HdrImage(320, 240), camera);
+  vector<shared_ptr<Renderer>> renderers = {make_shared<FlatRenderer>(world), make_shared<OnOffRenderer>(world)};
+  for (int r{}; r < renderers.size(); ++r) {
+    Renderer &renderer = *renderers[r];
+    string renderer_name = name + (r == 0 ? ", flat" : ", onoff");
+    BENCHMARK(renderer_name + ", single rays") {
+      tracer.fire_all_rays([&](Ray ray) -> Color { return renderer(ray); });
+      return tracer.image.get_pixel(0, 0).r;
+    };
+    BENCHMARK(renderer_name + ", packets") {
+      tracer.fire_ray_packets([&](vector<Ray> &rays) -> vector<Color> { return renderer(rays); });
+      return tracer.image.get_pixel(0, 0).r;
+    };
+  }
+}
+
+TEST_CASE("Accelerators: primary ray packets", "[benchmark]") {
+
+  for (string file : {"cornell_box.txt", "fireflies.txt", "sunset.txt"}) {
+    ifstream in(string(EXAMPLES_DIR) + "/" + file);
+    Scene scene;
+    try {
+      InputStream scene_stream(in, file);
+      scene = scene_stream.parse_scene({});
+    } catch (runtime_error &e) {
+      cout << "Skipping " << file << ": " << e.what() << endl;
+      continue;
+    }
+    if (scene.camera) benchmark_packets(file, scene.world, scene.camera);
+  }
+
+  PCG pcg;
+  World world = random_world(5000, pcg, sphere_field());
+  world.build_bvh();
+  benchmark_packets("5000 spheres", world, make_shared<PerspectiveCamera>(1., 4. / 3., translation(Vec(-30., 0., 0.))));
+}
+
+TEST_CASE("Accelerators: sphere sets in renders", "[benchmark]") {
+
+  // A point-light render of many small spheres, with the spheres in the hierarchy one by one or packed in sets
+  PCG pcg;
+  RandomScene field = sphere_field();
+  field.min_size = 0.03;
+  field.max_size = 0.1;
+  World world = random_world(100000, pcg, field);
+  world.add_light(PointLight(Point(-30., 10., 20.), WHITE));
+  ImageTracer tracer(HdrImage(320, 240), make_shared<PerspectiveCamera>(1., 4. / 3., translation(Vec(-30., 0., 0.))));
+
+  HdrImage single_image(320, 240);
+  for (bool pack : {false, true}) {
+    World rendered = world;
+    rendered.pack_spheres = pack;
+    rendered.build_accelerator(AcceleratorType::BVH);
+    PointLightTracer renderer(rendered);
+    string name = pack ? "100000 spheres, point light, bvh with sphere sets (" + simd_level_name(best_simd_level()) + ")"
+                       : "100000 spheres, point light, bvh";
+
+    auto start = chrono::steady_clock::now();
+    tracer.fire_ray_batches(renderer, 1);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << name << ": " << seconds * 1e3 << " ms per image" << endl;
+    if (!pack) {
+      single_image = tracer.image;
+    } else {
+      // The sets give exactly the same image
+      int n_different = 0;
+      for (int i{}; i < single_image.pixels.size(); ++i) {
+        Color &expected = single_image.pixels[i], &color = tracer.image.pixels[i];
+        n_different += (color.r != expected.r || color.g != expected.g || color.b != expected.b);
+      }
+      REQUIRE(n_different == 0);
+    }
+
+    BENCHMARK(string(name)) {
+      tracer.fire_ray_batches(renderer, 1);
+      return tracer.image.get_pixel(0, 0).r;
+    };
+  }
+}
@@ -0,0 +1,85 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "world.h"
+#include "../test/random_scene.h"
+#include "catch_amalgamated.hpp"
+#include <iostream>
+
+#define CATCH_CONFIG_MAIN
+
+// Run with: ./bvhbenchmark --benchmark-samples 10
+
+// Setup: a random cloud of small spheres
+vector<shared_ptr<Shape>> random_spheres(int n_shapes) {
+  PCG pcg;
+  RandomScene scene;
+  scene.min_corner = Point(0, 0, 0);
+  scene.max_corner = Point(100, 100, 100);
+  scene.min_size = 0.05;
+  scene.max_size = 0.15;
+  scene.rotate = false;
+  scene.boxes = false;
+  return random_shapes(n_shapes, pcg, scene);
+}
+
+vector<Ray> random_rays(int n_rays) {
+  PCG pcg;
+  vector<Ray> rays;
+  for (int i{}; i < n_rays; ++i)
+    rays.push_back(random_ray(pcg, Point(0, 0, 0), Point(100, 100, 100)));
+  return rays;
+}
+
+int trace_all(BVH &bvh, vector<Ray> &rays) {
+  int n_hits = 0;
+  for (auto &ray : rays)
+    n_hits += bvh.ray_intersection(ray).init;
+  return n_hits;
+}
+
+TEST_CASE("BVH build: LBVH vs SAH", "[benchmark]") {
+
+  for (int n_shapes : {100000, 1000000}) {
+    vector<shared_ptr<Shape>> shapes = random_spheres(n_shapes);
+
+    for (BVHBuildMethod method : {BVHBuildMethod::SAH, BVHBuildMethod::BINNED_SAH, BVHBuildMethod::LBVH}) {
+      // The exact SAH builder is too slow to be sampled many times on the biggest scene
+      if (method == BVHBuildMethod::SAH && n_shapes > 100000) continue;
+
+      BVH bvh(shapes, method);
+      cout << bvh_method_name(method) << ", " << n_shapes << " shapes: " << bvh.stats.get_string() << endl;
+
+      BENCHMARK("build " + bvh_method_name(method) + ", " + to_string(n_shapes) + " shapes") {
+        return BVH(shapes, method).nodes.size();
+      };
+    }
+  }
+}
+
+TEST_CASE("BVH traversal: LBVH vs SAH", "[benchmark]") {
+
+  vector<shared_ptr<Shape>> shapes = random_spheres(100000);
+  vector<Ray> rays = random_rays(10000);
+
+  for (BVHBuildMethod method : {BVHBuildMethod::SAH, BVHBuildMethod::BINNED_SAH, BVHBuildMethod::LBVH}) {
+    BVH bvh(shapes, method);
+    BENCHMARK("trace 10000 rays, " + bvh_method_name(method)) { return trace_all(bvh, rays); };
+  }
+}
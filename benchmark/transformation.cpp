@@ -0,0 +1,173 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "sphere_set.h"
+#include "../test/random_scene.h"
+#include "catch_amalgamated.hpp"
+#include <chrono>
+#include <iostream>
+
+#define CATCH_CONFIG_MAIN
+
+// Run with: ./transformbenchmark --benchmark-samples 10
+
+// Setup: a random cloud of small spheres and rays crossing it
+RandomScene sphere_cloud() {
+  RandomScene scene;
+  scene.min_corner = Point(0, 0, 0);
+  scene.max_corner = Point(10, 10, 10);
+  scene.min_size = 0.2;
+  scene.max_size = 0.7;
+  scene.boxes = false;
+  return scene;
+}
+
+vector<Sphere> random_spheres(int n_shapes) {
+  PCG pcg;
+  vector<Sphere> spheres;
+  for (int i{}; i < n_shapes; ++i)
+    spheres.push_back(Sphere(random_placement(pcg, sphere_cloud())));
+  return spheres;
+}
+
+vector<Ray> random_rays(int n_rays) {
+  PCG pcg;
+  vector<Ray> rays;
+  for (int i{}; i < n_rays; ++i)
+    rays.push_back(random_ray(pcg, Point(0, 0, -1), Point(10, 10, -1), Point(-0.5, -0.5, 1), Point(0.5, 0.5, 1)));
+  return rays;
+}
+
+// The sphere test as it was before the affine fast path: the matrices are copied and points divided by w
+bool reference_check(Sphere &sphere, Ray ray) {
+  Ray inv_ray(ray.transform(sphere.transformation.inverse()));
+  Vec origin_vec(inv_ray.origin.to_vec());
+  float a = inv_ray.dir.squared_norm();
+  float b = 2.0 * dot(origin_vec, inv_ray.dir);
+  float c = origin_vec.squared_norm() - 1.0;
+  float delta = b * b - 4.0 * a * c;
+  if (delta <= 0.0) return false;
+  float tmin = (-b - sqrt(delta)) / 2.0 / a;
+  float tmax = (-b + sqrt(delta)) / 2.0 / a;
+  return ((tmin > inv_ray.tmin && tmin < inv_ray.tmax) || (tmax > inv_ray.tmin && tmax < inv_ray.tmax));
+}
+
+template <typename Check> int count_hits(vector<Sphere> &spheres, vector<Ray> &rays, Check check) {
+  int n_hits = 0;
+  for (auto &ray : rays)
+    for (auto &sphere : spheres)
+      n_hits += check(sphere, ray);
+  return n_hits;
+}
+
+template <typename Check> void print_rate(string name, vector<Sphere> &spheres, vector<Ray> &rays, Check check) {
+  auto start = chrono::steady_clock::now();
+  int n_hits = count_hits(spheres, rays, check);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  cout << name << ": " << spheres.size() * rays.size() / seconds / 1e6 << " million intersections per second ("
+       << n_hits << " hits)" << endl;
+}
+
+TEST_CASE("Sphere intersections: affine inverse vs copied projective inverse", "[benchmark]") {
+
+  vector<Sphere> spheres = random_spheres(1000);
+  vector<Ray> rays = random_rays(1000);
+
+  auto before = [](Sphere &s, Ray &r) { return reference_check(s, r); };
+  auto after = [](Sphere &s, Ray &r) { return s.check_if_intersection(r); };
+  auto after_closest = [](Sphere &s, Ray &r) { return s.ray_intersection(r).init; };
+  REQUIRE(count_hits(spheres, rays, before) == count_hits(spheres, rays, after));
+
+  print_rate("check_if_intersection, before", spheres, rays, before);
+  print_rate("check_if_intersection, after", spheres, rays, after);
+  print_rate("ray_intersection, after", spheres, rays, after_closest);
+
+  BENCHMARK("1M sphere tests, before") { return count_hits(spheres, rays, before); };
+  BENCHMARK("1M sphere tests, after") { return count_hits(spheres, rays, after); };
+  BENCHMARK("1M closest-hit sphere tests, after") { return count_hits(spheres, rays, after_closest); };
+}
+
+TEST_CASE("Sphere intersections: specialized vs general transformation kernels", "[benchmark]") {
+
+  // Spheres placed by 'translation * scaling', as in most scenes, and the same spheres with untagged matrices
+  PCG pcg;
+  RandomScene scene = sphere_cloud();
+  scene.rotate = false;
+  vector<Sphere> spheres, general_spheres;
+  for (int i{}; i < 1000; ++i) {
+    Transformation tr = random_placement(pcg, scene);
+    spheres.push_back(Sphere(tr));
+    general_spheres.push_back(Sphere(Transformation(tr.m, tr.invm)));
+  }
+  vector<Ray> rays = random_rays(1000);
+
+  auto check = [](Sphere &s, Ray &r) { return s.check_if_intersection(r); };
+  REQUIRE(count_hits(spheres, rays, check) == count_hits(general_spheres, rays, check));
+
+  print_rate("translated and scaled spheres, general kernel", general_spheres, rays, check);
+  print_rate("translated and scaled spheres, specialized kernel", spheres, rays, check);
+
+  BENCHMARK("1M sphere tests, general kernel") { return count_hits(general_spheres, rays, check); };
+  BENCHMARK("1M sphere tests, specialized kernel") { return count_hits(spheres, rays, check); };
+}
+
+TEST_CASE("Sphere intersections: packed sets", "[benchmark]") {
+
+  // Overlapping spheres, so that each ray hits many of them
+  vector<shared_ptr<Sphere>> spheres;
+  PCG pcg;
+  RandomScene scene = sphere_cloud();
+  scene.min_size = scene.max_size = 1.5;
+  scene.rotate = false;
+  for (int i{}; i < 1000; ++i)
+    spheres.push_back(make_shared<Sphere>(random_placement(pcg, scene)));
+  vector<SphereSet> sets;
+  for (int i{}; i < spheres.size(); i += SPHERE_SET_SIZE)
+    sets.push_back(SphereSet(vector<shared_ptr<Sphere>>(spheres.begin() + i, spheres.begin() + i + SPHERE_SET_SIZE)));
+  vector<Ray> rays = random_rays(1000);
+
+  auto trace_spheres = [&]() {
+    int n_hits = 0;
+    for (auto &ray : rays)
+      for (auto &sphere : spheres)
+        n_hits += sphere->check_if_intersection(ray);
+    return n_hits;
+  };
+  BENCHMARK("1M sphere tests, single spheres") { return trace_spheres(); };
+
+  for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::SSE, SimdLevel::AVX2}) {
+    if (level > best_simd_level()) continue;
+    for (auto &set : sets)
+      set.simd = level;
+    BENCHMARK("1M sphere tests, all hits of the sets, " + simd_level_name(level)) {
+      int n_hits = 0;
+      float t[SPHERE_SET_SIZE];
+      for (auto &ray : rays)
+        for (auto &set : sets)
+          n_hits += __builtin_popcount(set.intersect(ray, t));
+      return n_hits;
+    };
+    BENCHMARK("1M sphere tests, closest hits of the sets, " + simd_level_name(level)) {
+      int n_hits = 0;
+      for (auto &ray : rays)
+        for (auto &set : sets)
+          n_hits += set.ray_intersection(ray).init;
+      return n_hits;
+    };
+  }
+}
@@ -9,4 +9,4 @@ readonly angle="$1"
 readonly angleNNN=$(printf "%03d" $angle)
 readonly pngfile=img/image$angleNNN.png
 
-time ../../build/./raytracer render image.txt --output $pngfile -v ang=$angle --a_r ${2:-1}
+time ../../build/./raytracer render image.txt --bvh lbvh --output $pngfile -v ang=$angle --a_r ${2:-1}
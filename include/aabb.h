@@ -0,0 +1,213 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "geometry.h"
+#include "ray.h"
+#include "transformation.h"
+#include <algorithm>
+
+#ifndef _aabb_h_
+#define _aabb_h_
+
+/**
+ * Return the coordinate of the point along the given axis (0, 1, 2)
+ */
+inline float coordinate(const Point &p, int axis) {
+  return (axis == 0) ? p.x : ((axis == 1) ? p.y : p.z);
+}
+
+inline float coordinate(const Vec &v, int axis) {
+  return (axis == 0) ? v.x : ((axis == 1) ? v.y : v.z);
+}
+
+/**
+ * Slab kernel shared by the boxes of the shapes and of the acceleration structures: compute, along each axis,
+ * the ray parameters where the ray enters and leaves the slab between pmin and pmax.
+ * The entry face is picked with the sign bits of the ray, with no branch and no division.
+ * A ray parallel to an axis gets infinite distances, or NaN if it lies on the plane of a face:
+ * the reductions of the distances must ignore NaN, so that such a ray is considered inside the slab.
+ *
+ * @param t_near Output: entry parameter along each axis
+ * @param t_far Output: exit parameter along each axis
+ */
+inline void slab_distances(const Point &pmin, const Point &pmax, const Ray &ray, float t_near[3], float t_far[3]) {
+  t_near[0] = ((ray.dir_is_neg[0] ? pmax.x : pmin.x) - ray.origin.x) * ray.inv_dir.x;
+  t_far[0] = ((ray.dir_is_neg[0] ? pmin.x : pmax.x) - ray.origin.x) * ray.inv_dir.x;
+  t_near[1] = ((ray.dir_is_neg[1] ? pmax.y : pmin.y) - ray.origin.y) * ray.inv_dir.y;
+  t_far[1] = ((ray.dir_is_neg[1] ? pmin.y : pmax.y) - ray.origin.y) * ray.inv_dir.y;
+  t_near[2] = ((ray.dir_is_neg[2] ? pmax.z : pmin.z) - ray.origin.z) * ray.inv_dir.z;
+  t_far[2] = ((ray.dir_is_neg[2] ? pmin.z : pmax.z) - ray.origin.z) * ray.inv_dir.z;
+}
+
+//––––––––––––– Struct AABB –––––––––––––––––––––––––
+/**
+ * An axis-aligned bounding box, identified by its two opposite vertices.
+ * A default-constructed box is empty (pmin = +INFINITY, pmax = -INFINITY),
+ * so that it can be grown with 'expand'.
+ *
+ * @param pmin The vertex with the smallest coordinates
+ * @param pmax The vertex with the largest coordinates
+ */
+struct AABB {
+
+  Point pmin = Point(INFINITY, INFINITY, INFINITY);
+  Point pmax = Point(-INFINITY, -INFINITY, -INFINITY);
+
+  AABB(){};
+  AABB(Point p1, Point p2)
+      : pmin{fmin(p1.x, p2.x), fmin(p1.y, p2.y), fmin(p1.z, p2.z)},
+        pmax{fmax(p1.x, p2.x), fmax(p1.y, p2.y), fmax(p1.z, p2.z)} {}
+
+  /**
+   * Return a box covering the whole space, used for unbounded shapes (e.g. planes)
+   */
+  static AABB unbounded() {
+    AABB box;
+    box.pmin = Point(-INFINITY, -INFINITY, -INFINITY);
+    box.pmax = Point(INFINITY, INFINITY, INFINITY);
+    return box;
+  }
+
+  /**
+   * Check if the box contains no point at all
+   */
+  bool is_empty() { return pmin.x > pmax.x || pmin.y > pmax.y || pmin.z > pmax.z; }
+
+  /**
+   * Check if the box has a finite extent along all the three axes
+   */
+  bool is_bounded() {
+    return !is_empty() && isfinite(pmin.x) && isfinite(pmin.y) && isfinite(pmin.z) &&
+           isfinite(pmax.x) && isfinite(pmax.y) && isfinite(pmax.z);
+  }
+
+  /**
+   * Grow the box so that it contains the given point
+   */
+  void expand(Point p) {
+    pmin = Point(fmin(pmin.x, p.x), fmin(pmin.y, p.y), fmin(pmin.z, p.z));
+    pmax = Point(fmax(pmax.x, p.x), fmax(pmax.y, p.y), fmax(pmax.z, p.z));
+  }
+
+  /**
+   * Grow the box so that it contains the given box
+   */
+  void expand(AABB box) {
+    if (box.is_empty()) return;
+    expand(box.pmin);
+    expand(box.pmax);
+  }
+
+  /**
+   * Return the center of the box
+   */
+  Point centroid() { return (pmin + pmax.to_vec()) * 0.5; }
+
+  /**
+   * Return the total area of the six faces of the box (0 for an empty box)
+   */
+  float surface_area() {
+    if (is_empty()) return 0.;
+    Vec d = pmax - pmin;
+    return 2. * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+
+  /**
+   * Return the index (0, 1, 2) of the axis along which the box is longest
+   */
+  int largest_axis() {
+    Vec d = pmax - pmin;
+    if (d.x >= d.y && d.x >= d.z) return 0;
+    return (d.y >= d.z) ? 1 : 2;
+  }
+
+  /**
+   * Check if a ray crosses the box within [tmin, tmax] (branchless slab test, see 'slab_distances')
+   *
+   * @param ray The ray (only its origin, reciprocal direction and sign bits are used)
+   * @param tmin Lower bound of the ray parameter
+   * @param tmax Upper bound of the ray parameter
+   * @param t_near Output: ray parameter where the ray enters the box
+   * @param t_far Output: ray parameter where the ray leaves the box
+   * @return boolean value
+   */
+  bool ray_intersection(const Ray &ray, float tmin, float tmax, float &t_near, float &t_far) {
+    float near[3], far[3];
+    slab_distances(pmin, pmax, ray, near, far);
+    // max(a, NaN) and min(a, NaN) both return a
+    t_near = max(max(max(tmin, near[0]), near[1]), near[2]);
+    t_far = min(min(min(tmax, far[0]), far[1]), far[2]);
+    return t_near <= t_far;
+  }
+
+  bool ray_intersection(const Ray &ray, float tmin, float tmax, float &t_near) {
+    float t_far;
+    return ray_intersection(ray, tmin, tmax, t_near, t_far);
+  }
+
+  /**
+   * Restrict [tmin, tmax] of the ray to the part inside the box
+   *
+   * @return false if the ray misses the box (the ray is left untouched)
+   */
+  bool clip(Ray &ray) {
+    if (is_empty()) return false;
+    if (!is_bounded()) return true;
+    // Pad the box, so that surfaces lying on its faces are still found by the strict tests of the shapes
+    Vec pad = (pmax - pmin) * 1e-4 + Vec(1e-4, 1e-4, 1e-4);
+    AABB padded(pmin - pad, pmax + pad);
+    float t_near, t_far;
+    if (!padded.ray_intersection(ray, ray.tmin, ray.tmax, t_near, t_far)) return false;
+    ray.tmin = t_near;
+    ray.tmax = t_far;
+    return true;
+  }
+};
+
+/**
+ * Return the smallest box containing both the given boxes
+ */
+inline AABB merge(AABB a, AABB b) {
+  a.expand(b);
+  return a;
+}
+
+/**
+ * Return a box containing the given box after the (affine) transformation has been applied to it.
+ * Each new extent is the sum of the extremes of every matrix column times the old extent
+ * (J. Arvo, "Transforming axis-aligned bounding boxes", Graphics Gems, 1990)
+ */
+inline AABB operator*(Transformation t, AABB box) {
+  if (box.is_empty() || !box.is_bounded()) return box;
+  float new_min[3], new_max[3];
+  float old_min[3] = {box.pmin.x, box.pmin.y, box.pmin.z};
+  float old_max[3] = {box.pmax.x, box.pmax.y, box.pmax.z};
+  for (int i{}; i < 3; ++i) {
+    new_min[i] = new_max[i] = t.m[i][3];
+    for (int j{}; j < 3; ++j) {
+      float a = t.m[i][j] * old_min[j];
+      float b = t.m[i][j] * old_max[j];
+      new_min[i] += fmin(a, b);
+      new_max[i] += fmax(a, b);
+    }
+  }
+  return AABB(Point(new_min[0], new_min[1], new_min[2]), Point(new_max[0], new_max[1], new_max[2]));
+}
+
+#endif
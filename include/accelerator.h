@@ -0,0 +1,129 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "aabb.h"
+#include "shapes.h"
+#include <string>
+#include <vector>
+
+#ifndef _accelerator_h_
+#define _accelerator_h_
+
+/**
+ * Spatial structures that can speed up the intersections of a group of shapes:
+ * - NONE: no structure, every shape is checked (the reference for all the others)
+ * - BVH: binary bounding volume hierarchy
+ * - WIDE_BVH: 4-ary hierarchy with quantized child bounds packed in cache-line sized nodes
+ * - GRID: uniform grid
+ * - HASHED_GRID: uniform grid storing only its non-empty cells
+ */
+enum class AcceleratorType {
+  NONE,
+  BVH,
+  WIDE_BVH,
+  GRID,
+  HASHED_GRID,
+};
+
+/**
+ * Return the name of the acceleration structure (as accepted by the command line)
+ */
+inline string accelerator_name(AcceleratorType type) {
+  if (type == AcceleratorType::NONE) return "none";
+  else if (type == AcceleratorType::BVH) return "bvh";
+  else if (type == AcceleratorType::WIDE_BVH) return "wide";
+  else if (type == AcceleratorType::GRID) return "grid";
+  else return "hashgrid";
+}
+
+//––––––––––––– Abstract struct Accelerator –––––––––––––––––––––––––
+/**
+ * Abstract struct representing a spatial structure over a list of bounded shapes,
+ * answering the same queries as a linear scan of the shapes
+ */
+struct Accelerator {
+
+  virtual ~Accelerator() {}
+
+  /**
+   * Return the box enclosing all the shapes of the structure
+   */
+  virtual AABB bounding_box() = 0;
+
+  /**
+   * Find the closest intersection between the ray and the shapes in the structure, computing only its distance
+   *
+   * @param ray Input ray to check: only the hits within [tmin, tmax] are considered
+   * @param hit Set to the closest hit, only if an intersection happens
+   * @return boolean value
+   */
+  virtual bool hit_distance(Ray, HitDistance &) = 0;
+
+  /**
+   * Find the closest intersection between the ray and the shapes in the structure:
+   * the surface attributes are computed only for the closest hit found by 'hit_distance'
+   *
+   * @param ray Input ray to check
+   * @return HitRecord of the closest intersection ('init' set to false if no intersection happens)
+   */
+  HitRecord ray_intersection(Ray ray) {
+    HitDistance hit;
+    return hit_distance(ray, hit) ? hit.shape->hit_record(ray, hit) : HitRecord();
+  }
+
+  /**
+   * Check if the given ray hits any shape in the structure, stopping at the first one found
+   *
+   * @param ray Input ray to check
+   * @return boolean value
+   */
+  virtual bool check_if_intersection(Ray) = 0;
+
+  /**
+   * Batch version of 'hit_distance', meant for coherent rays (e.g. the primary rays of a block of pixels)
+   *
+   * @param rays Input rays to check
+   * @param hits Set to the closest hit of every ray, or to an empty 'HitDistance' (same size as 'rays')
+   */
+  virtual void hit_distance(vector<Ray> &rays, vector<HitDistance> &hits) {
+    for (int i{}; i < rays.size(); ++i) {
+      hits[i] = HitDistance();
+      hit_distance(rays[i], hits[i]);
+    }
+  }
+
+  /**
+   * Batch version of 'check_if_intersection'
+   *
+   * @param rays Input rays to check
+   * @param occluded Set to true for every ray hitting a shape (rays already marked are skipped)
+   */
+  virtual void check_if_intersection(vector<Ray> &rays, vector<bool> &occluded) {
+    for (int i{}; i < rays.size(); ++i) {
+      if (!occluded[i] && check_if_intersection(rays[i])) occluded[i] = true;
+    }
+  }
+
+  /**
+   * Return the memory used by the structure, in bytes (the shapes themselves are not counted)
+   */
+  virtual size_t memory_footprint() = 0;
+};
+
+#endif
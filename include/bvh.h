@@ -0,0 +1,247 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "accelerator.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef _bvh_h_
+#define _bvh_h_
+
+// Relative costs used by the surface area heuristic
+#define SAH_TRAVERSAL_COST 1.0
+#define SAH_INTERSECTION_COST 4.0
+
+// Maximum depth of the tree (the traversal stack is sized accordingly)
+#define BVH_MAX_DEPTH 64
+
+// Number of bins per axis used by the binned SAH builder
+#define BVH_N_BINS 16
+
+// A refitted tree whose SAH cost grows by more than this factor is rebuilt from scratch
+#define BVH_REBUILD_THRESHOLD 1.3
+
+// Number of rays traced together by the packet traversal (one bit of a 64-bit mask each), and the number of
+// rays under which a packet is considered diverged and its rays go on alone
+#define BVH_PACKET_SIZE 64
+#define BVH_PACKET_MIN_ACTIVE 4
+
+// Bits per axis of the Morton codes used by the linear builder (sorted in one radix pass per axis)
+#define BVH_MORTON_BITS 10
+
+/**
+ * Strategies for building a bounding volume hierarchy:
+ * - SAH: exact surface area heuristic, evaluated at every primitive after sorting (best trees, slowest build)
+ * - BINNED_SAH: surface area heuristic evaluated on a few bins, built in parallel (good trees, fast build)
+ * - MIDPOINT: split at the middle of the largest axis, built in parallel (fast build, slower traversal)
+ * - LBVH: linear BVH, primitives radix-sorted along a Morton curve and split at the highest differing bit
+ *   of their codes, built in parallel (fastest build, meant for scenes rebuilt at every frame)
+ */
+enum class BVHBuildMethod {
+  SAH,
+  BINNED_SAH,
+  MIDPOINT,
+  LBVH,
+};
+
+/**
+ * Return the name of the build method (as accepted by the command line)
+ */
+string bvh_method_name(BVHBuildMethod);
+
+//––––––––––––– Struct BVHStats –––––––––––––––––––––––––
+/**
+ * Statistics collected while building a hierarchy
+ *
+ * @param build_time_ms Wall-clock build time in milliseconds
+ * @param n_threads Number of threads used by the builder
+ * @param n_nodes Total number of nodes
+ * @param n_leaves Number of leaves
+ * @param max_depth Depth of the deepest leaf (the root has depth 0)
+ * @param sah_cost Expected cost of a ray traversal according to the SAH, when the tree was built (lower is better)
+ * @param n_refits Number of times the bounds were refitted since the tree was built
+ * @param cached Whether the tree was loaded from a 'BVHCache' instead of being built (the build statistics are the original ones)
+ */
+struct BVHStats {
+  double build_time_ms = 0.;
+  int n_threads = 1;
+  int n_nodes = 0;
+  int n_leaves = 0;
+  int max_depth = 0;
+  float sah_cost = 0.;
+  int n_refits = 0;
+  bool cached = false;
+
+  /**
+   * Return a printable string with the statistics
+   */
+  string get_string();
+};
+
+//––––––––––––– Struct BVHNode –––––––––––––––––––––––––
+/**
+ * A node of a bounding volume hierarchy, stored in a flat array in depth-first order:
+ * the first child of an interior node is always the node that follows it.
+ *
+ * @param box The bounding box of everything below the node
+ * @param offset Index of the first primitive (leaf) or of the second child (interior node)
+ * @param count Number of primitives in the leaf (0 for interior nodes)
+ * @param axis Axis along which the primitives of an interior node were split
+ */
+struct BVHNode {
+  AABB box;
+  int offset = 0;
+  int count = 0;
+  int axis = 0;
+
+  bool is_leaf() { return count > 0; }
+};
+
+/**
+ * Build the nodes of a hierarchy over primitives known only by their bounding boxes
+ * (the shapes of a 'BVH', or the triangles of a 'Mesh')
+ *
+ * @param n Number of primitives
+ * @param box_of Function returning the bounding box of the i-th primitive (called from several threads)
+ * @param method The build strategy
+ * @param max_leaf Maximum number of primitives stored in a leaf
+ * @param n_threads Number of threads for the parallel builders (0: all the available cores)
+ * @param nodes Filled with the nodes of the tree
+ * @param order Filled with the indices of the primitives in leaf order: each leaf refers to a contiguous range of it
+ * @param stats Filled with the statistics about the build
+ */
+void build_bvh_nodes(int n, function<AABB(int)> box_of, BVHBuildMethod method, int max_leaf, int n_threads,
+                     vector<BVHNode> &nodes, vector<int> &order, BVHStats &stats);
+
+/**
+ * Return the expected cost of a ray traversal of the given nodes according to the SAH, normalized by the area of the root
+ */
+float bvh_sah_cost(vector<BVHNode> &);
+
+//––––––––––––– Struct BVH –––––––––––––––––––––––––
+/**
+ * A bounding volume hierarchy over a list of bounded shapes
+ *
+ * @param nodes The nodes of the tree (the root is nodes[0])
+ * @param primitives The shapes, reordered so that each leaf refers to a contiguous range
+ * @param method The strategy used to build the tree
+ * @param max_leaf_size Maximum number of shapes stored in a leaf
+ * @param stats Statistics about the build
+ */
+struct BVH : public Accelerator {
+
+  vector<BVHNode> nodes;
+  vector<shared_ptr<Shape>> primitives;
+  BVHBuildMethod method;
+  int max_leaf_size;
+  BVHStats stats;
+
+  /**
+   * Build the hierarchy over the given shapes
+   *
+   * @param shapes The bounded shapes to store in the tree
+   * @param method The build strategy (default: SAH)
+   * @param max_leaf Maximum number of shapes stored in a leaf (default 4)
+   * @param n_threads Number of threads for the parallel builders (default 0: all the available cores)
+   */
+  BVH(vector<shared_ptr<Shape>> shapes, BVHBuildMethod method = BVHBuildMethod::SAH, int max_leaf = 4,
+      int n_threads = 0);
+
+  /**
+   * Return the expected cost of a ray traversal according to the SAH, normalized by the area of the root
+   */
+  float sah_cost();
+
+  /**
+   * Recompute the bounds of the nodes bottom-up after the shapes have moved (e.g. their transformations changed),
+   * keeping the topology of the tree. The shapes must still be bounded.
+   */
+  void refit();
+
+  /**
+   * Return how much the tree has degraded since it was built, as the ratio between its current SAH cost
+   * and the one it had when it was built (1 for a freshly built tree)
+   */
+  float degradation();
+
+  /**
+   * Return the bounding box of the whole hierarchy
+   */
+  AABB bounding_box() { return nodes.empty() ? AABB() : nodes[0].box; }
+
+  /**
+   * Return the memory used by the nodes and by the list of primitives, in bytes
+   */
+  size_t memory_footprint() { return nodes.size() * sizeof(BVHNode) + primitives.size() * sizeof(shared_ptr<Shape>); }
+
+  /**
+   * Find the distance of the closest intersection between the ray and the shapes in the hierarchy.
+   * Children are visited front-to-back and subtrees farther than the closest hit are skipped.
+   *
+   * @param ray Input ray to check
+   * @param hit Set to the closest hit, only if an intersection happens
+   * @return boolean value
+   */
+  bool hit_distance(Ray, HitDistance &);
+
+  /**
+   * Check if the given ray hits any shape in the hierarchy, stopping at the first one found
+   *
+   * @param ray Input ray to check
+   * @return boolean value
+   */
+  bool check_if_intersection(Ray);
+
+  /**
+   * Batch version of 'hit_distance' for coherent rays (e.g. the primary rays of a block of pixels):
+   * the rays are traversed together in packets of BVH_PACKET_SIZE.
+   * A packet whose rays all point to the same octant is culled with a single interval test per node;
+   * an inner node is entered by the whole packet as soon as one ray crosses it, and the rays are tested one by one
+   * only in the leaves. Once fewer than BVH_PACKET_MIN_ACTIVE rays reach a node, each of them finishes the subtree alone.
+   * The hits are the same as the ones of 'hit_distance'.
+   *
+   * @param rays Input rays to check
+   * @param hits Set to the closest hit of every ray, or to an empty 'HitDistance' (same size as 'rays')
+   */
+  void hit_distance(vector<Ray> &, vector<HitDistance> &);
+
+  /**
+   * Find the closest intersection of a single ray with the shapes below the given node,
+   * shortening the query ray every time a closer hit is found
+   *
+   * @param root Index of the node
+   * @param query The ray, whose tmax is updated
+   * @param closest The closest hit found so far, updated
+   */
+  void intersect_subtree(int, Ray &, HitDistance &);
+
+  /**
+   * Batch version of 'check_if_intersection': the rays are traversed together (in groups of 64),
+   * so that the nodes are visited once for all the rays crossing them.
+   * Each ray stops being tested as soon as it is found to be occluded.
+   *
+   * @param rays Input rays to check
+   * @param occluded Set to true for every ray hitting a shape (rays already marked are skipped)
+   */
+  void check_if_intersection(vector<Ray> &, vector<bool> &);
+};
+
+#endif
@@ -0,0 +1,91 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bvh.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef _bvh_cache_h_
+#define _bvh_cache_h_
+
+// Version of the file format, stored in every entry: entries written by other versions are ignored
+#define BVH_CACHE_VERSION 1
+
+//––––––––––––– Struct BVHCache –––––––––––––––––––––––––
+/**
+ * A directory of bounding volume hierarchies saved to disk, so that rendering the same scene again
+ * (e.g. with other samples, output names or '-v' variables that do not move the shapes) skips the build.
+ *
+ * A hierarchy only depends on the bounding boxes of its shapes (and on their order), on the build method
+ * and on the size of the leaves: the key of an entry is a hash of all of them, so an entry is valid for any list
+ * of shapes with the same key. Each entry stores the nodes and, for each primitive, its index in the list of shapes.
+ * Entries are read through a memory mapping and written to a temporary file renamed at the end,
+ * so that several renders can share the same directory.
+ *
+ * @param directory The directory holding the entries (created if missing)
+ * @param n_hits Number of hierarchies loaded from the cache
+ * @param n_misses Number of hierarchies built (and saved) because they were not in the cache
+ */
+struct BVHCache {
+
+  string directory;
+  int n_hits = 0;
+  int n_misses = 0;
+
+  BVHCache(string dir);
+
+  /**
+   * Return the key of the hierarchy built over the given shapes
+   *
+   * @param shapes The bounded shapes stored in the tree
+   * @param method The build strategy
+   * @param max_leaf Maximum number of shapes stored in a leaf
+   */
+  uint64_t key(vector<shared_ptr<Shape>> &shapes, BVHBuildMethod method, int max_leaf);
+
+  /**
+   * Return the name of the file of an entry
+   */
+  string path(uint64_t key);
+
+  /**
+   * Load the hierarchy over the given shapes from the cache
+   *
+   * @return the hierarchy, or nullptr if there is no valid entry for the shapes
+   */
+  shared_ptr<BVH> load(vector<shared_ptr<Shape>> &shapes, BVHBuildMethod method, int max_leaf = 4);
+
+  /**
+   * Save a hierarchy to the cache
+   *
+   * @param bvh The hierarchy
+   * @param shapes The list of shapes the hierarchy was built over (in the order given to the builder)
+   * @return true if the entry was written
+   */
+  bool save(BVH &bvh, vector<shared_ptr<Shape>> &shapes);
+
+  /**
+   * Load the hierarchy over the given shapes from the cache, or build it and save it if it is missing
+   */
+  shared_ptr<BVH> get(vector<shared_ptr<Shape>> &shapes, BVHBuildMethod method, int max_leaf = 4);
+};
+
+#endif
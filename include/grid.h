@@ -0,0 +1,131 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "accelerator.h"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _grid_h_
+#define _grid_h_
+
+// Target number of cells per shape, used to choose the resolution of the grids
+#define GRID_DENSITY 3.0
+
+// Maximum number of cells per axis: the hashed grid stores the non-empty cells only, so it can be much finer
+#define GRID_MAX_RESOLUTION 128
+#define HASHED_GRID_MAX_RESOLUTION 1024
+
+//––––––––––––– Struct GridCell –––––––––––––––––––––––––
+/**
+ * The range of 'Grid::cell_primitives' listing the shapes overlapping a cell
+ */
+struct GridCell {
+  int start = 0;
+  int count = 0;
+};
+
+//––––––––––––– Struct Grid –––––––––––––––––––––––––
+/**
+ * A uniform grid over a list of bounded shapes: each cell lists the shapes whose bounding box overlaps it,
+ * and a ray visits the cells it crosses in order (3D-DDA, Amanatides & Woo), stopping at the first cell
+ * containing a hit. Best suited for dense, uniform fields of shapes of similar size.
+ * The resolution is chosen so that the cells are roughly cubic and about GRID_DENSITY times the number of shapes.
+ *
+ * In the hashed variant only the non-empty cells are stored, in a hash table, so that large empty regions cost no memory.
+ *
+ * @param primitives The shapes
+ * @param box The bounds of the grid
+ * @param resolution Number of cells along each axis
+ * @param cell_size Size of a cell along each axis
+ * @param hashed Whether the cells are stored in a hash table ('cells') instead of a dense array ('cell_start')
+ * @param cell_start Dense grid: the shapes of cell i are cell_primitives[cell_start[i]] ... cell_primitives[cell_start[i + 1] - 1]
+ * @param cells Hashed grid: the non-empty cells, by linear index
+ * @param cell_primitives Indices of the shapes (in 'primitives') of each cell, cell after cell
+ */
+struct Grid : public Accelerator {
+
+  vector<shared_ptr<Shape>> primitives;
+  AABB box;
+  int resolution[3] = {1, 1, 1};
+  float cell_size[3];
+  bool hashed;
+  vector<int> cell_start;
+  unordered_map<int64_t, GridCell> cells;
+  vector<int> cell_primitives;
+
+  /**
+   * Build the grid over the given shapes
+   *
+   * @param shapes The bounded shapes to store in the grid
+   * @param hashed Whether only the non-empty cells are stored (default: false)
+   * @param density Target number of cells per shape (default GRID_DENSITY)
+   */
+  Grid(vector<shared_ptr<Shape>> shapes, bool hashed = false, float density = GRID_DENSITY);
+
+  /**
+   * Return the linear index of a cell
+   */
+  int64_t cell_index(int ix, int iy, int iz) { return (int64_t(iz) * resolution[1] + iy) * resolution[0] + ix; }
+
+  /**
+   * Return the range of 'cell_primitives' holding the shapes of a cell (empty if the cell is)
+   */
+  GridCell cell(int64_t index) {
+    if (!hashed) return GridCell{cell_start[index], cell_start[index + 1] - cell_start[index]};
+    auto found = cells.find(index);
+    return (found == cells.end()) ? GridCell() : found->second;
+  }
+
+  /**
+   * Return the bounds of the grid
+   */
+  AABB bounding_box() { return box; }
+
+  /**
+   * Find the distance of the closest intersection between the ray and the shapes in the grid
+   *
+   * @param ray Input ray to check
+   * @param hit Set to the closest hit, only if an intersection happens
+   * @return boolean value
+   */
+  bool hit_distance(Ray, HitDistance &);
+
+  /**
+   * Check if the given ray hits any shape in the grid, stopping at the first one found
+   *
+   * @param ray Input ray to check
+   * @return boolean value
+   */
+  bool check_if_intersection(Ray);
+
+  /**
+   * Return the memory used by the cells and by the list of primitives, in bytes (hash tables are estimated)
+   */
+  size_t memory_footprint();
+
+  /**
+   * Visit the cells crossed by the ray, front to back, calling 'visit(cell, t_exit)' on the non-empty ones
+   * until it returns true ('t_exit' is where the ray leaves the cell)
+   */
+  template <typename Visitor> void traverse(Ray &ray, Visitor visit);
+};
+
+#endif
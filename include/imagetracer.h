@@ -21,13 +21,21 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "camera.h"
 #include "colors.h"
 #include "pcg.h"
+#include "scheduler.h"
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <vector>
 
-#ifndef _imageracer_h_
+#ifndef _imagetracer_h_
 #define _imagetracer_h_
 
+// Side of the square blocks of pixels whose primary rays are traced together by 'fire_ray_packets'
+#define RAY_PACKET_SIDE 8
+
+// Default side of the square tiles in which the image is split among the rendering threads
+#define RENDER_TILE_SIZE 32
+
 /**
  * A struct that represents image tracing obtained by shooting rays through the image's pixels
  *
@@ -35,7 +43,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
  * @param camera orthogonal or perspective camera
  * @param samples_per_size if larger than zero, it activates the stratified sampling algorithm 
  on each pixel of the image, that uses the random number generator pcg
- * @param pcg PCG object for random number generation
+ * @param pcg PCG object for random number generation: it is never advanced, but seeds the generator of each sample
+ (see 'sample_pcg')
+ * @param tile_order Order in which the tiles are handed out to the threads by the multithreaded methods
+ * @param tile_stats Load balance of the threads of the last multithreaded rendering
  */
 struct ImageTracer {
 
@@ -43,6 +54,8 @@ struct ImageTracer {
   shared_ptr<Camera> camera;
   int samples_per_side;
   PCG pcg;
+  TileOrder tile_order = TileOrder::HILBERT;
+  SchedulerStats tile_stats;
 
   ImageTracer(HdrImage img, shared_ptr<Camera> cam, int samples = 0, PCG _pcg = PCG()): 
       image{img}, camera{cam}, samples_per_side{samples}, pcg{_pcg} {};
@@ -67,6 +80,15 @@ struct ImageTracer {
     return camera->fire_ray(u,v);
   }
 
+  /**
+   * Return the random number generator of the given sample of the pixel (col,row).
+   * Its seed only depends on 'pcg' and on the sample, so that each sample draws the same random numbers
+   * whatever the order the pixels are rendered in (and the number of threads, and the region of the image rendered).
+   */
+  PCG sample_pcg(int col, int row, int sample = 0){
+    return pcg.substream(mix_bits((uint64_t(uint32_t(row)) << 32) | uint32_t(col)) + uint64_t(sample));
+  }
+
   /**
    * Shoot all the rays through each image pixel and set the corrisponding color on the base of the choosen rendering algorithm.
    *
@@ -75,9 +97,65 @@ struct ImageTracer {
    * It also implements the antialiasing algorithm to avoid Moirè pattern effect.
    */
   void fire_all_rays(function<Color(Ray)> func){
+    function<Color(Ray, PCG &)> kernel = [&](Ray ray, PCG &) { return func(ray); };
+    fire_rays_in_region(0, 0, image.width, image.height, kernel);
+  }
 
-    for(int row{}; row<image.height; ++row){
-      for(int col{}; col<image.width; ++col){
+  /**
+   * Same as 'fire_all_rays', but the rays are passed to 'func' in packets of nearby rays, that can be traced together:
+   * the image is split in square blocks of pixels (with antialiasing, each pixel makes a packet of its samples).
+   *
+   * @param func Function returning the colors of a packet of rays
+   * @param packet_side Side of the blocks of pixels (default RAY_PACKET_SIDE)
+   */
+  void fire_ray_packets(function<vector<Color>(vector<Ray> &)> func, int packet_side = RAY_PACKET_SIDE){
+    function<vector<Color>(vector<Ray> &, vector<PCG> &)> kernel = [&](vector<Ray> &rays, vector<PCG> &) {
+      return func(rays);
+    };
+    fire_packets_in_region(0, 0, image.width, image.height, kernel, packet_side);
+  }
+
+  /**
+   * Multithreaded version of 'fire_all_rays': the image is split in square tiles, rendered by a pool of threads.
+   * Every sample draws its random numbers (its position in the pixel as well as those drawn by 'func')
+   * from its own 'sample_pcg', so that the image is the same for any number of threads, tile size and tile order.
+   *
+   * @param func Function returning the color along a ray, drawing its random numbers from the given PCG
+   * (called concurrently by all the threads)
+   * @param n_threads Number of threads (0: all the available cores)
+   * @param tile_size Side of the tiles (default RENDER_TILE_SIZE)
+   */
+  void fire_all_rays(function<Color(Ray, PCG &)> func, int n_threads, int tile_size = RENDER_TILE_SIZE){
+    for_each_tile(n_threads, tile_size, [&](int col_begin, int row_begin, int col_end, int row_end) {
+      fire_rays_in_region(col_begin, row_begin, col_end, row_end, func);
+    });
+  }
+
+  /**
+   * Multithreaded version of 'fire_ray_packets', with the same tiles as the multithreaded 'fire_all_rays'
+   * (the blocks of pixels traced together never cross a tile)
+   *
+   * @param func Function returning the colors of a packet of rays, each drawing its random numbers from the PCG
+   * of the same index (called concurrently by all the threads)
+   * @param n_threads Number of threads (0: all the available cores)
+   * @param tile_size Side of the tiles (default RENDER_TILE_SIZE)
+   * @param packet_side Side of the blocks of pixels (default RAY_PACKET_SIDE)
+   */
+  void fire_ray_packets(function<vector<Color>(vector<Ray> &, vector<PCG> &)> func, int n_threads,
+                        int tile_size = RENDER_TILE_SIZE, int packet_side = RAY_PACKET_SIDE){
+    for_each_tile(n_threads, tile_size, [&](int col_begin, int row_begin, int col_end, int row_end) {
+      fire_packets_in_region(col_begin, row_begin, col_end, row_end, func, packet_side);
+    });
+  }
+
+  /**
+   * Shoot the rays through the pixels of the region [col_begin, col_end) x [row_begin, row_end) of the image,
+   * each sample drawing its random numbers from its 'sample_pcg'
+   */
+  void fire_rays_in_region(int col_begin, int row_begin, int col_end, int row_end, function<Color(Ray, PCG &)> &func){
+
+    for(int row{row_begin}; row<row_end; ++row){
+      for(int col{col_begin}; col<col_end; ++col){
 
         Color cum_color = BLACK;
 
@@ -85,24 +163,139 @@ struct ImageTracer {
           // Run stratified sampling over the pixel's surface
           for(int pixel_row{};  pixel_row<samples_per_side; ++pixel_row) {
             for(int pixel_col{};  pixel_col<samples_per_side; ++pixel_col) {
-              float u_pixel = (pixel_col + pcg.random_float()) / samples_per_side;
-              float v_pixel = (pixel_row + pcg.random_float()) / samples_per_side;
+              PCG sample_rng = sample_pcg(col, row, pixel_row * samples_per_side + pixel_col);
+              float u_pixel = (pixel_col + sample_rng.random_float()) / samples_per_side;
+              float v_pixel = (pixel_row + sample_rng.random_float()) / samples_per_side;
               Ray ray = fire_ray(col, row, u_pixel, v_pixel);
-              cum_color = cum_color + func(ray); 
+              cum_color = cum_color + func(ray, sample_rng);
             }
           }
           image.set_pixel(col, row, cum_color * (1 / pow(samples_per_side,2)));
 
         } else {
+          PCG sample_rng = sample_pcg(col, row);
           Ray ray = fire_ray(col, row);
-          Color color = func(ray);
+          Color color = func(ray, sample_rng);
           image.set_pixel(col, row, color);
         }
       }
     }
   }
 
-  
+  /**
+   * Same as 'fire_rays_in_region', with the rays traced in packets (see 'fire_ray_packets')
+   */
+  void fire_packets_in_region(int col_begin, int row_begin, int col_end, int row_end,
+                              function<vector<Color>(vector<Ray> &, vector<PCG> &)> &func, int packet_side){
+    FunctionKernel kernel{func};
+    trace_batches_in_region(col_begin, row_begin, col_end, row_end, kernel, packet_side);
+  }
+
+  /**
+   * Render the image with a kernel of known type, such as a renderer: the tiles are rendered on a pool of threads
+   * as in the multithreaded 'fire_ray_packets', and the blocks of pixels (or the samples of a pixel, with antialiasing)
+   * are passed to 'kernel.trace(rays, pcgs, colors)', that writes the color of each ray in 'colors'.
+   * The kernel is called directly instead of through a 'std::function' (and, being a 'final' renderer,
+   * with no virtual dispatch), and the buffers of the rays, of their generators and of their colors
+   * are reused by all the packets of a tile.
+   *
+   * @param kernel Object with a method 'void trace(vector<Ray> &, vector<PCG> &, vector<Color> &)'
+   * (called concurrently by all the threads)
+   * @param n_threads Number of threads (0: all the available cores)
+   * @param tile_size Side of the tiles (default RENDER_TILE_SIZE)
+   * @param packet_side Side of the blocks of pixels (default RAY_PACKET_SIDE)
+   */
+  template <typename Kernel> void fire_ray_batches(Kernel &kernel, int n_threads, int tile_size = RENDER_TILE_SIZE,
+                                                   int packet_side = RAY_PACKET_SIDE){
+    for_each_tile(n_threads, tile_size, [&](int col_begin, int row_begin, int col_end, int row_end) {
+      trace_batches_in_region(col_begin, row_begin, col_end, row_end, kernel, packet_side);
+    });
+  }
+
+  /**
+   * Adapter of the functions passed to 'fire_ray_packets' to the interface of the kernels
+   */
+  struct FunctionKernel {
+    function<vector<Color>(vector<Ray> &, vector<PCG> &)> &func;
+
+    void trace(vector<Ray> &rays, vector<PCG> &pcgs, vector<Color> &colors) { colors = func(rays, pcgs); }
+  };
+
+  /**
+   * Same as 'fire_rays_in_region', with the rays traced in packets by 'kernel' (see 'fire_ray_batches')
+   */
+  template <typename Kernel> void trace_batches_in_region(int col_begin, int row_begin, int col_end, int row_end,
+                                                          Kernel &kernel, int packet_side){
+
+    vector<Ray> rays;
+    vector<PCG> rngs;
+    vector<Color> colors;
+
+    if(samples_per_side > 0) {
+      for(int row{row_begin}; row<row_end; ++row){
+        for(int col{col_begin}; col<col_end; ++col){
+          rays.clear();
+          rngs.clear();
+          for(int pixel_row{};  pixel_row<samples_per_side; ++pixel_row) {
+            for(int pixel_col{};  pixel_col<samples_per_side; ++pixel_col) {
+              PCG sample_rng = sample_pcg(col, row, pixel_row * samples_per_side + pixel_col);
+              float u_pixel = (pixel_col + sample_rng.random_float()) / samples_per_side;
+              float v_pixel = (pixel_row + sample_rng.random_float()) / samples_per_side;
+              rays.push_back(fire_ray(col, row, u_pixel, v_pixel));
+              rngs.push_back(sample_rng);
+            }
+          }
+          colors.resize(rays.size());
+          kernel.trace(rays, rngs, colors);
+          Color cum_color = BLACK;
+          for(auto color : colors)
+            cum_color = cum_color + color;
+          image.set_pixel(col, row, cum_color * (1 / pow(samples_per_side,2)));
+        }
+      }
+      return;
+    }
+
+    for(int block_row{row_begin}; block_row<row_end; block_row += packet_side){
+      for(int block_col{col_begin}; block_col<col_end; block_col += packet_side){
+        int last_row = min(block_row + packet_side, row_end);
+        int last_col = min(block_col + packet_side, col_end);
+
+        rays.clear();
+        rngs.clear();
+        for(int row{block_row}; row<last_row; ++row){
+          for(int col{block_col}; col<last_col; ++col){
+            rays.push_back(fire_ray(col, row));
+            rngs.push_back(sample_pcg(col, row));
+          }
+        }
+
+        colors.resize(rays.size());
+        kernel.trace(rays, rngs, colors);
+        int i = 0;
+        for(int row{block_row}; row<last_row; ++row){
+          for(int col{block_col}; col<last_col; ++col)
+            image.set_pixel(col, row, colors[i++]);
+        }
+      }
+    }
+  }
+
+  /**
+   * Split the image in square tiles and render them on a pool of threads with a work-stealing 'TileScheduler',
+   * handing them out in the order 'tile_order'
+   *
+   * @param render_tile Function rendering the region [col_begin, col_end) x [row_begin, row_end)
+   */
+  template <typename TileFunction> void for_each_tile(int n_threads, int tile_size, TileFunction render_tile){
+
+    if (tile_size <= 0) tile_size = RENDER_TILE_SIZE;
+    TileScheduler scheduler(split_in_tiles(image.width, image.height, tile_size, tile_order));
+    scheduler.run(n_threads, [&](const Tile &tile) {
+      render_tile(tile.col_begin, tile.row_begin, tile.col_end, tile.row_end);
+    });
+    tile_stats = scheduler.stats;
+  }
 };
 
 #endif
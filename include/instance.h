@@ -0,0 +1,203 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bvh.h"
+#include "bvh_cache.h"
+#include "grid.h"
+#include "shapes.h"
+#include "sphere_set.h"
+#include "wide_bvh.h"
+#include <memory>
+#include <vector>
+
+#ifndef _instance_h_
+#define _instance_h_
+
+//––––––––––––– Struct ShapeGroup –––––––––––––––––––––––––
+/**
+ * A group of shapes sharing the same local reference frame, stored once together with its own
+ * bounding volume hierarchy and placed in the world any number of times through 'Instance'.
+ * Unbounded shapes (i.e. planes) are kept in a separate list that is always checked.
+ * The queries go through 'accelerator', which is the binary hierarchy itself, a structure derived from it or a grid
+ * (with no accelerator, every shape is checked).
+ *
+ * @param shapes The shapes of the group
+ * @param bvh The binary hierarchy over the bounded shapes (built by 'build_bvh' or 'build_accelerator', null for grids)
+ * @param accelerator The structure answering the queries over the bounded shapes
+ * @param accelerator_type The kind of 'accelerator'
+ * @param unbounded_shapes The shapes with no finite bounding box
+ * @param pack_spheres Whether the spheres are packed in 'SphereSet's of nearby spheres before building the accelerator
+ * (default: false)
+ * @param sphere_sets The sets of spheres stored in the accelerator in place of the single spheres, if packed
+ * @param typed_storage Whether the shapes checked one by one (the unbounded ones, or all of them with no accelerator)
+ * are copied in arrays sorted by type when the accelerator is built, so that they are checked with no virtual call (default: false)
+ * @param typed_shapes The arrays of the shapes checked one by one (null until built, or without 'typed_storage')
+ */
+struct ShapeGroup {
+
+  vector<shared_ptr<Shape>> shapes;
+  shared_ptr<BVH> bvh;
+  shared_ptr<Accelerator> accelerator;
+  AcceleratorType accelerator_type = AcceleratorType::BVH;
+  vector<shared_ptr<Shape>> unbounded_shapes;
+  bool pack_spheres = false;
+  vector<shared_ptr<SphereSet>> sphere_sets;
+  bool typed_storage = false;
+  shared_ptr<ShapeArrays> typed_shapes;
+
+  /**
+   * Add a new shape to the group (an already built hierarchy is discarded)
+   */
+  void add_shape(shared_ptr<Shape> s) {
+    shapes.push_back(s);
+    bvh.reset();
+    accelerator.reset();
+    unbounded_shapes.clear();
+    sphere_sets.clear();
+    typed_shapes.reset();
+  }
+
+  /**
+   * Build the binary bounding volume hierarchy over the bounded shapes of the group
+   *
+   * @param method The build strategy (default: SAH)
+   */
+  void build_bvh(BVHBuildMethod method = BVHBuildMethod::SAH) { build_accelerator(AcceleratorType::BVH, method); }
+
+  /**
+   * Build the given acceleration structure over the bounded shapes of the group
+   *
+   * @param type The kind of structure
+   * @param method The strategy used to build the binary hierarchy the structure is derived from, if any (default: SAH)
+   * @param cache Where the binary hierarchy is looked up before being built, and saved after (default: no cache)
+   */
+  void build_accelerator(AcceleratorType type, BVHBuildMethod method = BVHBuildMethod::SAH,
+                         shared_ptr<BVHCache> cache = nullptr);
+
+  /**
+   * Update the hierarchy after the transformations of the shapes have changed:
+   * the bounds are refitted, and the tree is rebuilt (with the same method) only if it has degraded too much.
+   * A missing hierarchy (or a grid) is built from scratch, and so is the whole accelerator if a packed sphere
+   * cannot stay in its set. The arrays of 'typed_storage' are copied again.
+   *
+   * @param max_degradation Maximum ratio between the SAH cost of the refitted tree and the one of the built tree
+   * @return true if the hierarchy was rebuilt, false if it was only refitted
+   */
+  bool update_bvh(float max_degradation = BVH_REBUILD_THRESHOLD);
+
+  /**
+   * Return the box enclosing all the shapes of the group, in the group reference frame
+   */
+  AABB bounding_box();
+
+  /**
+   * Find the distance of the closest intersection between the ray (in the group reference frame) and the shapes of the group
+   *
+   * @param ray Input ray to check: only the hits within [tmin, tmax] are considered
+   * @param hit Set to the closest hit, only if an intersection happens
+   * @return boolean value
+   */
+  bool hit_distance(Ray, HitDistance &);
+
+  /**
+   * Batch version of 'hit_distance' for coherent rays, traced together through the accelerator
+   *
+   * @param rays Input rays to check (in the group reference frame)
+   * @param hits Set to the closest hit of every ray, or to an empty 'HitDistance' (same size as 'rays')
+   */
+  void hit_distance(vector<Ray> &, vector<HitDistance> &);
+
+  /**
+   * Find the closest intersection between the ray (in the group reference frame) and the shapes of the group:
+   * the surface attributes are computed only for the closest hit found by 'hit_distance'
+   */
+  HitRecord ray_intersection(Ray);
+
+  /**
+   * Batch version of 'ray_intersection' for coherent rays, traced together through the accelerator
+   *
+   * @param rays Input rays to check (in the group reference frame)
+   * @param hits Set to the closest intersection of every ray (same size as 'rays')
+   */
+  void ray_intersection(vector<Ray> &, vector<HitRecord> &);
+
+  /**
+   * Check if the ray (in the group reference frame) hits any shape of the group
+   */
+  bool check_if_intersection(Ray);
+};
+
+//––––––––––––– Sub-struct Instance ––––––––––––––––––––––––
+/**
+ * A placement of a shared 'ShapeGroup' in the world: only the transformation
+ * (and optionally a material) belongs to the instance, the geometry and its hierarchy are shared.
+ * A ray is transformed into the group reference frame once per instance, whatever the number of shapes in the group.
+ *
+ * @param group The shared group of shapes
+ * @param transformation The transformation from the group reference frame to the world
+ * @param material The material replacing the ones of the group shapes (only if 'material_override' is true)
+ * @param material_override Whether 'material' replaces the materials of the group shapes
+ */
+struct Instance : public Shape {
+
+  shared_ptr<ShapeGroup> group;
+  bool material_override;
+
+  // No material is allocated when the instance keeps the materials of the group
+  Instance(shared_ptr<ShapeGroup> g, Transformation t = Transformation())
+      : Shape(t, Material(nullptr, nullptr)), group{g}, material_override{false} {}
+
+  Instance(shared_ptr<ShapeGroup> g, Transformation t, Material m)
+      : Shape(t, m), group{g}, material_override{true} {}
+
+  /**
+   * Check if the given ray hits any shape of the instance, computing only the distance of the hit
+   */
+  bool hit_distance(Ray, HitDistance &);
+
+  /**
+   * Compute all infos about an intersection found by 'hit_distance':
+   * the record of the shape hit inside the group (kept by 'hit_distance') is brought back to the world
+   */
+  HitRecord hit_record(Ray, HitDistance);
+
+  /**
+   * Check if the given ray hits any shape of the instance
+   *
+   * @param ray Input ray to check
+   * @return HitRecord struct containing all infos about the closest intersection
+   * (param 'init' set to false if no intersection happens)
+   */
+  HitRecord ray_intersection(Ray);
+
+  /**
+   * Check if the given ray hits any shape of the instance or not
+   *
+   * @param ray Input ray to check
+   * @return boolean value
+   */
+  bool check_if_intersection(Ray);
+
+  /**
+   * Return the bounding box of the transformed group
+   */
+  AABB bounding_box();
+};
+
+#endif
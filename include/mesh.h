@@ -0,0 +1,229 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bvh.h"
+#include "shapes.h"
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _mesh_h_
+#define _mesh_h_
+
+// Maximum number of triangles stored in a leaf of the hierarchy of a mesh
+#define MESH_MAX_LEAF_SIZE 4
+
+// Number of triangles from which the hierarchy of a mesh is built with the linear builder instead of the binned SAH one
+#define MESH_LINEAR_BUILD_THRESHOLD (1 << 20)
+
+/**
+ * Derived struct from runtime_error representing an error found while reading a mesh file
+ */
+struct InvalidMeshFileFormat : public runtime_error {
+  InvalidMeshFileFormat(const string &message) : runtime_error(message) {}
+};
+
+/**
+ * A triangle of a mesh, referring to the shared arrays of the mesh by index
+ *
+ * @param vertex Indices of the three vertices (counter-clockwise order)
+ * @param normal Indices of the normals of the three vertices (-1 if the triangle has no vertex normals)
+ */
+struct MeshTriangle {
+  int vertex[3];
+  int normal[3];
+};
+
+/**
+ * A read-only memory mapping of a whole file, released when the last mesh using it is destroyed
+ */
+struct MappedFile {
+  const char *data = nullptr;
+  size_t size = 0;
+
+  /**
+   * Map the file in memory; an 'InvalidMeshFileFormat' error is thrown if this is not possible
+   */
+  MappedFile(string file_name);
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile();
+};
+
+/**
+ * An array of records stored in place in a mapped file: the i-th record starts 'offset + i * stride' bytes
+ * after the beginning of the mapping (no alignment is assumed)
+ */
+struct MappedArray {
+  size_t offset = 0;
+  size_t stride = 0;
+  size_t size = 0;
+};
+
+//––––––––––––– Sub-struct Mesh ––––––––––––––––––––––––
+/**
+ * A triangle mesh: a list of triangles sharing the same arrays of vertices and normals
+ *
+ * The triangles are intersected in the space of the mesh with a watertight test (the rays passing through
+ * a shared edge or vertex always hit one of the triangles around it), after going through a bounding volume hierarchy
+ * of their own, so that a mesh is a single shape for the hierarchy of the world.
+ * The triangles without vertex normals are flat shaded.
+ *
+ * The vertices, the normals and the triangles are either owned by the mesh, or read in place from a memory-mapped file
+ * (see 'read_ply_file'): in the latter case only the hierarchy and the order of the triangles are kept in memory.
+ *
+ * @param transformation The transformation to apply to the mesh
+ * @param material The material of the whole mesh
+ * @param vertices The positions of the vertices
+ * @param normals The vertex normals (possibly empty)
+ * @param triangles The triangles, stored in leaf order (the face of a 'HitDistance' is an index of this array)
+ * @param nodes The nodes of the hierarchy, as in a 'BVH'
+ * @param method The build strategy of the hierarchy (binned SAH, or LBVH for the huge meshes)
+ * @param mapping The mapped file holding the arrays read in place (nullptr if the mesh owns all its data)
+ * @param mapped_vertices Vertices read in place, three floats per record ('vertices' is then empty)
+ * @param mapped_normals Vertex normals read in place, three floats per record ('normals' is then empty)
+ * @param mapped_triangles Triangles read in place, three 32-bit vertex indices per record ('triangles' is then empty):
+ * their normals are the vertex normals of the same index
+ * @param triangle_order Indices of the mapped triangles in leaf order
+ */
+struct Mesh : public Shape {
+
+  vector<Point> vertices;
+  vector<Normal> normals;
+  vector<MeshTriangle> triangles;
+  vector<BVHNode> nodes;
+  BVHBuildMethod method = BVHBuildMethod::BINNED_SAH;
+  BVHStats stats;
+
+  shared_ptr<MappedFile> mapping;
+  MappedArray mapped_vertices, mapped_normals, mapped_triangles;
+  vector<int> triangle_order;
+
+  /**
+   * Build the mesh and its hierarchy
+   *
+   * @param n_threads Number of threads used by the build (0: all the available cores)
+   */
+  Mesh(vector<Point> v = {}, vector<Normal> n = {}, vector<MeshTriangle> tri = {},
+       Transformation t = Transformation(), Material m = Material(), int n_threads = 0);
+
+  /**
+   * Build a mesh over the arrays of a mapped file and its hierarchy:
+   * the normals are optional (an array of size 0)
+   *
+   * @param n_threads Number of threads used by the build (0: all the available cores)
+   */
+  Mesh(shared_ptr<MappedFile> file, MappedArray v, MappedArray n, MappedArray tri,
+       Transformation t = Transformation(), Material m = Material(), int n_threads = 0);
+
+  /**
+   * Return the number of vertices and of triangles of the mesh
+   */
+  size_t n_vertices() { return mapping ? mapped_vertices.size : vertices.size(); }
+  size_t n_triangles() { return mapping ? mapped_triangles.size : triangles.size(); }
+
+  /**
+   * Return the i-th vertex or vertex normal
+   */
+  Point vertex(int i) {
+    if (!mapping) return vertices[i];
+    float xyz[3];
+    memcpy(xyz, mapping->data + mapped_vertices.offset + i * mapped_vertices.stride, sizeof(xyz));
+    return Point(xyz[0], xyz[1], xyz[2]);
+  }
+  Normal normal(int i) {
+    if (!mapping) return normals[i];
+    float xyz[3];
+    memcpy(xyz, mapping->data + mapped_normals.offset + i * mapped_normals.stride, sizeof(xyz));
+    return Normal(xyz[0], xyz[1], xyz[2]);
+  }
+
+  /**
+   * Return the i-th triangle in leaf order
+   */
+  MeshTriangle triangle(int i) {
+    if (!mapping) return triangles[i];
+    MeshTriangle tri;
+    memcpy(tri.vertex, mapping->data + mapped_triangles.offset + triangle_order[i] * mapped_triangles.stride,
+           sizeof(tri.vertex));
+    for (int k{}; k < 3; ++k)
+      tri.normal[k] = (mapped_normals.size > 0) ? tri.vertex[k] : -1;
+    return tri;
+  }
+
+  /**
+   * Check if the given ray hits the mesh, computing only the distance of the hit and the triangle hit
+   */
+  bool hit_distance(Ray, HitDistance &);
+
+  /**
+   * Compute all infos about the ray-mesh intersection found by 'hit_distance':
+   * the (u,v) coordinates of the surface point are the barycentric coordinates within the triangle
+   */
+  HitRecord hit_record(Ray, HitDistance);
+
+  /**
+   * Check if the given ray hits the mesh or not, stopping at the first triangle found
+   *
+   * @param ray Input ray to check
+   * @return boolean value
+   */
+  bool check_if_intersection(Ray);
+
+  /**
+   * Return the bounding box of the transformed mesh
+   */
+  AABB bounding_box();
+
+  /**
+   * Build the hierarchy over the triangles, then store them (or their indices) in leaf order
+   */
+  void build(int n_threads);
+};
+
+/**
+ * Read a triangle mesh from a Wavefront OBJ file.
+ * Only the vertices ('v'), the vertex normals ('vn') and the faces ('f') are read; polygons are split in fans of
+ * triangles. The file is read in one go and parsed in chunks by several threads, straight into the arrays of the mesh.
+ *
+ * @param file_name Path of the OBJ file
+ * @param transformation The transformation to apply to the mesh
+ * @param material The material of the mesh
+ * @param n_threads Number of threads used by the parser and by the build of the hierarchy (0: all the available cores)
+ * @return the mesh; an 'InvalidMeshFileFormat' error is thrown if the file cannot be read
+ */
+Mesh read_obj_file(string, Transformation = Transformation(), Material = Material(), int n_threads = 0);
+
+/**
+ * Read a triangle mesh from a binary little-endian PLY file.
+ * The file is memory-mapped: when the coordinates (and the normals 'nx', 'ny', 'nz') are three consecutive floats
+ * and all the faces are triangles with 32-bit indices, the mesh reads them in place (no copy is made);
+ * otherwise they are converted into arrays owned by the mesh (polygons are split in fans of triangles).
+ *
+ * @param file_name Path of the PLY file
+ * @param transformation The transformation to apply to the mesh
+ * @param material The material of the mesh
+ * @param n_threads Number of threads used by the build of the hierarchy (0: all the available cores)
+ * @return the mesh; an 'InvalidMeshFileFormat' error is thrown if the file cannot be read
+ */
+Mesh read_ply_file(string, Transformation = Transformation(), Material = Material(), int n_threads = 0);
+
+#endif
@@ -22,6 +22,22 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #ifndef _pcg_h_
 #define _pcg_h_
 
+// Multiplier of the linear congruential generator underlying the PCG
+#define PCG_MULTIPLIER 6364136223846793005ULL
+
+/**
+ * Mix the bits of a 64-bit integer (the finalizer of SplitMix64), so that close inputs give unrelated outputs:
+ * used to derive the seeds of independent generators from keys such as the coordinates of a pixel
+ */
+inline uint64_t mix_bits(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111eb;
+  x ^= x >> 31;
+  return x;
+}
+
 /**
  * A class implementing a PCG pseudo-random number generator
  *
@@ -47,7 +63,7 @@ public:
    */
   uint32_t random() {
     uint64_t oldstate = state;
-    state = uint64_t(oldstate * 6364136223846793005 + inc);
+    state = uint64_t(oldstate * PCG_MULTIPLIER + inc);
     // "^" is the xor operation
     uint32_t xorshifted = uint32_t(((oldstate >> 18) ^ oldstate) >> 27);
     uint32_t rot = oldstate >> 59;
@@ -61,6 +77,48 @@ public:
   float random_float() {
     return random() / float(0xffffffff);
   }
+
+  /**
+   * Skip the next 'delta' random numbers in O(log(delta)) steps, with the same result as calling 'random' 'delta' times.
+   * The period of the generator is 2^64, so that 'advance(-delta)' goes back by 'delta' numbers.
+   */
+  void advance(uint64_t delta) {
+    // The state after n steps is mult^n * state + (mult^(n-1) + ... + mult + 1) * inc: both factors are composed
+    // by squaring, one bit of 'delta' at a time
+    uint64_t cur_mult = PCG_MULTIPLIER, cur_plus = inc;
+    uint64_t acc_mult = 1, acc_plus = 0;
+    while (delta > 0) {
+      if (delta & 1) {
+        acc_mult *= cur_mult;
+        acc_plus = acc_plus * cur_mult + cur_plus;
+      }
+      cur_plus = (cur_mult + 1) * cur_plus;
+      cur_mult *= cur_mult;
+      delta /= 2;
+    }
+    state = acc_mult * state + acc_plus;
+  }
+
+  /**
+   * Return the generator of the given stream derived from this one, that is left unchanged.
+   * The seed and the sequence of the new generator are both hashed from the current state and the stream identifier,
+   * so that close identifiers (e.g. the indices of pixels or of workers) give uncorrelated generators,
+   * and the same identifier always gives the same generator.
+   */
+  PCG substream(uint64_t id) const {
+    uint64_t key = mix_bits(id);
+    return PCG(mix_bits(state ^ key), mix_bits(inc + key));
+  }
+
+  /**
+   * Return a new generator, seeded with random numbers drawn from this one (which is advanced by four steps):
+   * a tree of generators can be split from a single seed, e.g. one for each parallel worker
+   */
+  PCG split() {
+    uint64_t new_state = (uint64_t(random()) << 32) | random();
+    uint64_t new_seq = (uint64_t(random()) << 32) | random();
+    return PCG(new_state, new_seq);
+  }
 };
 
 #endif
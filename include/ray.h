@@ -31,6 +31,9 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
  @param tmin floating-point parameter identifing the "minimum distance" the ray travels (to be multiplied by 'dir', default 1e-5)
  @param tmax floating-point parameter identifing the "maximum distance" the ray travels (to be multiplied by 'dir', default INFINITY)
  @param depth integer parameter giving the number of reflections on surfaces (default 0)
+ @param inv_dir the component-wise inverse of 'dir' (infinite for null components), computed when the ray is built:
+ a ray whose direction changes must be built again
+ @param dir_is_neg whether each component of 'dir' is negative, i.e. which face of a box slab the ray enters first
  */
 struct Ray {
 
@@ -39,10 +42,24 @@ struct Ray {
   float tmin = 1e-5;
   float tmax = INFINITY;
   int depth = 0;
+  Vec inv_dir = Vec(INFINITY, INFINITY, INFINITY);
+  bool dir_is_neg[3] = {false, false, false};
 
   Ray(){};
-  Ray(Point o, Vec d) : origin{o}, dir{d} {}
-  Ray(Point o, Vec d, float tm, float tM, int n) : origin{o}, dir{d} , tmin{tm}, tmax{tM}, depth{n} {}
+  Ray(Point o, Vec d) : origin{o}, dir{d} { set_inverse_direction(); }
+  Ray(Point o, Vec d, float tm, float tM, int n) : origin{o}, dir{d} , tmin{tm}, tmax{tM}, depth{n} {
+    set_inverse_direction();
+  }
+
+  /**
+   Compute 'inv_dir' and 'dir_is_neg' from the direction
+   */
+  void set_inverse_direction() {
+    inv_dir = Vec(1. / dir.x, 1. / dir.y, 1. / dir.z);
+    dir_is_neg[0] = inv_dir.x < 0;
+    dir_is_neg[1] = inv_dir.y < 0;
+    dir_is_neg[2] = inv_dir.z < 0;
+  }
 
   /**
    Check if the ray is close enough to the given one to be considered the same
@@ -60,10 +77,25 @@ struct Ray {
   /**
    Return the transformed ray (origin and direction)
    */
-  Ray transform(const Transformation T){
+  Ray transform(const Transformation &T){
     Ray newray((T*origin), (T*dir), tmin, tmax, depth);
     return newray;
   }
+
+  /**
+   Return the ray transformed by the inverse of the given (affine) transformation,
+   e.g. from world to shape coordinates: faster than 'transform(T.inverse())'
+   */
+  Ray inverse_transform(const Transformation &T) const {
+    return with_kind(T.kind, [&](auto tag) { return inverse_transform<decltype(tag)::value>(T); });
+  }
+
+  /**
+   Version of 'inverse_transform' specialized for transformations of kind 'K'
+   */
+  template <TransformationKind K> Ray inverse_transform(const Transformation &T) const {
+    return Ray(T.inverse_apply<K>(origin), T.inverse_apply<K>(dir), tmin, tmax, depth);
+  }
 };
 
 #endif
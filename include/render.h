@@ -44,6 +44,45 @@ struct Renderer {
    * If the given 'Ray' hits a shape, it returns the evaluated radiance (i.e. 'Color') according to the implemented rendering algorithm, otherwise it returns the background color.
    */
   virtual Color operator()(Ray ray) = 0;
+
+  /**
+   * Estimates the total radiance along each of the given rays (e.g. the primary rays of a block of pixels).
+   * By default the rays are traced one at a time; renderers whose cost is dominated by the primary rays
+   * trace them together (see 'World::ray_intersection').
+   */
+  virtual vector<Color> operator()(vector<Ray> &rays) {
+    vector<Color> colors(rays.size());
+    for (int i{}; i < rays.size(); ++i)
+      colors[i] = (*this)(rays[i]);
+    return colors;
+  }
+
+  /**
+   * Same as the call operators, but drawing the random numbers (if any) from the given PCG instead of
+   * a member of the renderer, so that several threads can share the same renderer (see 'ImageTracer::fire_all_rays').
+   * The renderers that draw no random numbers just call the operators.
+   */
+  virtual Color trace(Ray ray, PCG &) { return (*this)(ray); }
+
+  /**
+   * Batch version of 'trace', used as a render kernel by 'ImageTracer::fire_ray_batches':
+   * each ray draws its random numbers from the PCG of the same index, and its color is written in 'colors'
+   * (already sized as 'rays'). The renderers are declared 'final', so that a kernel of known type calls
+   * its own 'trace' with no virtual dispatch for each ray.
+   */
+  virtual void trace(vector<Ray> &rays, vector<PCG> &pcgs, vector<Color> &colors) {
+    for (int i{}; i < rays.size(); ++i)
+      colors[i] = trace(rays[i], pcgs[i]);
+  }
+
+  /**
+   * Same as the previous one, returning the colors
+   */
+  vector<Color> trace(vector<Ray> &rays, vector<PCG> &pcgs) {
+    vector<Color> colors(rays.size());
+    trace(rays, pcgs, colors);
+    return colors;
+  }
 };
 
 //––––––––––––– Sub-struct OnOffRender ––––––––––––––––––––––––
@@ -55,7 +94,7 @@ struct Renderer {
  *
  * @param color of the world's shapes hit by a ray
  */
-struct OnOffRenderer : public Renderer {
+struct OnOffRenderer final : public Renderer {
   Color color;
 
   OnOffRenderer(World w, Color bc = BLACK, Color c = WHITE)
@@ -68,6 +107,22 @@ struct OnOffRenderer : public Renderer {
       return background_color;
     }
   }
+
+  vector<Color> operator()(vector<Ray> &rays) {
+    vector<Color> colors(rays.size());
+    vector<PCG> no_pcgs;
+    trace(rays, no_pcgs, colors);
+    return colors;
+  }
+
+  using Renderer::trace;
+  void trace(vector<Ray> &rays, vector<PCG> &, vector<Color> &colors) {
+    vector<HitRecord> hits(rays.size());
+    world.ray_intersection(rays, hits);
+
+    for (int i{}; i < rays.size(); ++i)
+      colors[i] = hits[i].init ? color : background_color;
+  }
 };
 
 //––––––––––––– Sub-struct FlatRender ––––––––––––––––––––––––
@@ -76,13 +131,32 @@ struct OnOffRenderer : public Renderer {
  * it estimates the solution of the rendering equation neglecting any contribution of the light
  * it uses the pigment of each surface to compute the final radiance
  */
-struct FlatRenderer : public Renderer {
+struct FlatRenderer final : public Renderer {
 
   FlatRenderer(World w, Color bc = BLACK) : Renderer(w, bc) {}
 
-  Color operator()(Ray ray) {
+  Color operator()(Ray ray) { return radiance(world.ray_intersection(ray)); }
 
-    HitRecord hit = world.ray_intersection(ray);
+  vector<Color> operator()(vector<Ray> &rays) {
+    vector<Color> colors(rays.size());
+    vector<PCG> no_pcgs;
+    trace(rays, no_pcgs, colors);
+    return colors;
+  }
+
+  using Renderer::trace;
+  void trace(vector<Ray> &rays, vector<PCG> &, vector<Color> &colors) {
+    vector<HitRecord> hits(rays.size());
+    world.ray_intersection(rays, hits);
+
+    for (int i{}; i < rays.size(); ++i)
+      colors[i] = radiance(hits[i]);
+  }
+
+  /**
+   * Return the color of the surface hit (or the background color if no hit happened)
+   */
+  Color radiance(HitRecord hit) {
 
     if (!hit.init) {
 
@@ -106,7 +180,7 @@ struct FlatRenderer : public Renderer {
  * @param russian_roulette_limit allows the algorithm to complete the calculation
  even if max_depth is set to infinity, using the Roussian roulette method
  */
-struct PathTracer : public Renderer {
+struct PathTracer final : public Renderer {
 
   PCG pcg;
   int num_of_rays;
@@ -116,7 +190,15 @@ struct PathTracer : public Renderer {
   PathTracer(World w, Color bc = BLACK, PCG _pcg = PCG(), int nrays = 10, int maxd = 2, int rrlim = 3)
       : Renderer(w, bc), pcg{_pcg}, num_of_rays{nrays}, max_depth{maxd}, russian_roulette_limit{rrlim} {}
 
-  Color operator()(Ray ray) {
+  Color operator()(Ray ray) { return trace(ray, pcg); }
+
+  using Renderer::trace;
+  void trace(vector<Ray> &rays, vector<PCG> &pcgs, vector<Color> &colors) {
+    for (int i{}; i < rays.size(); ++i)
+      colors[i] = trace(rays[i], pcgs[i]);
+  }
+
+  Color trace(Ray ray, PCG &pcg) {
     
     if (ray.depth > max_depth)
       return BLACK;
@@ -148,7 +230,7 @@ struct PathTracer : public Renderer {
       for (int i{}; i < num_of_rays; ++i){
         Ray new_ray = hit_material.brdf->scatter_ray(pcg, hit.ray.dir, hit.world_point, hit.normal, (ray.depth + 1));
         // Recursive call
-        Color new_radiance = (*this)(new_ray);
+        Color new_radiance = trace(new_ray, pcg);
         cum_radiance = cum_radiance + hit_color * new_radiance;
       }
     }
@@ -161,16 +243,40 @@ struct PathTracer : public Renderer {
  * A simple point-linght renderer based on the POV-Ray algorithm.
  *
  * @param ambient_color default Color(0.1,0.1,0.1)
+ * @param light_positions positions of the world's lights, gathered once for the batched visibility checks
  */
-struct PointLightTracer : public Renderer {
+struct PointLightTracer final : public Renderer {
   
   Color ambient_color;
+  vector<Point> light_positions;
   
   PointLightTracer(World w, Color bc = BLACK, Color amb_col = Color(0.1,0.1,0.1))
-  : Renderer(w, bc), ambient_color{amb_col} {}
+  : Renderer(w, bc), ambient_color{amb_col} {
+    for(auto light : world.lights)
+      light_positions.push_back(light.position);
+  }
   
+
+  using Renderer::trace;
+  void trace(vector<Ray> &rays, vector<PCG> &, vector<Color> &colors) {
+    // The buffers of the shadow rays are shared by all the hits of the batch
+    vector<Ray> shadow_rays;
+    vector<bool> visible;
+    for (int i{}; i < rays.size(); ++i)
+      colors[i] = shade(rays[i], shadow_rays, visible);
+  }
   
   Color operator()(Ray ray) {
+    vector<Ray> shadow_rays;
+    vector<bool> visible;
+    return shade(ray, shadow_rays, visible);
+  }
+
+  /**
+   * Return the color seen along the ray: 'shadow_rays' and 'visible' are scratch buffers
+   * for the visibility checks (see 'World::are_points_visible'), reused from a hit to the next
+   */
+  Color shade(Ray ray, vector<Ray> &shadow_rays, vector<bool> &visible) {
       
     HitRecord hit = world.ray_intersection(ray);
 
@@ -180,11 +286,14 @@ struct PointLightTracer : public Renderer {
     Material hit_material = hit.material;
     
     Color total_color(ambient_color);
+
+    // All the shadow rays of the hit point are checked together
+    world.are_points_visible(light_positions, hit.world_point, shadow_rays, visible);
     
     for(int l{}; l < world.lights.size(); ++l){
       
-      PointLight each_light(world.lights[l]);
-      if(world.is_point_visible(each_light.position, hit.world_point)){
+      PointLight &each_light = world.lights[l];
+      if(visible[l]){
         
         Vec distance_vec = hit.world_point - each_light.position;
         float distance = distance_vec.norm();
@@ -18,6 +18,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "imagetracer.h"
+#include "mesh.h"
 #include "render.h"
 #include <iostream>
 #include <unordered_map>
@@ -52,6 +53,9 @@ enum class Keyword {
   PLANE,
   SPHERE,
   BOX,
+  MESH,
+  GROUP,
+  INSTANCE,
   LIGHT,
   DIFFUSE,
   SPECULAR,
@@ -102,7 +106,7 @@ union TokenValue {
  */
 struct Token {
   SourceLocation location;
-  TokenType type;
+  TokenType type = TokenType::STOPTOKEN;
   TokenValue value;
 
   Token(SourceLocation loc = SourceLocation()) : location{loc} {}
@@ -132,10 +136,16 @@ struct Token {
  */
 struct Scene {
   unordered_map<string, Material> materials;
+  unordered_map<string, shared_ptr<ShapeGroup>> groups;
   World world;
   shared_ptr<Camera> camera;
   unordered_map<string, float> float_variables;
   vector<string> overridden_variables;
+  BVHBuildMethod bvh_method = BVHBuildMethod::SAH;
+  AcceleratorType accelerator_type = AcceleratorType::BVH;
+  shared_ptr<BVHCache> bvh_cache;
+  bool pack_spheres = false;
+  bool typed_storage = false;
 };
 
 
@@ -335,6 +345,30 @@ struct InputStream {
    */
   Box parse_box(Scene);
 
+  /**
+   * Create a Mesh if a sequence of characters follows the order mesh(material, string, transformation),
+   * where the string is the path of an OBJ file or of a PLY file (with the extension '.ply')
+   *
+   * @return read_obj_file/read_ply_file(string, transformation, scene.materials[material_name])
+   */
+  Mesh parse_mesh(Scene);
+
+  /**
+   * Create a ShapeGroup if a sequence of characters follows the order identifier(shape, shape, ...),
+   * where each shape is a sphere, a plane, a box, a mesh or an instance of a previously defined group
+   *
+   * @return tuple with the name of the group and the group itself (with its hierarchy already built)
+   */
+  tuple<string, shared_ptr<ShapeGroup>> parse_group(Scene);
+
+  /**
+   * Create an Instance if a sequence of characters follows the order instance(group, transformation)
+   * or instance(group, material, transformation), the latter replacing the materials of the group shapes
+   *
+   * @return Instance(scene.groups[group_name], transformation) or Instance(scene.groups[group_name], transformation, scene.materials[material_name])
+   */
+  Instance parse_instance(Scene);
+
   /**
    * Create a PointLight if a sequence of characters follows the order light(point, color, float)
    *
@@ -353,9 +387,17 @@ struct InputStream {
   /**
    * Read from the input stream and create the scene
    *
+   * @param variables Float variables defined outside the scene file
+   * @param bvh_method Strategy used to build the bounding volume hierarchies (default: SAH)
+   * @param accelerator_type Acceleration structure of the world and of the groups (default: binary BVH)
+   * @param cache_directory Directory where the bounding volume hierarchies are cached (default: empty, no cache)
+   * @param pack_spheres Whether the spheres are packed in sets intersected with SIMD instructions (default: false)
+   * @param typed_storage Whether the shapes checked one by one are stored in arrays sorted by type (default: false)
    * @return Scene
    */
-  Scene parse_scene (unordered_map<string, float>);
+  Scene parse_scene (unordered_map<string, float>, BVHBuildMethod bvh_method = BVHBuildMethod::SAH,
+                     AcceleratorType accelerator_type = AcceleratorType::BVH, string cache_directory = "",
+                     bool pack_spheres = false, bool typed_storage = false);
   
 };
 
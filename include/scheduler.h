@@ -0,0 +1,110 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#ifndef _scheduler_h_
+#define _scheduler_h_
+
+/**
+ * Order in which the tiles of an image are handed out to the rendering threads
+ */
+enum class TileOrder {
+  ROWS,
+  HILBERT,
+  SPIRAL,
+};
+
+/**
+ * Return the name of the tile order (as accepted by the command line)
+ */
+string tile_order_name(TileOrder);
+
+/**
+ * A rectangular region [col_begin, col_end) x [row_begin, row_end) of the image
+ *
+ * @param index Position of the tile in row-major order (independent of the order the tiles are rendered in)
+ */
+struct Tile {
+  int col_begin, row_begin, col_end, row_end;
+  int index;
+};
+
+/**
+ * Split an image in square tiles (the last ones may be cut at the border) and sort them:
+ * - ROWS: row by row
+ * - HILBERT: along a Hilbert curve, so that consecutive tiles are adjacent (but where the curve leaves the image)
+ * - SPIRAL: from the center outwards, the part of the image that is usually most interesting
+ */
+vector<Tile> split_in_tiles(int width, int height, int tile_size, TileOrder order = TileOrder::HILBERT);
+
+//––––––––––––– Struct SchedulerStats –––––––––––––––––––––––––
+/**
+ * Load balance of the threads of the last 'TileScheduler::run'
+ *
+ * @param n_tiles Number of tiles rendered by each thread
+ * @param n_stolen Number of those tiles the thread stole from the others
+ * @param busy_ms Time spent by each thread rendering its tiles, in milliseconds
+ * @param idle_ms Time spent by each thread looking for work or waiting for the others to finish, in milliseconds
+ * @param wall_ms Wall-clock time of the whole run, in milliseconds
+ */
+struct SchedulerStats {
+  vector<int> n_tiles, n_stolen;
+  vector<double> busy_ms, idle_ms;
+  double wall_ms = 0.;
+
+  /**
+   * Return a printable string with the statistics (one line per thread)
+   */
+  string get_string();
+};
+
+//––––––––––––– Struct TileScheduler –––––––––––––––––––––––––
+/**
+ * A work-stealing scheduler of the tiles of an image
+ *
+ * The sorted tiles are split in as many contiguous runs as the threads, so that each thread starts from a compact
+ * region of the image. A thread takes its tiles from the front of its own run; once the run is over,
+ * it steals the tiles from the back of the longest run left, until all the tiles are done.
+ * A run is a single atomic word (its first and last tile), so that taking and stealing need no lock.
+ *
+ * @param tiles The tiles, in the order they are handed out
+ * @param stats Load balance of the last run
+ */
+struct TileScheduler {
+  vector<Tile> tiles;
+  SchedulerStats stats;
+
+  TileScheduler(vector<Tile> t = {}) : tiles{t} {}
+
+  /**
+   * Render all the tiles on a pool of threads
+   *
+   * @param n_threads Number of threads (0: all the available cores)
+   * @param render_tile Function rendering a tile (called concurrently by all the threads)
+   */
+  void run(int n_threads, function<void(const Tile &)> render_tile);
+};
+
+#endif
@@ -17,11 +17,14 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include "aabb.h"
 #include "geometry.h"
 #include "materials.h"
 #include "ray.h"
 #include "transformation.h"
+#include <memory>
 #include <string>
+#include <vector>
 
 #ifndef _shapes_h_
 #define _shapes_h_
@@ -66,7 +69,8 @@ struct HitRecord {
   Material material;
   bool init = false;
 
-  HitRecord() { init = false; }
+  // No material is allocated for the records of missed rays, which are never shaded
+  HitRecord() : material{nullptr, nullptr} { init = false; }
 
   HitRecord(Point wp, Normal n, Vec2d sp, float T, Ray r, Material m = Material())
       : world_point(wp), normal(n), surface_point(sp), t(T), ray(r), material{m} {
@@ -81,13 +85,76 @@ struct HitRecord {
   }
 };
 
+//––––––––––––– Struct HitDistance –––––––––––––––––––––––––
+// Number of nested instances whose hits keep the shapes hit inside them (see 'HitDistance')
+#define HIT_MAX_INNER_SHAPES 4
+
+/**
+ * The result of the first, cheap phase of an intersection: only the distance and what is hit,
+ * from which the full 'HitRecord' is computed once the closest hit is known (see 'Shape::hit_record')
+ *
+ * When the shape hit is an instance, the shapes hit inside it are kept as well (the shape hit in its group,
+ * then, if that is an instance too, the one hit in the group of the latter, and so on), so that the record
+ * is computed by the innermost shape with no new search: see 'inner_hit'.
+ *
+ * @param t The distance between the origin of the ray and the hit point (INFINITY if no intersection happens)
+ * @param shape The shape hit (null if no intersection happens), not owned
+ * @param face The part of the shape hit (e.g. the face of a box)
+ * @param n_inner Number of shapes hit inside 'shape' that are kept (0 if 'shape' is not an instance, or if the instances
+ * are nested more than HIT_MAX_INNER_SHAPES times)
+ * @param inner_shapes The shapes hit inside 'shape', from the outermost to the innermost
+ * @param inner_face The part of the innermost shape hit
+ */
+struct HitDistance {
+
+  float t = INFINITY;
+  Shape *shape = nullptr;
+  int face = 0;
+  int n_inner = 0;
+  Shape *inner_shapes[HIT_MAX_INNER_SHAPES];
+  int inner_face = 0;
+
+  HitDistance() {}
+  HitDistance(float T, Shape *s, int f = 0) : t{T}, shape{s}, face{f} {}
+
+  /**
+   * Return the hit of the first inner shape (only if 'n_inner' > 0), as it was found in the group of 'shape'
+   */
+  HitDistance inner_hit() {
+    HitDistance inner(t, inner_shapes[0], (n_inner == 1) ? inner_face : 0);
+    inner.n_inner = n_inner - 1;
+    for (int i{}; i < inner.n_inner; ++i)
+      inner.inner_shapes[i] = inner_shapes[i + 1];
+    inner.inner_face = inner_face;
+    return inner;
+  }
+
+  /**
+   * Return the hit of the given shape (an instance) whose group had this hit, keeping this one as its inner hit
+   * (if there is still room for it)
+   */
+  HitDistance outer_hit(Shape *outer) {
+    HitDistance outer_hit(t, outer);
+    if (n_inner < HIT_MAX_INNER_SHAPES) {
+      outer_hit.n_inner = n_inner + 1;
+      outer_hit.inner_shapes[0] = shape;
+      for (int i{}; i < n_inner; ++i)
+        outer_hit.inner_shapes[i + 1] = inner_shapes[i];
+      outer_hit.inner_face = (n_inner > 0) ? inner_face : face;
+    }
+    return outer_hit;
+  }
+};
+
 //––––––––––––– Abstract struct Shapes ––––––––––––––––––––––––
 /**
  * A generic 3D shape (sphere, plane, box)
  *
  * It is an abstract stuct
- * with virtual methods ray_intersection(Ray) and check_if_intersection(Ray)
- * to be implemented in derived structs
+ * with virtual methods hit_distance(Ray, HitDistance &), hit_record(Ray, HitDistance) and check_if_intersection(Ray)
+ * to be implemented in derived structs.
+ * An intersection is found in two phases: 'hit_distance' only computes the distance of the hit,
+ * 'hit_record' the surface attributes of the closest one (so that the hits left behind by closer ones cost little).
  *
  * @param transformation The transformation to apply to the shape
  * @param material The material of the shape
@@ -100,14 +167,49 @@ struct Shape {
   Shape(Transformation t = Transformation(), Material m = Material())
       : transformation{t}, material{m} {}
 
-  virtual HitRecord ray_intersection(Ray) = 0;
+  /**
+   * Check if the given ray hits the shape, computing only the distance of the hit
+   *
+   * @param ray Input ray to check: only the hits within [tmin, tmax] are considered
+   * @param hit Set to the distance and the part of the shape hit, only if an intersection happens
+   * @return boolean value
+   */
+  virtual bool hit_distance(Ray, HitDistance &) = 0;
+
+  /**
+   * Compute all infos about an intersection found by 'hit_distance' with the same ray
+   */
+  virtual HitRecord hit_record(Ray, HitDistance) = 0;
+
+  /**
+   * Check if the given ray hits the shape, going through both phases
+   *
+   * @param ray Input ray to check
+   * @return HitRecord struct containing all infos about the intersection
+   * (param 'init' set to false if no intersection happens)
+   */
+  virtual HitRecord ray_intersection(Ray ray) {
+    HitDistance hit;
+    return hit_distance(ray, hit) ? hit_record(ray, hit) : HitRecord();
+  }
+
   virtual bool check_if_intersection(Ray) = 0;
+
+  /**
+   * Return an axis-aligned box enclosing the shape in world coordinates.
+   * Shapes that do not override it are considered unbounded, which is always a safe (conservative) answer.
+   */
+  virtual AABB bounding_box() { return AABB::unbounded(); }
 };
 
 //––––––––––––– Sub-struct Sphere ––––––––––––––––––––––––
 /**
  * A 3D unit sphere centered on the origin
  *
+ * A sphere placed with a translation and a uniform scaling (the usual case) is round: it is intersected directly
+ * in world space, from the center and the radius read in the matrix, with no transformation of the ray,
+ * of the hit point or of the normal. The other spheres (ellipsoids) are intersected in the unit sphere space.
+ *
  * @param transformation The transformation to apply to the unit sphere
  * @param material The material of the sphere
  */
@@ -117,13 +219,14 @@ struct Sphere : public Shape {
       : Shape(t, m) {}
 
   /**
-   * Check if the given ray hits the sphere
-   *
-   * @param Ray Input ray to check
-   * @return HitRecord struct containing all infos about the ray-sphere intersection 
-   * (param 'init' set to false if no intersection happens)
+   * Check if the given ray hits the sphere, computing only the distance of the hit
+   */
+  bool hit_distance(Ray, HitDistance &);
+
+  /**
+   * Compute all infos about the ray-sphere intersection found by 'hit_distance'
    */
-  HitRecord ray_intersection(Ray);
+  HitRecord hit_record(Ray, HitDistance);
 
   /**
    * Check if the given ray hits the sphere or not
@@ -132,6 +235,37 @@ struct Sphere : public Shape {
    * @return boolean value
    */
   bool check_if_intersection(Ray);
+
+  /**
+   * Versions of 'hit_distance', 'hit_record' and 'check_if_intersection' specialized for a transformation of kind 'K':
+   * the virtual functions pick the right one once per ray
+   */
+  template <TransformationKind K> bool distance(Ray, HitDistance &);
+  template <TransformationKind K> HitRecord record(Ray, HitDistance);
+  template <TransformationKind K> bool check_intersection(Ray);
+
+  /**
+   * Check if the transformation is made of a translation and a uniform scaling only,
+   * i.e. if the sphere is round: its center is then the translation and its radius the scale factor
+   * (checked from the matrix, so that it follows any change of the transformation)
+   */
+  bool is_round() const {
+    return transformation.kind <= TransformationKind::SCALING && transformation.m[0][0] == transformation.m[1][1] &&
+           transformation.m[1][1] == transformation.m[2][2];
+  }
+
+  /**
+   * Versions of 'hit_distance', 'hit_record' and 'check_if_intersection' for round spheres (see 'is_round'),
+   * working in world space
+   */
+  bool round_distance(Ray, HitDistance &);
+  HitRecord round_record(Ray, HitDistance);
+  bool round_check(Ray);
+
+  /**
+   * Return the bounding box of the transformed unit sphere (the tightest one, even for rotated ellipsoids)
+   */
+  AABB bounding_box();
 };
 
 //––––––––––––– Sub-struct Plane ––––––––––––––––––––––––
@@ -147,13 +281,14 @@ struct Plane : public Shape {
       : Shape(t, m) {}
 
   /**
-   * Check if the given ray hits the plane
-   *
-   * @param ray Input ray to check
-   * @return HitRecord struct containing all infos about the ray-plane intersection
-   * (param 'init' set to false if no intersection happens)
+   * Check if the given ray hits the plane, computing only the distance of the hit
+   */
+  bool hit_distance(Ray, HitDistance &);
+
+  /**
+   * Compute all infos about the ray-plane intersection found by 'hit_distance'
    */
-  HitRecord ray_intersection(Ray);
+  HitRecord hit_record(Ray, HitDistance);
 
   /**
    * Check if the given ray hits the plane or not
@@ -162,6 +297,19 @@ struct Plane : public Shape {
    * @return boolean value
    */
   bool check_if_intersection(Ray);
+
+  /**
+   * Versions of 'hit_distance', 'hit_record' and 'check_if_intersection' specialized for a transformation of kind 'K':
+   * the virtual functions pick the right one once per ray
+   */
+  template <TransformationKind K> bool distance(Ray, HitDistance &);
+  template <TransformationKind K> HitRecord record(Ray, HitDistance);
+  template <TransformationKind K> bool check_intersection(Ray);
+
+  /**
+   * A plane is infinite: return an unbounded box
+   */
+  AABB bounding_box();
 };
 
 //––––––––––––– Sub-struct Box ––––––––––––––––––––––––
@@ -170,8 +318,9 @@ struct Plane : public Shape {
  *
  * @param transformation The transformation to apply to the box
  * @param material The material of the box
- * @param Pmin A vertex of the box
- * @param Pmax The opposite vertex
+ * @param Pmin The vertex with the smallest coordinates (the two vertices given are sorted, so that the slab test
+ * can pick the entry face of each axis from the sign of the ray direction)
+ * @param Pmax The opposite vertex, with the largest coordinates
  *
  */
 struct Box : public Shape {
@@ -180,16 +329,18 @@ struct Box : public Shape {
 
   Box(Point pmin = Point(0, 0, 0), Point pmax = Point(1, 1, 1),
       Transformation t = Transformation(), Material m = Material())
-      : Shape(t, m), Pmin{pmin}, Pmax{pmax} {}
+      : Shape(t, m), Pmin{fmin(pmin.x, pmax.x), fmin(pmin.y, pmax.y), fmin(pmin.z, pmax.z)},
+        Pmax{fmax(pmin.x, pmax.x), fmax(pmin.y, pmax.y), fmax(pmin.z, pmax.z)} {}
 
   /**
-   * Check if the given ray hits the box
-   *
-   * @param ray Input ray to check
-   * @return HitRecord struct containing all infos about the ray-box intersection
-   * (param 'init' set to false if no intersection happens)
+   * Check if the given ray hits the box, computing only the distance of the hit
+   */
+  bool hit_distance(Ray, HitDistance &);
+
+  /**
+   * Compute all infos about the ray-box intersection found by 'hit_distance'
    */
-  HitRecord ray_intersection(Ray);
+  HitRecord hit_record(Ray, HitDistance);
 
   /**
    * Check if the given ray hits the box or not
@@ -199,6 +350,19 @@ struct Box : public Shape {
    */
   bool check_if_intersection(Ray);
 
+  /**
+   * Versions of 'hit_distance', 'hit_record' and 'check_if_intersection' specialized for a transformation of kind 'K':
+   * the virtual functions pick the right one once per ray
+   */
+  template <TransformationKind K> bool distance(Ray, HitDistance &);
+  template <TransformationKind K> HitRecord record(Ray, HitDistance);
+  template <TransformationKind K> bool check_intersection(Ray);
+
+  /**
+   * Return the bounding box of the transformed box
+   */
+  AABB bounding_box();
+
   /**
    * Convert a 3D box point to 2D (u,v) coordinates on one face of the box
    */
@@ -215,4 +379,45 @@ struct Box : public Shape {
   Normal box_normal(int, Vec);
 };
 
+//––––––––––––– Struct ShapeArrays ––––––––––––––––––––––––
+/**
+ * A list of shapes stored by type: the spheres, planes and boxes are copied into contiguous arrays of their own type,
+ * scanned with direct (inlined) calls to their kernels instead of virtual calls through shared pointers.
+ * Any other shape (e.g. an instance, or a custom shape derived from 'Shape') is kept in 'others' and checked as usual.
+ * The copies do not follow later changes of the original shapes: the arrays must be built again.
+ *
+ * @param spheres The copies of the spheres
+ * @param planes The copies of the planes
+ * @param boxes The copies of the boxes
+ * @param others The remaining shapes
+ */
+struct ShapeArrays {
+
+  vector<Sphere> spheres;
+  vector<Plane> planes;
+  vector<Box> boxes;
+  vector<shared_ptr<Shape>> others;
+
+  /**
+   * Sort the given shapes by type (only the exact types are copied, so that derived shapes are not sliced)
+   */
+  ShapeArrays(const vector<shared_ptr<Shape>> &);
+
+  /**
+   * Find the distance of the closest intersection between the ray and the shapes (see 'Shape::hit_distance'):
+   * the hits refer to the copies, which can compute their records as long as the arrays exist
+   */
+  bool hit_distance(Ray, HitDistance &);
+
+  /**
+   * Check if the given ray hits any of the shapes, stopping at the first one found
+   */
+  bool check_if_intersection(Ray);
+
+  /**
+   * Return the number of shapes
+   */
+  size_t size() { return spheres.size() + planes.size() + boxes.size() + others.size(); }
+};
+
 #endif
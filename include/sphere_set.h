@@ -0,0 +1,146 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "shapes.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef _sphere_set_h_
+#define _sphere_set_h_
+
+// Maximum number of spheres packed in a set (one AVX register of floats)
+#define SPHERE_SET_SIZE 8
+
+/**
+ * Instruction sets usable by the batched kernels:
+ * - SCALAR: plain C++, one sphere at a time
+ * - SSE: 4 spheres per instruction (always available on x86-64)
+ * - AVX2: 8 spheres per instruction
+ */
+enum class SimdLevel {
+  SCALAR,
+  SSE,
+  AVX2,
+};
+
+/**
+ * Return the best instruction set supported by the CPU running the program (detected once, at the first call)
+ */
+SimdLevel best_simd_level();
+
+/**
+ * Return the name of the instruction set
+ */
+string simd_level_name(SimdLevel);
+
+//––––––––––––– Sub-struct SphereSet ––––––––––––––––––––––––
+/**
+ * A small set of spheres stored as a structure of arrays, so that a ray is intersected with several of them at once.
+ * Only spheres whose transformation has a diagonal linear part (see 'can_pack') are accepted. They are either round
+ * (see 'Sphere::is_round'), stored by center and squared radius, or ellipsoids aligned with the axes, stored by
+ * the map from world to sphere coordinates, which along each axis is x' = x * scale + offset.
+ *
+ * The batched kernels compute the distance of the hits with the same operations as 'Sphere' (in world space for
+ * the round spheres, in sphere space for the ellipsoids), so the results are exactly the ones of the single spheres.
+ * A hit refers to the set, with the index of the sphere as face: its record is computed by the sphere,
+ * through a call that is not virtual.
+ *
+ * @param spheres The spheres of the set
+ * @param members The spheres of the set, as plain pointers (padded with null pointers to SPHERE_SET_SIZE)
+ * @param center Center of each round sphere, per axis
+ * @param radius2 Squared radius of each round sphere
+ * @param scale Scale of the world-to-sphere map of each ellipsoid, per axis
+ * @param offset Offset of the world-to-sphere map of each ellipsoid, per axis
+ * @param material_id Index in 'materials' of the material of each sphere
+ * @param materials The materials of the spheres, each stored once
+ * @param round_mask The bit mask of the round spheres
+ * @param box The bounding box of the spheres
+ * @param simd The instruction set used by the kernels (default: the best one available)
+ */
+struct SphereSet : public Shape {
+
+  vector<shared_ptr<Sphere>> spheres;
+  Sphere *members[SPHERE_SET_SIZE];
+  float center[3][SPHERE_SET_SIZE];
+  float radius2[SPHERE_SET_SIZE];
+  float scale[3][SPHERE_SET_SIZE];
+  float offset[3][SPHERE_SET_SIZE];
+  int material_id[SPHERE_SET_SIZE];
+  vector<Material> materials;
+  unsigned int round_mask;
+  AABB box;
+  SimdLevel simd;
+
+  /**
+   * Pack the given spheres (at most SPHERE_SET_SIZE, each accepted by 'can_pack')
+   */
+  SphereSet(vector<shared_ptr<Sphere>> s);
+
+  /**
+   * Check if a sphere can be stored in a set
+   */
+  static bool can_pack(Sphere &);
+
+  /**
+   * Read the transformations and the materials of the spheres again, after they have changed
+   *
+   * @return false if some sphere cannot be packed any more (the set is then left unchanged)
+   */
+  bool update();
+
+  /**
+   * Intersect the ray with all the spheres at once, with the batched kernel
+   *
+   * @param ray Input ray to check
+   * @param t Output: the distance of the hit of each sphere (only meaningful for the spheres hit)
+   * @return the bit mask of the spheres hit within [ray.tmin, ray.tmax]
+   */
+  unsigned int intersect(Ray &ray, float t[SPHERE_SET_SIZE]);
+
+  /**
+   * Find the distance of the closest intersection between the ray and the spheres of the set
+   * (on equal distances, the first sphere is hit, as in a scan of the single spheres)
+   *
+   * @param ray Input ray to check
+   * @param hit Set to the closest hit, only if an intersection happens
+   * @return boolean value
+   */
+  bool hit_distance(Ray, HitDistance &);
+
+  /**
+   * Compute all infos about an intersection found by 'hit_distance', through the sphere hit
+   */
+  HitRecord hit_record(Ray, HitDistance);
+
+  /**
+   * Check if the given ray hits any sphere of the set
+   *
+   * @param ray Input ray to check
+   * @return boolean value
+   */
+  bool check_if_intersection(Ray);
+
+  /**
+   * Return the box enclosing all the spheres of the set
+   */
+  AABB bounding_box() { return box; }
+};
+
+#endif
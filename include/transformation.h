@@ -19,6 +19,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "functions.h"
 #include "geometry.h"
+#include <type_traits>
 
 #ifndef _transformation_h_
 #define _transformation_h_
@@ -29,6 +30,98 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define VEC_Y Vec(0.0, 1.0, 0.0)
 #define VEC_Z Vec(0.0, 0.0, 1.0)
 
+//–––––––––––––––––––––– Transformation kinds –––––––––––––––––––––––––––––––––––
+
+/**
+ * The kinds of transformation, from the cheapest to the most expensive to apply:
+ * - IDENTITY: nothing to do
+ * - TRANSLATION: a translation only
+ * - SCALING: a scaling along the axes, possibly followed by a translation (diagonal linear part)
+ * - RIGID: a rotation, possibly followed by a translation
+ * - GENERAL: any other transformation, e.g. a rotated non-uniform scaling or a matrix given explicitly
+ * The kind is tracked as transformations are composed, and only guarantees which entries of the matrices are zero.
+ */
+enum class TransformationKind {
+  IDENTITY,
+  TRANSLATION,
+  SCALING,
+  RIGID,
+  GENERAL,
+};
+
+/**
+ * Return the kind of the product of two transformations of the given kinds
+ */
+TransformationKind compose_kinds(TransformationKind, TransformationKind);
+
+template <TransformationKind K> using TransformationKindTag = integral_constant<TransformationKind, K>;
+
+/**
+ * Call 'f' with a 'TransformationKindTag' of the given kind, so that 'f' can instantiate the kernel specialized for it:
+ * the kind is checked once, instead of at every point transformed
+ *
+ * Example: with_kind(t.kind, [&](auto tag) { return t.apply<decltype(tag)::value>(p); })
+ */
+template <typename F> decltype(auto) with_kind(TransformationKind kind, F f) {
+  switch (kind) {
+  case TransformationKind::IDENTITY:
+    return f(TransformationKindTag<TransformationKind::IDENTITY>());
+  case TransformationKind::TRANSLATION:
+    return f(TransformationKindTag<TransformationKind::TRANSLATION>());
+  case TransformationKind::SCALING:
+    return f(TransformationKindTag<TransformationKind::SCALING>());
+  case TransformationKind::RIGID:
+    return f(TransformationKindTag<TransformationKind::RIGID>());
+  default:
+    return f(TransformationKindTag<TransformationKind::GENERAL>());
+  }
+}
+
+/**
+ * Apply the first three rows of a matrix to a point, as an affine map, skipping the terms that are zero for the kind
+ */
+template <TransformationKind K> inline Point affine_point(const float m[4][4], const Point &p) {
+  if constexpr (K == TransformationKind::IDENTITY)
+    return p;
+  else if constexpr (K == TransformationKind::TRANSLATION)
+    return Point(p.x + m[0][3], p.y + m[1][3], p.z + m[2][3]);
+  else if constexpr (K == TransformationKind::SCALING)
+    return Point(p.x * m[0][0] + m[0][3], p.y * m[1][1] + m[1][3], p.z * m[2][2] + m[2][3]);
+  else
+    return Point(p.x * m[0][0] + p.y * m[0][1] + p.z * m[0][2] + m[0][3],
+                 p.x * m[1][0] + p.y * m[1][1] + p.z * m[1][2] + m[1][3],
+                 p.x * m[2][0] + p.y * m[2][1] + p.z * m[2][2] + m[2][3]);
+}
+
+/**
+ * Apply the linear part of a matrix to a vector, skipping the terms that are zero for the kind
+ */
+template <TransformationKind K> inline Vec affine_vec(const float m[4][4], const Vec &v) {
+  if constexpr (K == TransformationKind::IDENTITY || K == TransformationKind::TRANSLATION)
+    return v;
+  else if constexpr (K == TransformationKind::SCALING)
+    return Vec(v.x * m[0][0], v.y * m[1][1], v.z * m[2][2]);
+  else
+    return Vec(v.x * m[0][0] + v.y * m[0][1] + v.z * m[0][2],
+               v.x * m[1][0] + v.y * m[1][1] + v.z * m[1][2],
+               v.x * m[2][0] + v.y * m[2][1] + v.z * m[2][2]);
+}
+
+/**
+ * Apply the transposed linear part of a matrix to a normal (normals are transformed by the transposed inverse),
+ * skipping the terms that are zero for the kind
+ */
+template <TransformationKind K> inline Normal affine_normal(const float invm[4][4], const Normal &n) {
+  if constexpr (K == TransformationKind::IDENTITY || K == TransformationKind::TRANSLATION)
+    return n;
+  else if constexpr (K == TransformationKind::SCALING)
+    return Normal(n.x * invm[0][0], n.y * invm[1][1], n.z * invm[2][2]);
+  else
+    return Normal(n.x * invm[0][0] + n.y * invm[1][0] + n.z * invm[2][0],
+                  n.x * invm[0][1] + n.y * invm[1][1] + n.z * invm[2][1],
+                  n.x * invm[0][2] + n.y * invm[1][2] + n.z * invm[2][2]);
+}
+
 //–––––––––––––––––––––– Functions for Transformation –––––––––––––––––––––––––––––––––––
 
 bool are_matr_close(float [4][4], float [4][4]);
@@ -43,6 +136,7 @@ void matr_prod(const float [4][4], const float [4][4], float [4][4]);
  *
  * @param m transformation matrix
  * @param invm inverse transformation matrix, implemented to increase the code efficiency
+ * @param kind which entries of the matrices are known to be zero (GENERAL when unknown)
  */
 struct Transformation {
 
@@ -56,9 +150,11 @@ struct Transformation {
                       {0.0, 0.0, 1.0, 0.0},
                       {0.0, 0.0, 0.0, 1.0}};
 
+  TransformationKind kind = TransformationKind::IDENTITY;
+
   Transformation(){};
 
-  Transformation(float [4][4], float [4][4]);
+  Transformation(float [4][4], float [4][4], TransformationKind k = TransformationKind::GENERAL);
   
   /**
    * Return a printable strings showing the transformation matrix content
@@ -81,13 +177,34 @@ struct Transformation {
    */
   Transformation inverse();
 
+  /**
+   * Apply the inverse transformation to a point, reading the first three rows of 'invm' as a 3x4 affine matrix:
+   * unlike 'inverse() * p', no matrix is copied and there is no division by the homogeneous coordinate
+   */
+  Point inverse_apply(const Point &p) const { return affine_point<TransformationKind::GENERAL>(invm, p); }
+
+  /**
+   * Apply the inverse transformation to a vector (see 'inverse_apply(Point)')
+   */
+  Vec inverse_apply(const Vec &v) const { return affine_vec<TransformationKind::GENERAL>(invm, v); }
+
+  /**
+   * Versions of 'inverse_apply' and of the products with points, vectors and normals specialized for the kind 'K',
+   * which must be the kind of the transformation (or a more general one)
+   */
+  template <TransformationKind K> Point inverse_apply(const Point &p) const { return affine_point<K>(invm, p); }
+  template <TransformationKind K> Vec inverse_apply(const Vec &v) const { return affine_vec<K>(invm, v); }
+  template <TransformationKind K> Point apply(const Point &p) const { return affine_point<K>(m, p); }
+  template <TransformationKind K> Vec apply(const Vec &v) const { return affine_vec<K>(m, v); }
+  template <TransformationKind K> Normal apply(const Normal &n) const { return affine_normal<K>(invm, n); }
+
 };
 
 //–––––––––––––– Operations –––––––––––––––
-Transformation operator*(Transformation, Transformation);
-Point operator*(Transformation, Point);
-Vec operator*(Transformation, Vec);
-Normal operator*(Transformation, Normal);
+Transformation operator*(const Transformation &, const Transformation &);
+Point operator*(const Transformation &, Point);
+Vec operator*(const Transformation &, Vec);
+Normal operator*(const Transformation &, Normal);
 
 //–––––––––––––– Transformations –––––––––––––––
 /**
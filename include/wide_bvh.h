@@ -0,0 +1,115 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bvh.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#ifndef _wide_bvh_h_
+#define _wide_bvh_h_
+
+// Number of children of a node of the wide hierarchy (one per SIMD lane)
+#define WIDE_BVH_WIDTH 4
+
+//––––––––––––– Struct WideBVHNode –––––––––––––––––––––––––
+/**
+ * A node of the wide hierarchy, filling exactly one cache line.
+ * The child boxes are stored on an 8-bit grid spanning the node: along each axis the grid starts at 'origin'
+ * and has a power-of-two spacing, so that each child bound is 'origin + q * 2^exponent'.
+ * Bounds are rounded outwards, so a child box always contains the original one.
+ *
+ * @param origin The lowest corner of the node
+ * @param exponent The spacing of the grid along each axis, as a power of two
+ * @param n_children Number of children actually used
+ * @param qmin Lower bounds of the children, per axis (one byte per child, so that all the children are loaded together)
+ * @param qmax Upper bounds of the children, per axis
+ * @param child Index of the child node (inner child) or of the first primitive (leaf child)
+ * @param count Number of primitives of a leaf child (0 for inner children)
+ */
+struct alignas(64) WideBVHNode {
+  float origin[3];
+  int8_t exponent[3];
+  uint8_t n_children = 0;
+  uint8_t qmin[3][WIDE_BVH_WIDTH];
+  uint8_t qmax[3][WIDE_BVH_WIDTH];
+  int32_t child[WIDE_BVH_WIDTH];
+  uint8_t count[WIDE_BVH_WIDTH];
+};
+
+static_assert(sizeof(WideBVHNode) == 64, "A node of the wide BVH must fill one cache line");
+
+//––––––––––––– Struct WideBVH –––––––––––––––––––––––––
+/**
+ * A 4-ary bounding volume hierarchy, obtained by collapsing a binary one:
+ * a ray is tested against the four children of a node at once, using SSE instructions when available.
+ *
+ * @param nodes The nodes of the tree (the root is nodes[0])
+ * @param primitives The shapes, in the same order as in the binary hierarchy
+ */
+struct WideBVH : public Accelerator {
+
+  vector<WideBVHNode> nodes;
+  vector<shared_ptr<Shape>> primitives;
+
+  /**
+   * Build the wide hierarchy by collapsing the given binary one:
+   * each node adopts the largest descendants of its binary counterpart, up to four of them
+   *
+   * @param bvh The binary hierarchy (its leaves must hold less than 256 shapes)
+   */
+  WideBVH(BVH &bvh);
+
+  /**
+   * Return the bounding box of the whole hierarchy (in its quantized form)
+   */
+  AABB bounding_box();
+
+  /**
+   * Find the distance of the closest intersection between the ray and the shapes in the hierarchy.
+   * Inner children are visited front-to-back and subtrees farther than the closest hit are skipped.
+   *
+   * @param ray Input ray to check
+   * @param hit Set to the closest hit, only if an intersection happens
+   * @return boolean value
+   */
+  bool hit_distance(Ray, HitDistance &);
+
+  /**
+   * Check if the given ray hits any shape in the hierarchy, stopping at the first one found
+   *
+   * @param ray Input ray to check
+   * @return boolean value
+   */
+  bool check_if_intersection(Ray);
+
+  /**
+   * Return the memory used by the nodes and by the list of primitives, in bytes
+   */
+  size_t memory_footprint() { return nodes.size() * sizeof(WideBVHNode) + primitives.size() * sizeof(shared_ptr<Shape>); }
+
+  /**
+   * Append the wide node replacing the given binary node (and recursively its subtree)
+   *
+   * @return the index of the new node
+   */
+  int collapse(BVH &, int);
+};
+
+#endif
@@ -17,6 +17,7 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include "instance.h"
 #include "shapes.h"
 #include "lights.h"
 #include <vector>
@@ -31,19 +32,15 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
  * Shapes can be added to a world using the method `add_shape`
  * Lights can be added to a world using the method `add_light`
  * The method `ray_intersection` can be used to check whether a light ray intersects any of the shapes in the world
+ * Once all the shapes have been added, `build_bvh` creates a bounding volume hierarchy that speeds up the intersections
+ * (or `build_accelerator` any other acceleration structure);
+ * unbounded shapes (i.e. planes) are kept in a separate list that is always checked (see 'ShapeGroup');
+ * when only the transformations of the shapes change (e.g. between animation frames), `update_bvh` refits it instead
  */
-struct World {
+struct World : public ShapeGroup {
 
-  vector<shared_ptr<Shape>> shapes;
   vector<PointLight> lights;
 
-  /**
-   * Add a new shape to the world
-   */
-  void add_shape(shared_ptr<Shape> s){
-    shapes.push_back(s);
-  }
-  
 /**
  * Add a new light to the world
  */
@@ -51,36 +48,109 @@ void add_light(PointLight l){
   lights.push_back(l);
 }
 
+  /**
+   * Restrict [tmin, tmax] of the ray to the populated region of the world
+   *
+   * @return false if the ray cannot hit any shape
+   */
+  bool clip_ray(Ray &ray){
+    return bounding_box().clip(ray);
+  }
+
   /**
    * Check whether a light ray intersects any of the shapes in the world 
    */
   HitRecord ray_intersection(Ray ray){
     HitRecord closest;
-    for(int i{}; i<shapes.size(); ++i){
-      HitRecord intersection = shapes[i]->ray_intersection(ray);
-      if(intersection.init){
-        if(!closest.init || intersection.t < closest.t){
-          closest = intersection;
-          closest.normal.normalize();
-        }
-      }
-    } 
+    // The world bounds are cached in the hierarchy: clip the ray only once it is built
+    if(accelerator && !clip_ray(ray)) return closest;
+
+    closest = ShapeGroup::ray_intersection(ray);
+    if(closest.init) closest.normal.normalize();
     return closest;
   }
-  
+
   /**
-   * Check whether a point is visible form an observer point of view (pov), with no shape in the middle
+   * Batch version of 'ray_intersection' for coherent rays (e.g. the primary rays of a block of pixels):
+   * the rays that can hit the world are traced together through the hierarchy, with the same results
+   *
+   * @param rays Input rays to check
+   * @param hits Set to the closest intersection of every ray (same size as 'rays')
    */
-  bool is_point_visible (Point point, Point observer_pov){
+  void ray_intersection(vector<Ray> &rays, vector<HitRecord> &hits){
+    // The rays that cannot hit any shape are given an empty range, so that the packets keep their layout
+    vector<Ray> clipped(rays);
+    if(accelerator){
+      for(auto &ray : clipped){
+        if(!clip_ray(ray)) ray.tmax = -INFINITY;
+      }
+    }
+
+    ShapeGroup::ray_intersection(clipped, hits);
+    for(auto &hit : hits){
+      if(hit.init) hit.normal.normalize();
+    }
+  }
+
+  /**
+   * Return the ray going from the observer point of view (pov) to the point,
+   * ending at the point and starting a bit away from the observer (to avoid self-intersections)
+   */
+  Ray visibility_ray(Point point, Point observer_pov){
     Vec dir = point - observer_pov;
     float dir_norm = dir.norm();
-    
-    Ray ray(observer_pov, dir, 1e-2/dir_norm, 1., 0);
-    
-    for(int s{}; s < shapes.size(); ++s){
-      if(shapes[s]->check_if_intersection(ray)) return false;
+    return Ray(observer_pov, dir, 1e-2/dir_norm, 1., 0);
+  }
+
+  /**
+   * Check whether a point is visible form an observer point of view (pov), with no shape in the middle.
+   * The search stops at the first shape found in between.
+   */
+  bool is_point_visible (Point point, Point observer_pov){
+    return !check_if_intersection(visibility_ray(point, observer_pov));
+  }
+
+  /**
+   * Check which of the given points (e.g. the positions of the lights) are visible from the same
+   * observer point of view (e.g. a surface point), with no shape in the middle.
+   * It gives the same results as calling 'is_point_visible' for every point, but the rays share a single traversal of the hierarchy.
+   * The buffers are owned by the caller, so that they can be reused from a point to the next with no allocation.
+   *
+   * @param rays Scratch buffer for the visibility rays
+   * @param visible Output: the visibility of each point
+   */
+  void are_points_visible(const vector<Point> &points, Point observer_pov, vector<Ray> &rays, vector<bool> &visible){
+    rays.clear();
+    for(auto &point : points)
+      rays.push_back(visibility_ray(point, observer_pov));
+
+    // The occluded points are marked first, then the flags are flipped
+    visible.assign(points.size(), false);
+    vector<shared_ptr<Shape>> &candidates = accelerator ? unbounded_shapes : shapes;
+    for(int r{}; r < rays.size(); ++r){
+      if(typed_shapes){
+        visible[r] = typed_shapes->check_if_intersection(rays[r]);
+        continue;
+      }
+      for(int s{}; s < candidates.size(); ++s){
+        if(candidates[s]->check_if_intersection(rays[r])){
+          visible[r] = true;
+          break;
+        }
+      }
     }
-    return true;
+    if(accelerator) accelerator->check_if_intersection(rays, visible);
+    visible.flip();
+  }
+
+  /**
+   * Same as the previous one, returning the visibility of each point
+   */
+  vector<bool> are_points_visible(const vector<Point> &points, Point observer_pov){
+    vector<Ray> rays;
+    vector<bool> visible;
+    are_points_visible(points, observer_pov, rays, visible);
+    return visible;
   }
 };
 
@@ -0,0 +1,840 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bvh.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+// Subtrees with fewer primitives are not worth a new thread
+#define BVH_PARALLEL_THRESHOLD 4096
+
+// Minimum number of primitives binned by each thread
+#define BVH_PARALLEL_BINNING_CHUNK 32768
+
+//––––––––––––– Functions for Struct BVH –––––––––––––––––––––––––
+
+string bvh_method_name(BVHBuildMethod method) {
+  if (method == BVHBuildMethod::SAH) return "sah";
+  else if (method == BVHBuildMethod::BINNED_SAH) return "binned";
+  else if (method == BVHBuildMethod::MIDPOINT) return "fast";
+  else return "lbvh";
+}
+
+string BVHStats::get_string() {
+  ostringstream stream;
+  stream << n_nodes << " nodes, " << n_leaves << " leaves, max depth " << max_depth << ", SAH cost "
+         << sah_cost << ", built in " << build_time_ms << " ms using " << n_threads << " thread(s)";
+  if (cached) stream << " (loaded from cache)";
+  return stream.str();
+}
+
+//––––––––––––– Struct BVHBuilder –––––––––––––––––––––––––
+
+struct BuildPrimitive {
+  AABB box;
+  Point centroid;
+  int index;
+  unsigned int code = 0;
+};
+
+/**
+ * Spread the lowest 10 bits of an integer, so that two zero bits separate each of them
+ */
+inline unsigned int expand_bits(unsigned int v) {
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+struct Bin {
+  AABB box;
+  int count = 0;
+};
+
+/**
+ * Helper struct building the nodes of a BVH.
+ * Big subtrees are handed to new threads, as long as the thread budget allows it:
+ * each of them fills its own list of nodes, which is then appended to the parent's one.
+ *
+ * @param method The build strategy
+ * @param max_leaf_size Maximum number of shapes stored in a leaf
+ * @param spare_threads Number of threads that can still be started
+ * @param prims The primitives, reordered in place while the tree is built
+ */
+struct BVHBuilder {
+
+  BVHBuildMethod method;
+  int max_leaf_size;
+  atomic<int> spare_threads;
+  vector<BuildPrimitive> prims;
+
+  BVHBuilder(BVHBuildMethod m, int max_leaf, int n_threads)
+      : method{m}, max_leaf_size{max_leaf}, spare_threads{n_threads - 1} {}
+
+  /**
+   * Try to reserve a thread from the budget
+   */
+  bool take_thread() {
+    if (spare_threads.fetch_sub(1) > 0) return true;
+    spare_threads.fetch_add(1);
+    return false;
+  }
+
+  void release_thread() { spare_threads.fetch_add(1); }
+
+  /**
+   * Split [0, n) in 'n_parts' contiguous chunks and process each of them in its own thread
+   */
+  template <typename Function> void parallel_for(int n, int n_parts, Function f) {
+    vector<thread> workers;
+    for (int part{1}; part < n_parts; ++part)
+      workers.push_back(thread(f, part, n * part / n_parts, n * (part + 1) / n_parts));
+    f(0, 0, n / n_parts);
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  /**
+   * Compute the Morton codes of the centroids and sort the primitives along the curve,
+   * with a parallel least-significant-digit radix sort (one pass per axis)
+   */
+  void sort_morton(int n_threads) {
+
+    int n = prims.size();
+    int n_parts = (n >= BVH_PARALLEL_THRESHOLD) ? n_threads : 1;
+    int n_buckets = 1 << BVH_MORTON_BITS;
+
+    AABB centroid_box;
+    for (auto &p : prims)
+      centroid_box.expand(p.centroid);
+    float scale[3];
+    for (int a{}; a < 3; ++a) {
+      float extent = coordinate(centroid_box.pmax, a) - coordinate(centroid_box.pmin, a);
+      scale[a] = (extent > 0.) ? n_buckets / extent : 0.;
+    }
+
+    parallel_for(n, n_parts, [&](int, int begin, int end) {
+      for (int i{begin}; i < end; ++i) {
+        unsigned int code = 0;
+        for (int a{}; a < 3; ++a) {
+          int cell = int((coordinate(prims[i].centroid, a) - coordinate(centroid_box.pmin, a)) * scale[a]);
+          code |= expand_bits(min(max(cell, 0), n_buckets - 1)) << (2 - a);
+        }
+        prims[i].code = code;
+      }
+    });
+
+    vector<BuildPrimitive> sorted(n);
+    vector<int> offsets(n_parts * n_buckets);
+    for (int pass{}; pass < 3; ++pass) {
+      int shift = pass * BVH_MORTON_BITS;
+      fill(offsets.begin(), offsets.end(), 0);
+
+      // Count the digits of each chunk...
+      parallel_for(n, n_parts, [&](int part, int begin, int end) {
+        for (int i{begin}; i < end; ++i)
+          offsets[part * n_buckets + ((prims[i].code >> shift) & (n_buckets - 1))]++;
+      });
+
+      // ...turn the counts into the first position of each digit of each chunk...
+      int total = 0;
+      for (int bucket{}; bucket < n_buckets; ++bucket) {
+        for (int part{}; part < n_parts; ++part) {
+          int count = offsets[part * n_buckets + bucket];
+          offsets[part * n_buckets + bucket] = total;
+          total += count;
+        }
+      }
+
+      // ...and scatter the primitives, keeping the order of the previous pass
+      parallel_for(n, n_parts, [&](int part, int begin, int end) {
+        for (int i{begin}; i < end; ++i)
+          sorted[offsets[part * n_buckets + ((prims[i].code >> shift) & (n_buckets - 1))]++] = prims[i];
+      });
+      prims.swap(sorted);
+    }
+  }
+
+  /**
+   * Append the nodes of a subtree, shifting the child indices of its interior nodes
+   */
+  void append(vector<BVHNode> &nodes, vector<BVHNode> &subtree) {
+    int base = nodes.size();
+    for (auto &node : subtree) {
+      if (!node.is_leaf()) node.offset += base;
+      nodes.push_back(node);
+    }
+  }
+
+  /**
+   * Build the subtree over prims[begin, end), appending its nodes to 'nodes' in depth-first order
+   * (child indices are relative to the start of 'nodes')
+   */
+  void build(int begin, int end, int depth, vector<BVHNode> &nodes) {
+
+    int node_index = nodes.size();
+    nodes.push_back(BVHNode());
+
+    // The linear builder splits on the Morton codes alone: its boxes are merged bottom-up
+    bool bottom_up = method == BVHBuildMethod::LBVH;
+
+    AABB box, centroid_box;
+    if (!bottom_up) {
+      for (int i{begin}; i < end; ++i) {
+        box.expand(prims[i].box);
+        centroid_box.expand(prims[i].centroid);
+      }
+      nodes[node_index].box = box;
+    }
+
+    int axis;
+    int mid = bottom_up ? split_morton(begin, end, depth, axis) : split(begin, end, depth, box, centroid_box, axis);
+    if (mid < 0) {
+      nodes[node_index].offset = begin;
+      nodes[node_index].count = end - begin;
+      if (bottom_up) {
+        for (int i{begin}; i < end; ++i)
+          nodes[node_index].box.expand(prims[i].box);
+      }
+      return;
+    }
+    nodes[node_index].axis = axis;
+
+    if (end - begin >= BVH_PARALLEL_THRESHOLD && take_thread()) {
+      vector<BVHNode> left, right;
+      thread worker([&]() { build(begin, mid, depth + 1, left); });
+      build(mid, end, depth + 1, right);
+      worker.join();
+      release_thread();
+
+      append(nodes, left);
+      nodes[node_index].offset = nodes.size();
+      append(nodes, right);
+
+    } else {
+      build(begin, mid, depth + 1, nodes);
+      nodes[node_index].offset = nodes.size();
+      build(mid, end, depth + 1, nodes);
+    }
+
+    if (bottom_up)
+      nodes[node_index].box = merge(nodes[node_index + 1].box, nodes[nodes[node_index].offset].box);
+  }
+
+  /**
+   * Choose how to split prims[begin, end)
+   *
+   * @return the index of the first primitive of the second child, or -1 if a leaf must be created
+   */
+  int split(int begin, int end, int depth, AABB &box, AABB &centroid_box, int &axis) {
+
+    int n = end - begin;
+    if (n == 1) return -1;
+
+    bool degenerate = centroid_box.pmin.x == centroid_box.pmax.x &&
+                      centroid_box.pmin.y == centroid_box.pmax.y &&
+                      centroid_box.pmin.z == centroid_box.pmax.z;
+
+    // Coincident centroids (or a tree too deep): fall back on a median split
+    if (degenerate || depth >= BVH_MAX_DEPTH / 2) {
+      if (n <= max_leaf_size) return -1;
+      return split_median(begin, end, centroid_box, axis);
+    }
+
+    if (method == BVHBuildMethod::SAH)
+      return split_sah(begin, end, box, centroid_box, axis);
+    else if (method == BVHBuildMethod::BINNED_SAH)
+      return split_binned(begin, end, box, centroid_box, axis);
+    else
+      return split_midpoint(begin, end, centroid_box, axis);
+  }
+
+  /**
+   * Decide whether a leaf is cheaper than the best split found, according to the SAH
+   */
+  bool leaf_is_cheaper(int n, float best_cost, AABB &box) {
+    if (n > max_leaf_size) return false;
+    float parent_area = box.surface_area();
+    float split_cost = SAH_TRAVERSAL_COST +
+                       ((parent_area > 0.) ? SAH_INTERSECTION_COST * best_cost / parent_area : 0.);
+    return SAH_INTERSECTION_COST * n <= split_cost;
+  }
+
+  void sort_along(int begin, int end, int axis) {
+    sort(prims.begin() + begin, prims.begin() + end,
+         [axis](const BuildPrimitive &a, const BuildPrimitive &b) {
+           return coordinate(a.centroid, axis) < coordinate(b.centroid, axis);
+         });
+  }
+
+  int split_median(int begin, int end, AABB &centroid_box, int &axis) {
+    axis = centroid_box.largest_axis();
+    int mid = begin + (end - begin) / 2;
+    nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+                [axis](const BuildPrimitive &a, const BuildPrimitive &b) {
+                  return coordinate(a.centroid, axis) < coordinate(b.centroid, axis);
+                });
+    return mid;
+  }
+
+  // Sweep the sorted primitives along each axis, evaluating the SAH cost of every split
+  int split_sah(int begin, int end, AABB &box, AABB &centroid_box, int &axis) {
+
+    int n = end - begin;
+    float best_cost = INFINITY;
+    int best_split = -1, sorted_axis = -1;
+    vector<float> right_area(n);
+
+    for (int a{}; a < 3; ++a) {
+      if (coordinate(centroid_box.pmin, a) == coordinate(centroid_box.pmax, a)) continue;
+
+      sort_along(begin, end, a);
+      sorted_axis = a;
+
+      AABB right;
+      for (int i{n - 1}; i > 0; --i) {
+        right.expand(prims[begin + i].box);
+        right_area[i] = right.surface_area();
+      }
+
+      AABB left;
+      for (int i{1}; i < n; ++i) {
+        left.expand(prims[begin + i - 1].box);
+        float cost = left.surface_area() * i + right_area[i] * (n - i);
+        if (cost < best_cost) {
+          best_cost = cost;
+          axis = a;
+          best_split = i;
+        }
+      }
+    }
+
+    if (leaf_is_cheaper(n, best_cost, box)) return -1;
+    if (sorted_axis != axis) sort_along(begin, end, axis);
+    return begin + best_split;
+  }
+
+  int bin_index(BuildPrimitive &p, int a, AABB &centroid_box, float scale) {
+    int b = int((coordinate(p.centroid, a) - coordinate(centroid_box.pmin, a)) * scale);
+    return min(max(b, 0), BVH_N_BINS - 1);
+  }
+
+  void fill_bins(int begin, int end, AABB &centroid_box, float scale[3], Bin bins[3][BVH_N_BINS]) {
+    for (int i{begin}; i < end; ++i) {
+      for (int a{}; a < 3; ++a) {
+        if (scale[a] == 0.) continue;
+        Bin &bin = bins[a][bin_index(prims[i], a, centroid_box, scale[a])];
+        bin.box.expand(prims[i].box);
+        bin.count++;
+      }
+    }
+  }
+
+  // Evaluate the SAH cost at the boundaries of a fixed number of bins per axis
+  int split_binned(int begin, int end, AABB &box, AABB &centroid_box, int &axis) {
+
+    int n = end - begin;
+    float scale[3];
+    for (int a{}; a < 3; ++a) {
+      float extent = coordinate(centroid_box.pmax, a) - coordinate(centroid_box.pmin, a);
+      scale[a] = (extent > 0.) ? BVH_N_BINS / extent : 0.;
+    }
+
+    // Big nodes are binned in parallel: each thread fills its own bins, which are merged afterwards
+    int n_parts = 1;
+    while (n_parts < 16 && n / (n_parts + 1) >= BVH_PARALLEL_BINNING_CHUNK && take_thread())
+      n_parts++;
+
+    vector<Bin> part_bins(n_parts * 3 * BVH_N_BINS);
+    auto bins_of = [&](int part) { return (Bin(*)[BVH_N_BINS]) & part_bins[part * 3 * BVH_N_BINS]; };
+
+    parallel_for(n, n_parts, [&](int part, int first, int last) {
+      fill_bins(begin + first, begin + last, centroid_box, scale, bins_of(part));
+    });
+    for (int part{1}; part < n_parts; ++part)
+      release_thread();
+
+    Bin(*bins)[BVH_N_BINS] = bins_of(0);
+    for (int part{1}; part < n_parts; ++part) {
+      for (int a{}; a < 3; ++a) {
+        for (int b{}; b < BVH_N_BINS; ++b) {
+          bins[a][b].box.expand(bins_of(part)[a][b].box);
+          bins[a][b].count += bins_of(part)[a][b].count;
+        }
+      }
+    }
+
+    float best_cost = INFINITY;
+    int best_bin = -1;
+    for (int a{}; a < 3; ++a) {
+      if (scale[a] == 0.) continue;
+
+      float right_area[BVH_N_BINS];
+      int right_count[BVH_N_BINS];
+      AABB right;
+      int count = 0;
+      for (int b{BVH_N_BINS - 1}; b > 0; --b) {
+        right.expand(bins[a][b].box);
+        count += bins[a][b].count;
+        right_area[b] = right.surface_area();
+        right_count[b] = count;
+      }
+
+      AABB left;
+      count = 0;
+      for (int b{1}; b < BVH_N_BINS; ++b) {
+        left.expand(bins[a][b - 1].box);
+        count += bins[a][b - 1].count;
+        if (count == 0 || right_count[b] == 0) continue;
+        float cost = left.surface_area() * count + right_area[b] * right_count[b];
+        if (cost < best_cost) {
+          best_cost = cost;
+          axis = a;
+          best_bin = b;
+        }
+      }
+    }
+
+    if (leaf_is_cheaper(n, best_cost, box)) return -1;
+
+    float best_scale = scale[axis];
+    auto mid = partition(prims.begin() + begin, prims.begin() + end, [&](BuildPrimitive &p) {
+      return bin_index(p, axis, centroid_box, best_scale) < best_bin;
+    });
+    return mid - prims.begin();
+  }
+
+  // Split at the middle of the largest axis of the centroids, with no cost evaluation
+  int split_midpoint(int begin, int end, AABB &centroid_box, int &axis) {
+
+    if (end - begin <= max_leaf_size) return -1;
+
+    axis = centroid_box.largest_axis();
+    float middle = coordinate(centroid_box.centroid(), axis);
+    auto mid = partition(prims.begin() + begin, prims.begin() + end,
+                         [&](BuildPrimitive &p) { return coordinate(p.centroid, axis) < middle; });
+
+    if (mid == prims.begin() + begin || mid == prims.begin() + end)
+      return split_median(begin, end, centroid_box, axis);
+    return mid - prims.begin();
+  }
+
+  // Split the Morton-sorted primitives where the highest bit differing among their codes flips
+  int split_morton(int begin, int end, int depth, int &axis) {
+
+    if (end - begin <= max_leaf_size) return -1;
+
+    // Coincident codes (or a tree too deep): fall back on a median split
+    unsigned int differing = prims[begin].code ^ prims[end - 1].code;
+    if (differing == 0 || depth >= BVH_MAX_DEPTH / 2) {
+      AABB centroid_box;
+      for (int i{begin}; i < end; ++i)
+        centroid_box.expand(prims[i].centroid);
+      return split_median(begin, end, centroid_box, axis);
+    }
+
+    int bit = 31;
+    while (!(differing >> bit))
+      --bit;
+    // Bits are interleaved as ...xyzxyz, with z in the lowest one
+    axis = 2 - bit % 3;
+
+    unsigned int mask = 1u << bit;
+    auto mid = partition_point(prims.begin() + begin, prims.begin() + end,
+                               [mask](const BuildPrimitive &p) { return !(p.code & mask); });
+    return mid - prims.begin();
+  }
+};
+
+//––––––––––––– Functions for the construction –––––––––––––––––––––––––
+
+void build_bvh_nodes(int n, function<AABB(int)> box_of, BVHBuildMethod method, int max_leaf, int n_threads,
+                     vector<BVHNode> &nodes, vector<int> &order, BVHStats &stats) {
+
+  auto start = chrono::steady_clock::now();
+
+  if (n_threads <= 0) n_threads = max(1, int(thread::hardware_concurrency()));
+  stats = BVHStats();
+  stats.n_threads = n_threads;
+  nodes.clear();
+  order.clear();
+  if (n == 0) return;
+
+  BVHBuilder builder(method, max_leaf, n_threads);
+  builder.prims.resize(n);
+
+  // The bounding boxes of the primitives are computed in parallel as well
+  builder.parallel_for(n, (n >= BVH_PARALLEL_THRESHOLD) ? n_threads : 1, [&](int, int begin, int end) {
+    for (int i{begin}; i < end; ++i) {
+      AABB box = box_of(i);
+      builder.prims[i] = BuildPrimitive{box, box.centroid(), i};
+    }
+  });
+  if (method == BVHBuildMethod::LBVH) builder.sort_morton(n_threads);
+
+  nodes.reserve(2 * n - 1);
+  builder.build(0, n, 0, nodes);
+
+  order.reserve(n);
+  for (auto &p : builder.prims)
+    order.push_back(p.index);
+
+  stats.build_time_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+  // Walk the tree to collect the statistics
+  stats.n_nodes = nodes.size();
+  int stack[BVH_MAX_DEPTH], depths[BVH_MAX_DEPTH];
+  int stack_size = 0;
+  stack[stack_size] = 0;
+  depths[stack_size++] = 0;
+  while (stack_size > 0) {
+    --stack_size;
+    int node_index = stack[stack_size], depth = depths[stack_size];
+    if (nodes[node_index].is_leaf()) {
+      stats.n_leaves++;
+      stats.max_depth = max(stats.max_depth, depth);
+    } else {
+      stack[stack_size] = node_index + 1;
+      depths[stack_size++] = depth + 1;
+      stack[stack_size] = nodes[node_index].offset;
+      depths[stack_size++] = depth + 1;
+    }
+  }
+  stats.sah_cost = bvh_sah_cost(nodes);
+}
+
+float bvh_sah_cost(vector<BVHNode> &nodes) {
+  if (nodes.empty()) return 0.;
+  float cost = 0.;
+  for (auto &node : nodes) {
+    if (node.is_leaf())
+      cost += SAH_INTERSECTION_COST * node.count * node.box.surface_area();
+    else
+      cost += SAH_TRAVERSAL_COST * node.box.surface_area();
+  }
+  return cost / nodes[0].box.surface_area();
+}
+
+//––––––––––––– Struct BVH –––––––––––––––––––––––––
+
+BVH::BVH(vector<shared_ptr<Shape>> shapes, BVHBuildMethod m, int max_leaf, int n_threads)
+    : method{m}, max_leaf_size{max_leaf} {
+
+  vector<int> order;
+  build_bvh_nodes(shapes.size(), [&](int i) { return shapes[i]->bounding_box(); }, method, max_leaf_size, n_threads,
+                  nodes, order, stats);
+
+  // Store the shapes in leaf order, so that each leaf reads a contiguous range
+  primitives.reserve(order.size());
+  for (int i : order)
+    primitives.push_back(shapes[i]);
+}
+
+float BVH::sah_cost() { return bvh_sah_cost(nodes); }
+
+void BVH::refit() {
+  // Children always follow their parent, so a backward sweep visits them first
+  for (int i = int(nodes.size()) - 1; i >= 0; --i) {
+    BVHNode &node = nodes[i];
+    if (node.is_leaf()) {
+      node.box = AABB();
+      for (int p{node.offset}; p < node.offset + node.count; ++p)
+        node.box.expand(primitives[p]->bounding_box());
+    } else
+      node.box = merge(nodes[i + 1].box, nodes[node.offset].box);
+  }
+  stats.n_refits++;
+}
+
+float BVH::degradation() { return (stats.sah_cost > 0.) ? sah_cost() / stats.sah_cost : 1.; }
+
+bool BVH::hit_distance(Ray ray, HitDistance &hit) {
+
+  if (nodes.empty()) return false;
+
+  // The query ray is shortened every time a closer hit is found
+  HitDistance closest;
+  intersect_subtree(0, ray, closest);
+
+  if (!closest.shape) return false;
+  hit = closest;
+  return true;
+}
+
+void BVH::intersect_subtree(int root, Ray &query, HitDistance &closest) {
+
+  int stack[BVH_MAX_DEPTH];
+  int stack_size = 0;
+  stack[stack_size++] = root;
+
+  while (stack_size > 0) {
+    int node_index = stack[--stack_size];
+    BVHNode &node = nodes[node_index];
+
+    float t_near;
+    if (!node.box.ray_intersection(query, query.tmin, query.tmax, t_near))
+      continue;
+
+    if (node.is_leaf()) {
+      for (int i{node.offset}; i < node.offset + node.count; ++i) {
+        if (primitives[i]->hit_distance(query, closest)) query.tmax = closest.t;
+      }
+    } else {
+      // Push the far child first, so that the near one is visited first
+      if (query.dir_is_neg[node.axis]) {
+        stack[stack_size++] = node_index + 1;
+        stack[stack_size++] = node.offset;
+      } else {
+        stack[stack_size++] = node.offset;
+        stack[stack_size++] = node_index + 1;
+      }
+    }
+  }
+}
+
+//––––––––––––– Functions for the packet traversal –––––––––––––––––––––––––
+
+/**
+ * Bounds of the origins and of the inverse directions of a packet of rays pointing to the same octant
+ */
+struct PacketBounds {
+  float origin_min[3], origin_max[3];
+  float inv_dir_min[3], inv_dir_max[3];
+  bool dir_is_neg[3];
+  float tmin;
+};
+
+/**
+ * Check if any ray of the packet can cross the box within [bounds.tmin, tmax], bounding the slab distances
+ * of all the rays at once with interval arithmetic. The test is conservative, as floating-point rounding is monotonic.
+ */
+inline bool packet_may_hit(AABB &box, PacketBounds &bounds, float tmax) {
+  // Plain arrays, as 'Point::operator[]' is a chain of branches
+  float pmin[3] = {box.pmin.x, box.pmin.y, box.pmin.z};
+  float pmax[3] = {box.pmax.x, box.pmax.y, box.pmax.z};
+  float t_near = bounds.tmin, t_far = tmax;
+  for (int a{}; a < 3; ++a) {
+    float near_plane = bounds.dir_is_neg[a] ? pmax[a] : pmin[a];
+    float far_plane = bounds.dir_is_neg[a] ? pmin[a] : pmax[a];
+    // The smallest entry distance and the largest exit distance over the whole packet
+    float n0 = near_plane - bounds.origin_max[a], n1 = near_plane - bounds.origin_min[a];
+    float f0 = far_plane - bounds.origin_max[a], f1 = far_plane - bounds.origin_min[a];
+    float i0 = bounds.inv_dir_min[a], i1 = bounds.inv_dir_max[a];
+    t_near = fmax(t_near, fmin(fmin(n0 * i0, n0 * i1), fmin(n1 * i0, n1 * i1)));
+    t_far = fmin(t_far, fmax(fmax(f0 * i0, f0 * i1), fmax(f1 * i0, f1 * i1)));
+  }
+  return t_near <= t_far;
+}
+
+void BVH::hit_distance(vector<Ray> &rays, vector<HitDistance> &hits) {
+
+  for (auto &hit : hits)
+    hit = HitDistance();
+  if (nodes.empty()) return;
+
+  Ray queries[BVH_PACKET_SIZE];
+  int stack[BVH_MAX_DEPTH];
+  uint64_t stack_masks[BVH_MAX_DEPTH];
+
+  for (int first{}; first < rays.size(); first += BVH_PACKET_SIZE) {
+
+    int n = min(BVH_PACKET_SIZE, int(rays.size()) - first);
+    HitDistance *closest = &hits[first];
+
+    // The packet is culled as a whole only if all its rays point to the same octant
+    PacketBounds bounds{};
+    bool coherent = true;
+    float packet_tmax = -INFINITY;
+    for (int i{}; i < n; ++i) {
+      queries[i] = rays[first + i];
+      for (int a{}; a < 3; ++a) {
+        float o = coordinate(queries[i].origin, a), inv = coordinate(queries[i].inv_dir, a);
+        if (i == 0) {
+          bounds.origin_min[a] = bounds.origin_max[a] = o;
+          bounds.inv_dir_min[a] = bounds.inv_dir_max[a] = inv;
+          bounds.dir_is_neg[a] = inv < 0;
+        }
+        bounds.origin_min[a] = fmin(bounds.origin_min[a], o);
+        bounds.origin_max[a] = fmax(bounds.origin_max[a], o);
+        bounds.inv_dir_min[a] = fmin(bounds.inv_dir_min[a], inv);
+        bounds.inv_dir_max[a] = fmax(bounds.inv_dir_max[a], inv);
+        if (!isfinite(inv) || (inv < 0) != bounds.dir_is_neg[a]) coherent = false;
+      }
+      bounds.tmin = (i == 0) ? queries[i].tmin : fmin(bounds.tmin, queries[i].tmin);
+      packet_tmax = fmax(packet_tmax, queries[i].tmax);
+    }
+
+    // Bit i of a mask refers to rays[first + i]
+    int stack_size = 0;
+    stack[stack_size] = 0;
+    stack_masks[stack_size++] = (n == 64) ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+
+    while (stack_size > 0) {
+      --stack_size;
+      int node_index = stack[stack_size];
+      uint64_t mask = stack_masks[stack_size];
+      BVHNode &node = nodes[node_index];
+
+      if (coherent && !packet_may_hit(node.box, bounds, packet_tmax)) continue;
+
+      // The packet has diverged: the few rays left go on alone
+      if (__builtin_popcountll(mask) < BVH_PACKET_MIN_ACTIVE) {
+        for (; mask; mask &= mask - 1) {
+          int i = __builtin_ctzll(mask);
+          intersect_subtree(node_index, queries[i], closest[i]);
+        }
+      } else if (node.is_leaf()) {
+        for (; mask; mask &= mask - 1) {
+          int i = __builtin_ctzll(mask);
+          float t_near;
+          if (!node.box.ray_intersection(queries[i], queries[i].tmin, queries[i].tmax, t_near))
+            continue;
+          for (int p{node.offset}; p < node.offset + node.count; ++p) {
+            if (primitives[p]->hit_distance(queries[i], closest[i])) queries[i].tmax = closest[i].t;
+          }
+        }
+      } else {
+        // The rays before the first one crossing the box are dropped, the others follow it untested
+        uint64_t hit_mask = 0;
+        for (uint64_t m{mask}; m; m &= m - 1) {
+          int i = __builtin_ctzll(m);
+          float t_near;
+          if (node.box.ray_intersection(queries[i], queries[i].tmin, queries[i].tmax, t_near)) {
+            hit_mask = m;
+            break;
+          }
+        }
+        if (!hit_mask) continue;
+
+        // Push the far child first, as seen by the first ray
+        if (queries[__builtin_ctzll(hit_mask)].dir_is_neg[node.axis]) {
+          stack[stack_size] = node_index + 1;
+          stack_masks[stack_size++] = hit_mask;
+          stack[stack_size] = node.offset;
+          stack_masks[stack_size++] = hit_mask;
+        } else {
+          stack[stack_size] = node.offset;
+          stack_masks[stack_size++] = hit_mask;
+          stack[stack_size] = node_index + 1;
+          stack_masks[stack_size++] = hit_mask;
+        }
+        continue;
+      }
+
+      // Hits found above may let the packet skip farther nodes
+      packet_tmax = -INFINITY;
+      for (int i{}; i < n; ++i)
+        packet_tmax = fmax(packet_tmax, queries[i].tmax);
+    }
+  }
+}
+
+bool BVH::check_if_intersection(Ray ray) {
+
+  if (nodes.empty()) return false;
+
+  int stack[BVH_MAX_DEPTH];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+
+  while (stack_size > 0) {
+    int node_index = stack[--stack_size];
+    BVHNode &node = nodes[node_index];
+
+    float t_near;
+    if (!node.box.ray_intersection(ray, ray.tmin, ray.tmax, t_near))
+      continue;
+
+    if (node.is_leaf()) {
+      for (int i{node.offset}; i < node.offset + node.count; ++i) {
+        if (primitives[i]->check_if_intersection(ray)) return true;
+      }
+    } else {
+      stack[stack_size++] = node.offset;
+      stack[stack_size++] = node_index + 1;
+    }
+  }
+  return false;
+}
+
+void BVH::check_if_intersection(vector<Ray> &rays, vector<bool> &occluded) {
+
+  if (nodes.empty()) return;
+
+  const int group_size = 64;
+  int stack[BVH_MAX_DEPTH];
+  uint64_t stack_masks[BVH_MAX_DEPTH];
+
+  for (int first{}; first < rays.size(); first += group_size) {
+
+    int n = min(group_size, int(rays.size()) - first);
+
+    // Bit i of a mask refers to rays[first + i]
+    uint64_t active = 0;
+    for (int i{}; i < n; ++i) {
+      if (!occluded[first + i]) active |= uint64_t(1) << i;
+    }
+
+    int stack_size = 0;
+    stack[stack_size] = 0;
+    stack_masks[stack_size++] = active;
+
+    while (stack_size > 0 && active) {
+      --stack_size;
+      BVHNode &node = nodes[stack[stack_size]];
+      int node_index = stack[stack_size];
+      // Rays occluded since the node was pushed need no further test
+      uint64_t mask = stack_masks[stack_size] & active;
+
+      uint64_t hit_mask = 0;
+      float t_near;
+      for (int i{}; i < n; ++i) {
+        uint64_t bit = uint64_t(1) << i;
+        Ray &ray = rays[first + i];
+        if ((mask & bit) && node.box.ray_intersection(ray, ray.tmin, ray.tmax, t_near))
+          hit_mask |= bit;
+      }
+      if (!hit_mask) continue;
+
+      if (node.is_leaf()) {
+        for (int i{}; i < n; ++i) {
+          uint64_t bit = uint64_t(1) << i;
+          if (!(hit_mask & bit)) continue;
+          for (int p{node.offset}; p < node.offset + node.count; ++p) {
+            if (primitives[p]->check_if_intersection(rays[first + i])) {
+              occluded[first + i] = true;
+              active &= ~bit;
+              break;
+            }
+          }
+        }
+      } else {
+        stack[stack_size] = node.offset;
+        stack_masks[stack_size++] = hit_mask;
+        stack[stack_size] = node_index + 1;
+        stack_masks[stack_size++] = hit_mask;
+      }
+    }
+  }
+}
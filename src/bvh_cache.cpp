@@ -0,0 +1,243 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bvh_cache.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(is_trivially_copyable<BVHStats>::value, "BVH statistics are written to disk as they are in memory");
+
+/**
+ * A node as stored on disk
+ */
+struct BVHCacheNode {
+  float bounds[6];
+  int32_t offset;
+  int32_t count;
+  int32_t axis;
+};
+
+/**
+ * The beginning of an entry, followed by 'n_nodes' nodes and by 'n_primitives' indices of the shapes
+ */
+struct BVHCacheHeader {
+  char magic[8] = {'P', 'R', 'B', 'V', 'H', 'C', 'A', 'C'};
+  uint32_t version = BVH_CACHE_VERSION;
+  uint32_t method = 0;
+  uint64_t key = 0;
+  int32_t max_leaf_size = 0;
+  int32_t n_nodes = 0;
+  int32_t n_primitives = 0;
+  int32_t node_size = sizeof(BVHCacheNode);
+  BVHStats stats;
+};
+
+/**
+ * Fold some bytes into a 64-bit FNV-1a hash
+ */
+inline void fnv1a(uint64_t &hash, const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i{}; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+}
+
+//––––––––––––– Struct BVHCache –––––––––––––––––––––––––
+
+BVHCache::BVHCache(string dir) : directory{dir} {
+  error_code error;
+  filesystem::create_directories(directory, error);
+}
+
+uint64_t BVHCache::key(vector<shared_ptr<Shape>> &shapes, BVHBuildMethod method, int max_leaf) {
+  uint64_t hash = 14695981039346656037ULL;
+  uint32_t header[4] = {BVH_CACHE_VERSION, uint32_t(method), uint32_t(max_leaf), uint32_t(shapes.size())};
+  fnv1a(hash, header, sizeof(header));
+  for (auto shape : shapes) {
+    AABB box = shape->bounding_box();
+    float bounds[6] = {box.pmin.x, box.pmin.y, box.pmin.z, box.pmax.x, box.pmax.y, box.pmax.z};
+    fnv1a(hash, bounds, sizeof(bounds));
+  }
+  return hash;
+}
+
+string BVHCache::path(uint64_t key) {
+  char name[32];
+  snprintf(name, sizeof(name), "bvh_%016llx.bin", (unsigned long long)key);
+  return (filesystem::path(directory) / name).string();
+}
+
+shared_ptr<BVH> BVHCache::load(vector<shared_ptr<Shape>> &shapes, BVHBuildMethod method, int max_leaf) {
+
+  uint64_t k = key(shapes, method, max_leaf);
+  int fd = open(path(k).c_str(), O_RDONLY);
+  if (fd < 0) return nullptr;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(BVHCacheHeader)) {
+    close(fd);
+    return nullptr;
+  }
+  size_t size = info.st_size;
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return nullptr;
+
+  // The entry is checked thoroughly: a damaged or foreign file is simply ignored (and later overwritten)
+  BVHCacheHeader header, expected;
+  memcpy(&header, data, sizeof(header));
+  int n_shapes = shapes.size();
+  bool valid = memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 &&
+               header.version == BVH_CACHE_VERSION && header.node_size == sizeof(BVHCacheNode) && header.key == k &&
+               header.method == uint32_t(method) && header.max_leaf_size == max_leaf &&
+               header.n_primitives == n_shapes && header.n_nodes >= 0 &&
+               size == sizeof(header) + header.n_nodes * sizeof(BVHCacheNode) + header.n_primitives * sizeof(int32_t);
+
+  shared_ptr<BVH> bvh;
+  if (valid) {
+    bvh = make_shared<BVH>(vector<shared_ptr<Shape>>(), method, max_leaf, 1);
+    const char *cursor = static_cast<const char *>(data) + sizeof(header);
+    bvh->nodes.resize(header.n_nodes);
+    for (int i{}; i < header.n_nodes; ++i) {
+      BVHCacheNode stored;
+      memcpy(&stored, cursor, sizeof(stored));
+      cursor += sizeof(stored);
+      BVHNode &node = bvh->nodes[i];
+      node.box.pmin = Point(stored.bounds[0], stored.bounds[1], stored.bounds[2]);
+      node.box.pmax = Point(stored.bounds[3], stored.bounds[4], stored.bounds[5]);
+      node.offset = stored.offset;
+      node.count = stored.count;
+      node.axis = stored.axis;
+    }
+
+    vector<int32_t> indices(header.n_primitives);
+    memcpy(indices.data(), cursor, header.n_primitives * sizeof(int32_t));
+    bvh->primitives.reserve(n_shapes);
+    for (int32_t index : indices) {
+      if (index < 0 || index >= n_shapes) {
+        valid = false;
+        break;
+      }
+      bvh->primitives.push_back(shapes[index]);
+    }
+    for (int i{}; valid && i < header.n_nodes; ++i) {
+      BVHNode &node = bvh->nodes[i];
+      if (node.is_leaf() ? (node.offset < 0 || node.offset + node.count > n_shapes)
+                         : (node.count < 0 || node.offset <= i || node.offset >= header.n_nodes))
+        valid = false;
+    }
+
+    // The traversals keep the nodes to visit in a stack of BVH_MAX_DEPTH entries: the tree is walked from the root,
+    // which must exist if there are shapes, checking that no node is reached twice and that no leaf is deeper than that
+    if (n_shapes > 0 && header.n_nodes == 0) valid = false;
+    if (valid && header.n_nodes > 0) {
+      vector<bool> reached(header.n_nodes, false);
+      vector<pair<int, int>> pending{{0, 0}};
+      while (valid && !pending.empty()) {
+        int index = pending.back().first, depth = pending.back().second;
+        pending.pop_back();
+        if (reached[index] || depth > BVH_MAX_DEPTH - 1) {
+          valid = false;
+          break;
+        }
+        reached[index] = true;
+        BVHNode &node = bvh->nodes[index];
+        if (!node.is_leaf()) {
+          pending.push_back({index + 1, depth + 1});
+          pending.push_back({node.offset, depth + 1});
+        }
+      }
+    }
+    bvh->stats = header.stats;
+    bvh->stats.cached = true;
+  }
+  munmap(data, size);
+  return valid ? bvh : nullptr;
+}
+
+bool BVHCache::save(BVH &bvh, vector<shared_ptr<Shape>> &shapes) {
+
+  // The position of each primitive in the list of shapes (the same shape may appear more than once)
+  unordered_map<Shape *, int32_t> position;
+  for (int i{}; i < shapes.size(); ++i)
+    position.emplace(shapes[i].get(), i);
+  vector<int32_t> indices;
+  indices.reserve(bvh.primitives.size());
+  for (auto shape : bvh.primitives) {
+    auto found = position.find(shape.get());
+    if (found == position.end()) return false;
+    indices.push_back(found->second);
+  }
+
+  vector<BVHCacheNode> stored_nodes;
+  stored_nodes.reserve(bvh.nodes.size());
+  for (auto &node : bvh.nodes) {
+    stored_nodes.push_back(BVHCacheNode{{node.box.pmin.x, node.box.pmin.y, node.box.pmin.z, node.box.pmax.x,
+                                         node.box.pmax.y, node.box.pmax.z},
+                                        node.offset, node.count, node.axis});
+  }
+
+  BVHCacheHeader header;
+  header.method = uint32_t(bvh.method);
+  header.key = key(shapes, bvh.method, bvh.max_leaf_size);
+  header.max_leaf_size = bvh.max_leaf_size;
+  header.n_nodes = bvh.nodes.size();
+  header.n_primitives = indices.size();
+  header.stats = bvh.stats;
+  header.stats.cached = false;
+
+  string final_path = path(header.key);
+  string temporary_path = final_path + ".tmp" + to_string(getpid());
+  {
+    ofstream out(temporary_path, ios::binary);
+    if (!out) return false;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(stored_nodes.data()), stored_nodes.size() * sizeof(BVHCacheNode));
+    out.write(reinterpret_cast<const char *>(indices.data()), indices.size() * sizeof(int32_t));
+    if (!out) {
+      out.close();
+      remove(temporary_path.c_str());
+      return false;
+    }
+  }
+  error_code error;
+  filesystem::rename(temporary_path, final_path, error);
+  if (error) remove(temporary_path.c_str());
+  return !error;
+}
+
+shared_ptr<BVH> BVHCache::get(vector<shared_ptr<Shape>> &shapes, BVHBuildMethod method, int max_leaf) {
+  shared_ptr<BVH> bvh = load(shapes, method, max_leaf);
+  if (bvh) {
+    n_hits++;
+    return bvh;
+  }
+  n_misses++;
+  bvh = make_shared<BVH>(shapes, method, max_leaf);
+  save(*bvh, shapes);
+  return bvh;
+}
@@ -0,0 +1,202 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "grid.h"
+#include <algorithm>
+
+//––––––––––––– Struct Grid –––––––––––––––––––––––––
+
+Grid::Grid(vector<shared_ptr<Shape>> shapes, bool h, float density) : primitives{shapes}, hashed{h} {
+
+  vector<AABB> boxes;
+  boxes.reserve(primitives.size());
+  for (auto shape : primitives) {
+    boxes.push_back(shape->bounding_box());
+    box.expand(boxes.back());
+  }
+
+  if (primitives.empty()) {
+    cell_start = {0, 0};
+    return;
+  }
+
+  // Roughly cubic cells, about 'density' times the number of shapes (flat scenes keep a minimum thickness)
+  float extent[3];
+  for (int a{}; a < 3; ++a)
+    extent[a] = box.pmax[a] - box.pmin[a];
+  float max_extent = max(extent[0], max(extent[1], extent[2]));
+  for (int a{}; a < 3; ++a)
+    extent[a] = max(extent[a], 1e-3f * max_extent);
+  float cells_per_unit = cbrt(density * primitives.size() / (extent[0] * extent[1] * extent[2]));
+  int max_resolution = hashed ? HASHED_GRID_MAX_RESOLUTION : GRID_MAX_RESOLUTION;
+  for (int a{}; a < 3; ++a) {
+    resolution[a] = min(max(int(round(extent[a] * cells_per_unit)), 1), max_resolution);
+    if (box.pmax[a] == box.pmin[a]) resolution[a] = 1;
+    cell_size[a] = (box.pmax[a] - box.pmin[a]) / resolution[a];
+  }
+
+  // The range of cells overlapped by each shape, widened a little to be robust against rounding
+  auto cell_range = [&](AABB &b, int lo[3], int hi[3]) {
+    for (int a{}; a < 3; ++a) {
+      if (cell_size[a] <= 0.) {
+        lo[a] = hi[a] = 0;
+        continue;
+      }
+      float pad = 1e-3 * cell_size[a];
+      lo[a] = min(max(int(floor((b.pmin[a] - pad - box.pmin[a]) / cell_size[a])), 0), resolution[a] - 1);
+      hi[a] = min(max(int(floor((b.pmax[a] + pad - box.pmin[a]) / cell_size[a])), 0), resolution[a] - 1);
+    }
+  };
+
+  if (!hashed) {
+    // Count the shapes of each cell, then fill the cells
+    int64_t n_cells = int64_t(resolution[0]) * resolution[1] * resolution[2];
+    cell_start.assign(n_cells + 1, 0);
+    int lo[3], hi[3];
+    for (auto &b : boxes) {
+      cell_range(b, lo, hi);
+      for (int iz{lo[2]}; iz <= hi[2]; ++iz)
+        for (int iy{lo[1]}; iy <= hi[1]; ++iy)
+          for (int ix{lo[0]}; ix <= hi[0]; ++ix)
+            cell_start[cell_index(ix, iy, iz) + 1]++;
+    }
+    for (int64_t i{}; i < n_cells; ++i)
+      cell_start[i + 1] += cell_start[i];
+
+    cell_primitives.resize(cell_start[n_cells]);
+    vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+    for (int p{}; p < boxes.size(); ++p) {
+      cell_range(boxes[p], lo, hi);
+      for (int iz{lo[2]}; iz <= hi[2]; ++iz)
+        for (int iy{lo[1]}; iy <= hi[1]; ++iy)
+          for (int ix{lo[0]}; ix <= hi[0]; ++ix)
+            cell_primitives[fill[cell_index(ix, iy, iz)]++] = p;
+    }
+
+  } else {
+    // Sort the (cell, shape) pairs by cell, so that each cell is a contiguous range
+    vector<pair<int64_t, int>> entries;
+    int lo[3], hi[3];
+    for (int p{}; p < boxes.size(); ++p) {
+      cell_range(boxes[p], lo, hi);
+      for (int iz{lo[2]}; iz <= hi[2]; ++iz)
+        for (int iy{lo[1]}; iy <= hi[1]; ++iy)
+          for (int ix{lo[0]}; ix <= hi[0]; ++ix)
+            entries.push_back({cell_index(ix, iy, iz), p});
+    }
+    sort(entries.begin(), entries.end());
+
+    cell_primitives.resize(entries.size());
+    for (int i{}; i < entries.size(); ++i) {
+      cell_primitives[i] = entries[i].second;
+      if (i == 0 || entries[i].first != entries[i - 1].first) cells[entries[i].first].start = i;
+      cells[entries[i].first].count++;
+    }
+  }
+}
+
+size_t Grid::memory_footprint() {
+  size_t bytes = cell_start.size() * sizeof(int) + cell_primitives.size() * sizeof(int) +
+                 primitives.size() * sizeof(shared_ptr<Shape>);
+  // Each entry of the hash table is a node holding the key, the value and a link, plus one bucket pointer
+  bytes += cells.size() * (sizeof(pair<const int64_t, GridCell>) + sizeof(void *)) + cells.bucket_count() * sizeof(void *);
+  return bytes;
+}
+
+template <typename Visitor> void Grid::traverse(Ray &ray, Visitor visit) {
+
+  if (primitives.empty()) return;
+
+  Vec inv_dir = ray.inv_dir;
+  float t_enter, t_exit;
+  if (!box.ray_intersection(ray, ray.tmin, ray.tmax, t_enter, t_exit)) return;
+
+  // Set up the walk along each axis: the current cell, the distance to its next boundary and between boundaries
+  Point entry = ray.at(t_enter);
+  int index[3], step[3], out[3];
+  float next_t[3], delta_t[3];
+  for (int a{}; a < 3; ++a) {
+    index[a] = (cell_size[a] > 0.) ? int(floor((entry[a] - box.pmin[a]) / cell_size[a])) : 0;
+    index[a] = min(max(index[a], 0), resolution[a] - 1);
+
+    if (ray.dir[a] > 0.) {
+      step[a] = 1;
+      out[a] = resolution[a];
+      next_t[a] = (box.pmin[a] + (index[a] + 1) * cell_size[a] - ray.origin[a]) * inv_dir[a];
+      delta_t[a] = cell_size[a] * inv_dir[a];
+    } else if (ray.dir[a] < 0.) {
+      step[a] = -1;
+      out[a] = -1;
+      next_t[a] = (box.pmin[a] + index[a] * cell_size[a] - ray.origin[a]) * inv_dir[a];
+      delta_t[a] = -cell_size[a] * inv_dir[a];
+    } else {
+      step[a] = 0;
+      out[a] = -1;
+      next_t[a] = INFINITY;
+      delta_t[a] = INFINITY;
+    }
+  }
+
+  while (true) {
+    // The axis whose boundary is crossed first
+    int axis = (next_t[0] < next_t[1]) ? ((next_t[0] < next_t[2]) ? 0 : 2) : ((next_t[1] < next_t[2]) ? 1 : 2);
+
+    GridCell c = cell(cell_index(index[0], index[1], index[2]));
+    if (c.count > 0 && visit(c, next_t[axis])) return;
+
+    if (next_t[axis] > ray.tmax) return;
+    index[axis] += step[axis];
+    if (index[axis] == out[axis]) return;
+    next_t[axis] += delta_t[axis];
+  }
+}
+
+bool Grid::hit_distance(Ray ray, HitDistance &hit) {
+
+  HitDistance closest;
+
+  // The query ray is shortened every time a closer hit is found
+  Ray query(ray);
+  traverse(query, [&](GridCell c, float t_exit) {
+    for (int i{c.start}; i < c.start + c.count; ++i) {
+      if (primitives[cell_primitives[i]]->hit_distance(query, closest)) query.tmax = closest.t;
+    }
+    // A hit inside the current cell cannot be beaten by the shapes of the following cells
+    return closest.shape && closest.t <= t_exit;
+  });
+
+  if (!closest.shape) return false;
+  hit = closest;
+  return true;
+}
+
+bool Grid::check_if_intersection(Ray ray) {
+
+  bool found = false;
+  traverse(ray, [&](GridCell c, float) {
+    for (int i{c.start}; i < c.start + c.count; ++i) {
+      if (primitives[cell_primitives[i]]->check_if_intersection(ray)) {
+        found = true;
+        break;
+      }
+    }
+    return found;
+  });
+  return found;
+}
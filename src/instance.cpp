@@ -0,0 +1,236 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "instance.h"
+
+//––––––––––––– Struct ShapeGroup –––––––––––––––––––––––––
+
+/**
+ * Replace the spheres that can be packed with sets of nearby spheres, taken from the leaves of a hierarchy
+ * split at the midpoints down to SPHERE_SET_SIZE spheres (lone spheres are left as they are)
+ */
+vector<shared_ptr<Shape>> pack_spheres_in_sets(vector<shared_ptr<Shape>> &shapes, vector<shared_ptr<SphereSet>> &sets) {
+  vector<shared_ptr<Shape>> packed, spheres;
+  for (auto shape : shapes) {
+    shared_ptr<Sphere> sphere = dynamic_pointer_cast<Sphere>(shape);
+    if (sphere && SphereSet::can_pack(*sphere))
+      spheres.push_back(sphere);
+    else
+      packed.push_back(shape);
+  }
+  if (spheres.empty()) return packed;
+
+  BVH clusters(spheres, BVHBuildMethod::MIDPOINT, SPHERE_SET_SIZE);
+  for (auto &node : clusters.nodes) {
+    if (!node.is_leaf()) continue;
+    int first = node.offset, last = node.offset + node.count;
+    if (last - first == 1) {
+      packed.push_back(clusters.primitives[first]);
+      continue;
+    }
+    vector<shared_ptr<Sphere>> members;
+    for (int p{first}; p < last; ++p)
+      members.push_back(static_pointer_cast<Sphere>(clusters.primitives[p]));
+    sets.push_back(make_shared<SphereSet>(members));
+    packed.push_back(sets.back());
+  }
+  return packed;
+}
+
+void ShapeGroup::build_accelerator(AcceleratorType type, BVHBuildMethod method, shared_ptr<BVHCache> cache) {
+  vector<shared_ptr<Shape>> bounded_shapes;
+  unbounded_shapes.clear();
+  for (auto shape : shapes) {
+    if (shape->bounding_box().is_bounded())
+      bounded_shapes.push_back(shape);
+    else
+      unbounded_shapes.push_back(shape);
+  }
+  accelerator_type = type;
+  bvh.reset();
+  accelerator.reset();
+  sphere_sets.clear();
+  if (pack_spheres && type != AcceleratorType::NONE)
+    bounded_shapes = pack_spheres_in_sets(bounded_shapes, sphere_sets);
+
+  if (type == AcceleratorType::NONE) {
+    // Every shape is checked
+    unbounded_shapes.clear();
+  } else if (type == AcceleratorType::GRID || type == AcceleratorType::HASHED_GRID) {
+    accelerator = make_shared<Grid>(bounded_shapes, type == AcceleratorType::HASHED_GRID);
+  } else {
+    bvh = cache ? cache->get(bounded_shapes, method) : make_shared<BVH>(bounded_shapes, method);
+    if (type == AcceleratorType::WIDE_BVH)
+      accelerator = make_shared<WideBVH>(*bvh);
+    else
+      accelerator = bvh;
+  }
+
+  typed_shapes.reset();
+  if (typed_storage) typed_shapes = make_shared<ShapeArrays>(accelerator ? unbounded_shapes : shapes);
+}
+
+bool ShapeGroup::update_bvh(float max_degradation) {
+  if (typed_shapes) typed_shapes = make_shared<ShapeArrays>(accelerator ? unbounded_shapes : shapes);
+  if (accelerator_type == AcceleratorType::NONE) return false;
+  for (auto set : sphere_sets) {
+    if (!set->update()) {
+      build_accelerator(accelerator_type, bvh ? bvh->method : BVHBuildMethod::SAH);
+      return true;
+    }
+  }
+  // Grids have no hierarchy to refit: they are built again
+  if (!bvh) {
+    build_accelerator(accelerator_type);
+    return true;
+  }
+  bvh->refit();
+  if (bvh->degradation() > max_degradation) {
+    build_accelerator(accelerator_type, bvh->method);
+    return true;
+  }
+  // The quantized bounds of the wide hierarchy cannot be refitted: it is collapsed again from the refitted tree
+  if (accelerator_type == AcceleratorType::WIDE_BVH) accelerator = make_shared<WideBVH>(*bvh);
+  return false;
+}
+
+AABB ShapeGroup::bounding_box() {
+  if (accelerator)
+    return unbounded_shapes.empty() ? accelerator->bounding_box() : AABB::unbounded();
+  AABB box;
+  for (auto shape : shapes)
+    box.expand(shape->bounding_box());
+  return box;
+}
+
+bool ShapeGroup::hit_distance(Ray ray, HitDistance &hit) {
+  bool found = false;
+  // Without a hierarchy every shape is checked
+  vector<shared_ptr<Shape>> &candidates = accelerator ? unbounded_shapes : shapes;
+  if (accelerator && accelerator->hit_distance(ray, hit)) {
+    ray.tmax = hit.t;
+    found = true;
+  }
+
+  if (typed_shapes) {
+    if (typed_shapes->hit_distance(ray, hit)) found = true;
+  } else {
+    for (int i{}; i < candidates.size(); ++i) {
+      if (candidates[i]->hit_distance(ray, hit)) {
+        ray.tmax = hit.t;
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+void ShapeGroup::hit_distance(vector<Ray> &rays, vector<HitDistance> &hits) {
+  if (accelerator)
+    accelerator->hit_distance(rays, hits);
+  else {
+    for (auto &hit : hits)
+      hit = HitDistance();
+  }
+
+  vector<shared_ptr<Shape>> &candidates = accelerator ? unbounded_shapes : shapes;
+  for (int r{}; r < rays.size() && !candidates.empty(); ++r) {
+    Ray query(rays[r]);
+    if (hits[r].shape) query.tmax = hits[r].t;
+    if (typed_shapes) {
+      typed_shapes->hit_distance(query, hits[r]);
+      continue;
+    }
+    for (int i{}; i < candidates.size(); ++i) {
+      if (candidates[i]->hit_distance(query, hits[r])) query.tmax = hits[r].t;
+    }
+  }
+}
+
+HitRecord ShapeGroup::ray_intersection(Ray ray) {
+  HitDistance hit;
+  return hit_distance(ray, hit) ? hit.shape->hit_record(ray, hit) : HitRecord();
+}
+
+void ShapeGroup::ray_intersection(vector<Ray> &rays, vector<HitRecord> &hits) {
+  vector<HitDistance> distances(rays.size());
+  hit_distance(rays, distances);
+  for (int r{}; r < rays.size(); ++r)
+    hits[r] = distances[r].shape ? distances[r].shape->hit_record(rays[r], distances[r]) : HitRecord();
+}
+
+bool ShapeGroup::check_if_intersection(Ray ray) {
+  vector<shared_ptr<Shape>> &candidates = accelerator ? unbounded_shapes : shapes;
+  if (typed_shapes) {
+    if (typed_shapes->check_if_intersection(ray)) return true;
+  } else {
+    for (int i{}; i < candidates.size(); ++i) {
+      if (candidates[i]->check_if_intersection(ray)) return true;
+    }
+  }
+  return accelerator && accelerator->check_if_intersection(ray);
+}
+
+//––––––––––––– Sub-struct Instance ––––––––––––––––––––––––
+
+HitRecord Instance::ray_intersection(Ray ray) {
+
+  // The parameter t is the same in both reference frames, as the transformation is affine
+  HitRecord hit = group->ray_intersection(ray.inverse_transform(transformation));
+  if (!hit.init) return hit;
+
+  hit.world_point = transformation * hit.world_point;
+  hit.normal = transformation * hit.normal;
+  hit.ray = ray;
+  if (material_override) hit.material = material;
+  return hit;
+}
+
+bool Instance::hit_distance(Ray ray, HitDistance &hit) {
+  HitDistance inner;
+  if (!group->hit_distance(ray.inverse_transform(transformation), inner)) return false;
+  hit = inner.outer_hit(this);
+  return true;
+}
+
+HitRecord Instance::hit_record(Ray ray, HitDistance hit) {
+
+  // Instances nested too deeply do not keep the shape hit: the group is searched again, only up to the hit
+  if (hit.n_inner == 0) {
+    Ray query(ray);
+    query.tmax = nextafter(hit.t, INFINITY);
+    HitRecord record = ray_intersection(query);
+    record.ray = ray;
+    return record;
+  }
+
+  HitDistance inner = hit.inner_hit();
+  HitRecord record = inner.shape->hit_record(ray.inverse_transform(transformation), inner);
+  record.world_point = transformation * record.world_point;
+  record.normal = transformation * record.normal;
+  record.ray = ray;
+  if (material_override) record.material = material;
+  return record;
+}
+
+bool Instance::check_if_intersection(Ray ray) {
+  return group->check_if_intersection(ray.inverse_transform(transformation));
+}
+
+AABB Instance::bounding_box() { return transformation * group->bounding_box(); }
@@ -0,0 +1,856 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "mesh.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Minimum size (in bytes) of the chunks of an OBJ file parsed by different threads
+#define OBJ_MIN_CHUNK_SIZE (1 << 16)
+
+//––––––––––––– Watertight ray-triangle test –––––––––––––––––––––––––
+
+/**
+ * A ray prepared for the watertight ray-triangle test (S. Woop, C. Benthin, I. Wald,
+ * "Watertight ray/triangle intersection", JCGT, 2013): the space is sheared so that the ray runs along +z,
+ * where the edge functions of a triangle are evaluated in 2D with the same rounding for the triangles sharing an edge
+ *
+ * @param origin The origin of the ray
+ * @param kx, ky, kz The axes mapped to x, y and z (z being the largest component of the direction)
+ * @param sx, sy, sz The shear and scale constants
+ */
+struct WatertightRay {
+  Point origin;
+  int kx, ky, kz;
+  float sx, sy, sz;
+
+  WatertightRay(Ray &ray) : origin{ray.origin} {
+    float d[3] = {ray.dir.x, ray.dir.y, ray.dir.z};
+    kz = (fabs(d[0]) > fabs(d[1])) ? ((fabs(d[0]) > fabs(d[2])) ? 0 : 2) : ((fabs(d[1]) > fabs(d[2])) ? 1 : 2);
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    // Keep the winding of the triangles
+    if (d[kz] < 0.) swap(kx, ky);
+    sx = d[kx] / d[kz];
+    sy = d[ky] / d[kz];
+    sz = 1.f / d[kz];
+  }
+};
+
+/**
+ * Check if the ray hits the triangle (A, B, C) at a distance within (tmin, tmax)
+ *
+ * @param t Set to the distance of the hit, only if an intersection happens
+ * @param bary Set to the barycentric coordinates of the hit (the weights of A, B and C), only if an intersection happens
+ * @return boolean value
+ */
+static inline bool intersect_triangle(const WatertightRay &ray, Point A, Point B, Point C, float tmin, float tmax,
+                                      float &t, float bary[3]) {
+  Vec a = A - ray.origin, b = B - ray.origin, c = C - ray.origin;
+  float a_x = coordinate(a, ray.kx), a_y = coordinate(a, ray.ky), a_z = coordinate(a, ray.kz);
+  float b_x = coordinate(b, ray.kx), b_y = coordinate(b, ray.ky), b_z = coordinate(b, ray.kz);
+  float c_x = coordinate(c, ray.kx), c_y = coordinate(c, ray.ky), c_z = coordinate(c, ray.kz);
+
+  // Shear the vertices so that the ray starts from the origin and runs along z
+  a_x -= ray.sx * a_z;
+  a_y -= ray.sy * a_z;
+  b_x -= ray.sx * b_z;
+  b_y -= ray.sy * b_z;
+  c_x -= ray.sx * c_z;
+  c_y -= ray.sy * c_z;
+
+  // Edge functions (the scaled barycentric coordinates), recomputed in double precision when one is exactly zero
+  float u = c_x * b_y - c_y * b_x;
+  float v = a_x * c_y - a_y * c_x;
+  float w = b_x * a_y - b_y * a_x;
+  if (u == 0.f || v == 0.f || w == 0.f) {
+    u = float(double(c_x) * double(b_y) - double(c_y) * double(b_x));
+    v = float(double(a_x) * double(c_y) - double(a_y) * double(c_x));
+    w = float(double(b_x) * double(a_y) - double(b_y) * double(a_x));
+  }
+  if ((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f)) return false;
+
+  float det = u + v + w;
+  if (det == 0.f) return false;
+
+  // The scaled distance is compared with the range before dividing by the determinant
+  float scaled_t = (u * a_z + v * b_z + w * c_z) * ray.sz;
+  if (det > 0.f ? (scaled_t <= tmin * det || scaled_t >= tmax * det)
+                : (scaled_t >= tmin * det || scaled_t <= tmax * det))
+    return false;
+
+  float inv_det = 1.f / det;
+  t = scaled_t * inv_det;
+  bary[0] = u * inv_det;
+  bary[1] = v * inv_det;
+  bary[2] = w * inv_det;
+  return true;
+}
+
+//––––––––––––– Sub-struct Mesh –––––––––––––––––––––––––
+
+Mesh::Mesh(vector<Point> v, vector<Normal> n, vector<MeshTriangle> tri, Transformation t, Material m, int n_threads)
+    : Shape(t, m), vertices{move(v)}, normals{move(n)}, triangles{move(tri)} {
+  build(n_threads);
+}
+
+Mesh::Mesh(shared_ptr<MappedFile> file, MappedArray v, MappedArray n, MappedArray tri, Transformation t, Material m,
+           int n_threads)
+    : Shape(t, m), mapping{file}, mapped_vertices{v}, mapped_normals{n}, mapped_triangles{tri} {
+  // The mapped triangles are first visited in file order
+  triangle_order.resize(tri.size);
+  for (int i{}; i < tri.size; ++i)
+    triangle_order[i] = i;
+  build(n_threads);
+}
+
+void Mesh::build(int n_threads) {
+
+  // Huge meshes (e.g. scanned models) trade some tracing speed for a build many times faster
+  method = (n_triangles() >= MESH_LINEAR_BUILD_THRESHOLD) ? BVHBuildMethod::LBVH : BVHBuildMethod::BINNED_SAH;
+  vector<int> order;
+  build_bvh_nodes(n_triangles(),
+                  [&](int i) {
+                    MeshTriangle tri = triangle(i);
+                    AABB box;
+                    for (int k{}; k < 3; ++k)
+                      box.expand(vertex(tri.vertex[k]));
+                    return box;
+                  },
+                  method, MESH_MAX_LEAF_SIZE, n_threads, nodes, order, stats);
+
+  // Store the triangles in leaf order, so that each leaf reads a contiguous range
+  if (mapping) {
+    triangle_order = move(order);
+  } else {
+    vector<MeshTriangle> sorted;
+    sorted.reserve(order.size());
+    for (int i : order)
+      sorted.push_back(triangles[i]);
+    triangles = move(sorted);
+  }
+}
+
+bool Mesh::hit_distance(Ray ray, HitDistance &hit) {
+
+  if (nodes.empty()) return false;
+  Ray query(ray.inverse_transform(transformation));
+  WatertightRay wray(query);
+
+  int stack[BVH_MAX_DEPTH];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+  bool found = false;
+  float t, bary[3];
+
+  while (stack_size > 0) {
+    int node_index = stack[--stack_size];
+    BVHNode &node = nodes[node_index];
+
+    float t_near;
+    if (!node.box.ray_intersection(query, query.tmin, query.tmax, t_near))
+      continue;
+
+    if (node.is_leaf()) {
+      for (int i{node.offset}; i < node.offset + node.count; ++i) {
+        MeshTriangle tri = triangle(i);
+        if (intersect_triangle(wray, vertex(tri.vertex[0]), vertex(tri.vertex[1]), vertex(tri.vertex[2]),
+                               query.tmin, query.tmax, t, bary)) {
+          // The query ray is shortened every time a closer hit is found
+          hit = HitDistance(t, this, i);
+          query.tmax = t;
+          found = true;
+        }
+      }
+    } else {
+      // Push the far child first, so that the near one is visited first
+      if (query.dir_is_neg[node.axis]) {
+        stack[stack_size++] = node_index + 1;
+        stack[stack_size++] = node.offset;
+      } else {
+        stack[stack_size++] = node.offset;
+        stack[stack_size++] = node_index + 1;
+      }
+    }
+  }
+  return found;
+}
+
+HitRecord Mesh::hit_record(Ray ray, HitDistance hit) {
+
+  Ray query(ray.inverse_transform(transformation));
+  MeshTriangle tri = triangle(hit.face);
+  Point A = vertex(tri.vertex[0]), B = vertex(tri.vertex[1]), C = vertex(tri.vertex[2]);
+
+  // The same test as 'hit_distance' gives the barycentric coordinates (the centroid if rounding makes it miss)
+  float t, bary[3] = {1.f / 3, 1.f / 3, 1.f / 3};
+  intersect_triangle(WatertightRay(query), A, B, C, -INFINITY, INFINITY, t, bary);
+  Point hit_point = A + (B - A) * bary[1] + (C - A) * bary[2];
+
+  Normal hit_normal;
+  if (tri.normal[0] >= 0) {
+    Normal nA = normal(tri.normal[0]), nB = normal(tri.normal[1]), nC = normal(tri.normal[2]);
+    hit_normal = Normal(bary[0] * nA.x + bary[1] * nB.x + bary[2] * nC.x, bary[0] * nA.y + bary[1] * nB.y + bary[2] * nC.y,
+                    bary[0] * nA.z + bary[1] * nB.z + bary[2] * nC.z);
+  } else {
+    Vec n = cross(B - A, C - A);
+    hit_normal = Normal(n.x, n.y, n.z);
+  }
+  if (dot(query.dir, hit_normal) > 0.) hit_normal = -hit_normal;
+
+  return HitRecord(transformation * hit_point, transformation * hit_normal, Vec2d(bary[1], bary[2]), hit.t, ray,
+                   material);
+}
+
+bool Mesh::check_if_intersection(Ray ray) {
+
+  if (nodes.empty()) return false;
+  Ray query(ray.inverse_transform(transformation));
+  WatertightRay wray(query);
+
+  int stack[BVH_MAX_DEPTH];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+  float t, bary[3];
+
+  while (stack_size > 0) {
+    BVHNode &node = nodes[stack[--stack_size]];
+
+    float t_near;
+    if (!node.box.ray_intersection(query, query.tmin, query.tmax, t_near))
+      continue;
+
+    if (node.is_leaf()) {
+      for (int i{node.offset}; i < node.offset + node.count; ++i) {
+        MeshTriangle tri = triangle(i);
+        if (intersect_triangle(wray, vertex(tri.vertex[0]), vertex(tri.vertex[1]), vertex(tri.vertex[2]),
+                               query.tmin, query.tmax, t, bary))
+          return true;
+      }
+    } else {
+      stack[stack_size++] = node.offset;
+      stack[stack_size++] = &node - nodes.data() + 1;
+    }
+  }
+  return false;
+}
+
+AABB Mesh::bounding_box() {
+  if (nodes.empty()) return AABB();
+  return transformation * nodes[0].box;
+}
+
+//––––––––––––– Reading OBJ files –––––––––––––––––––––––––
+
+/**
+ * A range of whole lines of an OBJ file, parsed by one thread
+ *
+ * @param begin, end The range of characters
+ * @param n_vertices, n_normals, n_triangles The numbers of elements defined in the chunk (first pass)
+ * @param vertex_offset, normal_offset, triangle_offset The numbers of elements defined in the previous chunks
+ * @param error Position of the first error found in the chunk (nullptr if none)
+ * @param message Description of the error
+ */
+struct ObjChunk {
+  const char *begin, *end;
+  int n_vertices = 0, n_normals = 0, n_triangles = 0;
+  int vertex_offset = 0, normal_offset = 0, triangle_offset = 0;
+  const char *error = nullptr;
+  string message;
+};
+
+/**
+ * Kinds of the lines of an OBJ file that are read (all the others are skipped)
+ */
+enum class ObjLine {
+  VERTEX,
+  NORMAL,
+  FACE,
+  OTHER,
+};
+
+static inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static inline const char *skip_blanks(const char *p, const char *end) {
+  while (p < end && is_blank(*p))
+    ++p;
+  return p;
+}
+
+/**
+ * Return the kind of the line starting at 'p' and move 'p' past its keyword
+ */
+static ObjLine obj_line_kind(const char *&p, const char *end) {
+  p = skip_blanks(p, end);
+  if (end - p >= 2 && p[0] == 'v' && is_blank(p[1])) {
+    p += 2;
+    return ObjLine::VERTEX;
+  }
+  if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' && is_blank(p[2])) {
+    p += 3;
+    return ObjLine::NORMAL;
+  }
+  if (end - p >= 2 && p[0] == 'f' && is_blank(p[1])) {
+    p += 2;
+    return ObjLine::FACE;
+  }
+  return ObjLine::OTHER;
+}
+
+/**
+ * Read the three coordinates of a vertex or of a normal
+ *
+ * @return false if they are not valid numbers
+ */
+static bool parse_obj_floats(const char *p, const char *end, float xyz[3]) {
+  for (int k{}; k < 3; ++k) {
+    p = skip_blanks(p, end);
+    if (p < end && *p == '+') ++p;
+    auto result = from_chars(p, end, xyz[k]);
+    if (result.ec != errc()) return false;
+    p = result.ptr;
+    if (p < end && !is_blank(*p)) return false;
+  }
+  return true;
+}
+
+/**
+ * Read the next corner of a face ('v', 'v/vt', 'v//vn' or 'v/vt/vn'), moving 'p' past it
+ *
+ * @param vertex Set to the (OBJ) index of the vertex
+ * @param normal Set to the (OBJ) index of the normal, 0 if there is none
+ * @return false if the corner is not valid
+ */
+static bool parse_obj_corner(const char *&p, const char *end, int &vertex, int &normal) {
+  auto result = from_chars(p, end, vertex);
+  if (result.ec != errc() || vertex == 0) return false;
+  p = result.ptr;
+  normal = 0;
+  if (p < end && *p == '/') {
+    ++p;
+    // The texture coordinates are skipped
+    if (p < end && *p != '/') {
+      int texture;
+      result = from_chars(p, end, texture);
+      if (result.ec != errc()) return false;
+      p = result.ptr;
+    }
+    if (p < end && *p == '/') {
+      ++p;
+      result = from_chars(p, end, normal);
+      if (result.ec != errc() || normal == 0) return false;
+      p = result.ptr;
+    }
+  }
+  return p == end || is_blank(*p);
+}
+
+/**
+ * First pass over a chunk: count the vertices, the normals and the triangles it defines
+ */
+static void count_obj_chunk(ObjChunk &chunk) {
+  for (const char *line = chunk.begin; line < chunk.end;) {
+    const char *eol = static_cast<const char *>(memchr(line, '\n', chunk.end - line));
+    if (!eol) eol = chunk.end;
+
+    const char *p = line;
+    ObjLine kind = obj_line_kind(p, eol);
+    if (kind == ObjLine::VERTEX) {
+      chunk.n_vertices++;
+    } else if (kind == ObjLine::NORMAL) {
+      chunk.n_normals++;
+    } else if (kind == ObjLine::FACE) {
+      // A polygon with k corners is split in k - 2 triangles
+      int n_corners = 0;
+      for (p = skip_blanks(p, eol); p < eol; p = skip_blanks(p, eol)) {
+        n_corners++;
+        while (p < eol && !is_blank(*p))
+          ++p;
+      }
+      chunk.n_triangles += max(n_corners - 2, 0);
+    }
+    line = eol + 1;
+  }
+}
+
+/**
+ * Second pass over a chunk: parse its elements straight into their place in the arrays of the mesh
+ */
+static void parse_obj_chunk(ObjChunk &chunk, vector<Point> &vertices, vector<Normal> &normals,
+                            vector<MeshTriangle> &triangles) {
+  int vertex_index = chunk.vertex_offset, normal_index = chunk.normal_offset, triangle_index = chunk.triangle_offset;
+  int n_vertices = vertices.size(), n_normals = normals.size();
+
+  auto fail = [&](const char *position, string message) {
+    chunk.error = position;
+    chunk.message = message;
+  };
+
+  for (const char *line = chunk.begin; line < chunk.end;) {
+    const char *eol = static_cast<const char *>(memchr(line, '\n', chunk.end - line));
+    if (!eol) eol = chunk.end;
+
+    const char *p = line;
+    ObjLine kind = obj_line_kind(p, eol);
+    float xyz[3];
+
+    if (kind == ObjLine::VERTEX) {
+      if (!parse_obj_floats(p, eol, xyz)) return fail(line, "invalid vertex");
+      vertices[vertex_index++] = Point(xyz[0], xyz[1], xyz[2]);
+
+    } else if (kind == ObjLine::NORMAL) {
+      if (!parse_obj_floats(p, eol, xyz)) return fail(line, "invalid normal");
+      normals[normal_index++] = Normal(xyz[0], xyz[1], xyz[2]);
+
+    } else if (kind == ObjLine::FACE) {
+      // The polygon is split in a fan of triangles around its first corner
+      int first_vertex{}, first_normal{}, last_vertex{}, last_normal{};
+      int n_corners = 0;
+      for (p = skip_blanks(p, eol); p < eol; p = skip_blanks(p, eol)) {
+        int vertex, normal;
+        if (!parse_obj_corner(p, eol, vertex, normal)) return fail(line, "invalid face");
+
+        // OBJ indices start from 1, negative ones count backwards from the last element defined
+        vertex = (vertex > 0) ? vertex - 1 : vertex_index + vertex;
+        if (vertex < 0 || vertex >= n_vertices) return fail(line, "vertex index out of range");
+        if (normal != 0) {
+          normal = (normal > 0) ? normal - 1 : normal_index + normal;
+          if (normal < 0 || normal >= n_normals) return fail(line, "normal index out of range");
+        } else {
+          normal = -1;
+        }
+
+        if (n_corners == 0) {
+          first_vertex = vertex;
+          first_normal = normal;
+        } else if (n_corners >= 2) {
+          MeshTriangle &tri = triangles[triangle_index++];
+          tri = MeshTriangle{{first_vertex, last_vertex, vertex}, {first_normal, last_normal, normal}};
+          // Triangles with some corners lacking a normal are flat shaded
+          if (first_normal < 0 || last_normal < 0 || normal < 0) tri.normal[0] = tri.normal[1] = tri.normal[2] = -1;
+        }
+        last_vertex = vertex;
+        last_normal = normal;
+        n_corners++;
+      }
+      if (n_corners < 3) return fail(line, "face with less than three vertices");
+    }
+    line = eol + 1;
+  }
+}
+
+Mesh read_obj_file(string file_name, Transformation transformation, Material material, int n_threads) {
+
+  ifstream stream(file_name, ios::binary);
+  if (!stream) throw InvalidMeshFileFormat("impossible to open the OBJ file '" + file_name + "'");
+  stream.seekg(0, ios::end);
+  size_t size = stream.tellg();
+  stream.seekg(0, ios::beg);
+  string buffer(size, '\0');
+  if (!stream.read(&buffer[0], size)) throw InvalidMeshFileFormat("impossible to read the OBJ file '" + file_name + "'");
+
+  // Split the file in chunks of whole lines
+  if (n_threads <= 0) n_threads = max(1, int(thread::hardware_concurrency()));
+  int n_parts = int(min(size_t(n_threads), size / OBJ_MIN_CHUNK_SIZE + 1));
+  const char *data = buffer.data();
+  vector<ObjChunk> chunks(n_parts);
+  for (int k{}; k < n_parts; ++k) {
+    chunks[k].begin = (k == 0) ? data : chunks[k - 1].end;
+    if (k == n_parts - 1) {
+      chunks[k].end = data + size;
+    } else {
+      const char *eol = static_cast<const char *>(memchr(data + size * (k + 1) / n_parts, '\n', size - size * (k + 1) / n_parts));
+      chunks[k].end = max(chunks[k].begin, eol ? eol + 1 : data + size);
+    }
+  }
+
+  auto for_each_chunk = [&](auto f) {
+    vector<thread> workers;
+    for (int k{1}; k < n_parts; ++k)
+      workers.push_back(thread(f, ref(chunks[k])));
+    f(chunks[0]);
+    for (auto &worker : workers)
+      worker.join();
+  };
+
+  // Count the elements of each chunk, so that all the arrays are allocated once and filled in parallel
+  for_each_chunk([](ObjChunk &chunk) { count_obj_chunk(chunk); });
+  for (int k{1}; k < n_parts; ++k) {
+    chunks[k].vertex_offset = chunks[k - 1].vertex_offset + chunks[k - 1].n_vertices;
+    chunks[k].normal_offset = chunks[k - 1].normal_offset + chunks[k - 1].n_normals;
+    chunks[k].triangle_offset = chunks[k - 1].triangle_offset + chunks[k - 1].n_triangles;
+  }
+  ObjChunk &last = chunks.back();
+  vector<Point> vertices(last.vertex_offset + last.n_vertices);
+  vector<Normal> normals(last.normal_offset + last.n_normals);
+  vector<MeshTriangle> triangles(last.triangle_offset + last.n_triangles);
+
+  for_each_chunk([&](ObjChunk &chunk) { parse_obj_chunk(chunk, vertices, normals, triangles); });
+
+  for (auto &chunk : chunks) {
+    if (chunk.error) {
+      int line_num = 1 + count(data, chunk.error, '\n');
+      throw InvalidMeshFileFormat(chunk.message + " in OBJ file '" + file_name + "' at line " + to_string(line_num));
+    }
+  }
+
+  return Mesh(move(vertices), move(normals), move(triangles), transformation, material, n_threads);
+}
+
+//––––––––––––– Reading PLY files –––––––––––––––––––––––––
+
+MappedFile::MappedFile(string file_name) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) throw InvalidMeshFileFormat("impossible to open the file '" + file_name + "'");
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    throw InvalidMeshFileFormat("impossible to read the file '" + file_name + "'");
+  }
+  size = info.st_size;
+  void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) throw InvalidMeshFileFormat("impossible to map the file '" + file_name + "' in memory");
+  data = static_cast<const char *>(address);
+}
+
+MappedFile::~MappedFile() { munmap(const_cast<char *>(data), size); }
+
+/**
+ * Scalar types of the properties of a PLY file
+ */
+enum class PlyType {
+  INT8,
+  UINT8,
+  INT16,
+  UINT16,
+  INT32,
+  UINT32,
+  FLOAT32,
+  FLOAT64,
+};
+
+/**
+ * A property of the records of a PLY element
+ *
+ * @param name The name of the property
+ * @param type The type of the property (of its items, for a list)
+ * @param is_list Whether the property is a list, made of a count followed by the items
+ * @param count_type The type of the count of a list
+ * @param offset The position of the property within the record (meaningful only before the first list)
+ */
+struct PlyProperty {
+  string name;
+  PlyType type;
+  bool is_list = false;
+  PlyType count_type = PlyType::UINT8;
+  size_t offset = 0;
+};
+
+/**
+ * An element of a PLY file: 'count' records with the same properties
+ *
+ * @param stride The size of a record (0 if it contains a list, whose records have different sizes)
+ * @param offset The position of the first record in the file
+ */
+struct PlyElement {
+  string name;
+  size_t count = 0;
+  vector<PlyProperty> properties;
+  size_t stride = 0;
+  size_t offset = 0;
+
+  /**
+   * Return the index of the property with the given name (-1 if there is none)
+   */
+  int find(string property) {
+    for (int i{}; i < properties.size(); ++i)
+      if (properties[i].name == property) return i;
+    return -1;
+  }
+};
+
+static bool parse_ply_type(string name, PlyType &type) {
+  static const unordered_map<string, PlyType> types = {
+      {"char", PlyType::INT8},     {"int8", PlyType::INT8},       {"uchar", PlyType::UINT8},
+      {"uint8", PlyType::UINT8},   {"short", PlyType::INT16},     {"int16", PlyType::INT16},
+      {"ushort", PlyType::UINT16}, {"uint16", PlyType::UINT16},   {"int", PlyType::INT32},
+      {"int32", PlyType::INT32},   {"uint", PlyType::UINT32},     {"uint32", PlyType::UINT32},
+      {"float", PlyType::FLOAT32}, {"float32", PlyType::FLOAT32}, {"double", PlyType::FLOAT64},
+      {"float64", PlyType::FLOAT64},
+  };
+  auto it = types.find(name);
+  if (it == types.end()) return false;
+  type = it->second;
+  return true;
+}
+
+static size_t ply_type_size(PlyType type) {
+  if (type == PlyType::INT8 || type == PlyType::UINT8) return 1;
+  else if (type == PlyType::INT16 || type == PlyType::UINT16) return 2;
+  else if (type == PlyType::FLOAT64) return 8;
+  else return 4;
+}
+
+/**
+ * Read a (little-endian) value of the given type
+ */
+template <typename T> static inline T load(const char *p) {
+  T value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static double ply_value(const char *p, PlyType type) {
+  switch (type) {
+  case PlyType::INT8:
+    return load<int8_t>(p);
+  case PlyType::UINT8:
+    return load<uint8_t>(p);
+  case PlyType::INT16:
+    return load<int16_t>(p);
+  case PlyType::UINT16:
+    return load<uint16_t>(p);
+  case PlyType::INT32:
+    return load<int32_t>(p);
+  case PlyType::UINT32:
+    return load<uint32_t>(p);
+  case PlyType::FLOAT32:
+    return load<float>(p);
+  default:
+    return load<double>(p);
+  }
+}
+
+/**
+ * Move 'p' past a record of the element, checking that it does not go beyond 'end'
+ *
+ * @return false if the record is truncated
+ */
+static bool skip_ply_record(const char *&p, const char *end, PlyElement &element) {
+  if (element.stride > 0) {
+    if (size_t(end - p) < element.stride) return false;
+    p += element.stride;
+    return true;
+  }
+  for (auto &property : element.properties) {
+    if (property.is_list) {
+      size_t count_size = ply_type_size(property.count_type);
+      if (size_t(end - p) < count_size) return false;
+      double count = ply_value(p, property.count_type);
+      p += count_size;
+      if (count < 0. || size_t(end - p) < count * ply_type_size(property.type)) return false;
+      p += size_t(count) * ply_type_size(property.type);
+    } else {
+      if (size_t(end - p) < ply_type_size(property.type)) return false;
+      p += ply_type_size(property.type);
+    }
+  }
+  return true;
+}
+
+/**
+ * Check if the three properties with the given names are consecutive floats, so that they can be read in place
+ */
+static bool are_packed_floats(PlyElement &element, string x, string y, string z) {
+  int i = element.find(x), j = element.find(y), k = element.find(z);
+  if (i < 0 || j != i + 1 || k != i + 2) return false;
+  for (int p : {i, j, k})
+    if (element.properties[p].type != PlyType::FLOAT32) return false;
+  return true;
+}
+
+Mesh read_ply_file(string file_name, Transformation transformation, Material material, int n_threads) {
+
+  auto file = make_shared<MappedFile>(file_name);
+  const char *begin = file->data, *end = file->data + file->size;
+  auto error = [&](string message) { return InvalidMeshFileFormat(message + " in PLY file '" + file_name + "'"); };
+
+  // Header: a text line per statement, up to 'end_header'
+  vector<PlyElement> elements;
+  const char *p = begin;
+  bool header_ended = false;
+  for (int line_num{1}; p < end && !header_ended; ++line_num) {
+    const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+    if (!eol) throw error("unterminated header");
+    string line(p, eol);
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    p = eol + 1;
+
+    istringstream words(line);
+    string keyword;
+    words >> keyword;
+    if (line_num == 1) {
+      if (keyword != "ply") throw error("missing 'ply' magic number");
+    } else if (keyword == "format") {
+      string format;
+      words >> format;
+      if (format != "binary_little_endian") throw error("unsupported format '" + format + "' (only binary_little_endian is read)");
+    } else if (keyword == "element") {
+      PlyElement element;
+      long long count = -1;
+      words >> element.name >> count;
+      if (count < 0) throw error("invalid element at line " + to_string(line_num));
+      element.count = count;
+      elements.push_back(element);
+    } else if (keyword == "property") {
+      if (elements.empty()) throw error("property outside of an element at line " + to_string(line_num));
+      PlyProperty property;
+      string type;
+      words >> type;
+      if (type == "list") {
+        string count_type;
+        words >> count_type >> type;
+        property.is_list = true;
+        if (!parse_ply_type(count_type, property.count_type)) throw error("unknown type '" + count_type + "'");
+      }
+      if (!parse_ply_type(type, property.type)) throw error("unknown type '" + type + "'");
+      words >> property.name;
+      elements.back().properties.push_back(property);
+    } else if (keyword == "end_header") {
+      header_ended = true;
+    } else if (keyword != "comment" && keyword != "obj_info" && !keyword.empty()) {
+      throw error("unknown header keyword '" + keyword + "' at line " + to_string(line_num));
+    }
+  }
+  if (!header_ended) throw error("unterminated header");
+
+  // Place the elements in the file: the records with a list must be walked one by one
+  PlyElement *vertex_element = nullptr, *face_element = nullptr;
+  for (auto &element : elements) {
+    bool has_list = false;
+    size_t offset = 0;
+    for (auto &property : element.properties) {
+      property.offset = offset;
+      has_list = has_list || property.is_list;
+      offset += ply_type_size(property.type);
+    }
+    element.stride = has_list ? 0 : offset;
+    element.offset = p - begin;
+    if (element.stride > 0 && size_t(end - p) / element.stride < element.count) throw error("truncated element '" + element.name + "'");
+    if (element.stride > 0 || element.count == 0) {
+      p += element.stride * element.count;
+    } else {
+      for (size_t i{}; i < element.count; ++i)
+        if (!skip_ply_record(p, end, element)) throw error("truncated element '" + element.name + "'");
+    }
+
+    if (element.name == "vertex") vertex_element = &element;
+    if (element.name == "face") face_element = &element;
+  }
+
+  if (!vertex_element || vertex_element->stride == 0 || vertex_element->find("x") < 0 ||
+      vertex_element->find("y") < 0 || vertex_element->find("z") < 0)
+    throw error("missing vertex coordinates");
+  PlyElement &vertex_data = *vertex_element;
+  int x = vertex_data.find("x"), y = vertex_data.find("y"), z = vertex_data.find("z");
+  int nx = vertex_data.find("nx"), ny = vertex_data.find("ny"), nz = vertex_data.find("nz");
+  bool has_normals = nx >= 0 && ny >= 0 && nz >= 0;
+  if (vertex_data.count > size_t(INT32_MAX)) throw error("too many vertices");
+
+  int indices = -1;
+  if (face_element) {
+    indices = face_element->find("vertex_indices");
+    if (indices < 0) indices = face_element->find("vertex_index");
+  }
+  if (indices < 0 || !face_element->properties[indices].is_list) throw error("missing face indices");
+  PlyElement &face_data = *face_element;
+  PlyProperty &index_property = face_data.properties[indices];
+  size_t index_size = ply_type_size(index_property.type), count_size = ply_type_size(index_property.count_type);
+  int n_vertices = vertex_data.count;
+
+  // The faces can be used in place if they are triangles made only of 32-bit indices (then all records have the same size)
+  bool packed_faces = face_data.properties.size() == 1 && index_size == 4 &&
+                      (index_property.type == PlyType::INT32 || index_property.type == PlyType::UINT32);
+  for (size_t i{}; packed_faces && i < face_data.count; ++i)
+    packed_faces = ply_value(begin + face_data.offset + i * (count_size + 12), index_property.count_type) == 3.;
+  bool packed_vertices = are_packed_floats(vertex_data, "x", "y", "z") &&
+                         (!has_normals || are_packed_floats(vertex_data, "nx", "ny", "nz"));
+
+  if (packed_faces && packed_vertices) {
+    MappedArray vertices{vertex_data.offset + vertex_data.properties[x].offset, vertex_data.stride, vertex_data.count};
+    MappedArray normals;
+    if (has_normals) normals = {vertex_data.offset + vertex_data.properties[nx].offset, vertex_data.stride, vertex_data.count};
+    MappedArray triangles{face_data.offset + count_size, count_size + 12, face_data.count};
+
+    // The indices are checked once, so that the intersections can trust them
+    for (size_t i{}; i < face_data.count; ++i) {
+      const char *record = begin + triangles.offset + i * triangles.stride;
+      for (int k{}; k < 3; ++k) {
+        int32_t index = load<int32_t>(record + 4 * k);
+        if (index < 0 || index >= n_vertices) throw error("vertex index out of range in face " + to_string(i));
+      }
+    }
+    return Mesh(file, vertices, normals, triangles, transformation, material, n_threads);
+  }
+
+  // Any other layout is converted into arrays owned by the mesh
+  vector<Point> vertices(n_vertices);
+  vector<Normal> normals(has_normals ? n_vertices : 0);
+  for (int i{}; i < n_vertices; ++i) {
+    const char *record = begin + vertex_data.offset + i * vertex_data.stride;
+    auto value = [&](int property) {
+      return float(ply_value(record + vertex_data.properties[property].offset, vertex_data.properties[property].type));
+    };
+    vertices[i] = Point(value(x), value(y), value(z));
+    if (has_normals) normals[i] = Normal(value(nx), value(ny), value(nz));
+  }
+
+  vector<MeshTriangle> triangles;
+  triangles.reserve(face_data.count);
+  p = begin + face_data.offset;
+  for (size_t i{}; i < face_data.count; ++i) {
+    for (auto &property : face_data.properties) {
+      size_t item_size = ply_type_size(property.type), count = 1;
+      if (property.is_list) {
+        count = size_t(ply_value(p, property.count_type));
+        p += ply_type_size(property.count_type);
+      }
+
+      // Polygons are split in fans of triangles around their first vertex
+      if (&property == &index_property) {
+        if (count < 3) throw error("face " + to_string(i) + " with less than three vertices");
+        int first{}, last{};
+        for (size_t k{}; k < count; ++k) {
+          double index = ply_value(p + k * item_size, property.type);
+          if (index < 0. || index >= n_vertices) throw error("vertex index out of range in face " + to_string(i));
+          int current = int(index);
+          if (k == 0)
+            first = current;
+          else if (k >= 2)
+            triangles.push_back(has_normals ? MeshTriangle{{first, last, current}, {first, last, current}}
+                                            : MeshTriangle{{first, last, current}, {-1, -1, -1}});
+          last = current;
+        }
+      }
+      p += count * item_size;
+    }
+  }
+  return Mesh(move(vertices), move(normals), move(triangles), transformation, material, n_threads);
+}
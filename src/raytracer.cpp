@@ -39,9 +39,18 @@ using namespace std;
  * @param height Output image height
  * @param output_file PFM/PNG/JPEG output file name with the path where to place it
  * @param variables_list floating point variables list to set parameters directly from the command line (ex: angle where to see the scene)
+ * @param bvh_method strategy to build the bounding volume hierarchy, to choose among sah, binned, fast, lbvh
+ * @param accelerator acceleration structure, to choose among none, bvh, wide, grid, hashgrid
+ * @param cache_directory directory where the bounding volume hierarchies are cached (empty: no cache)
+ * @param pack_spheres whether nearby spheres are packed in sets intersected with SIMD instructions
+ * @param typed_storage whether the shapes checked one by one are stored in arrays sorted by type
+ * @param packet_side side of the blocks of pixels whose primary rays are traced together
+ * @param n_threads number of rendering threads (0: all the available cores)
+ * @param tile_size side of the square tiles in which the image is split among the threads
+ * @param tile_order order in which the tiles are handed out to the threads, to choose among rows, hilbert, spiral
  *
  */
-void image_render(string, string, int, int, uint64_t, uint64_t, int, float, float, int, int, string, vector<string>);
+void image_render(string, string, int, int, uint64_t, uint64_t, int, float, float, int, int, string, vector<string>, string, string, string, bool, bool, int, int, int, string);
 
 /**
  * Function needed to convert the variable_list passed from the command line into the a dictionary variable
@@ -107,6 +116,24 @@ int main(int argc, char **argv) {
   args::ValueFlagList<string> declare_variables(render_arguments, "",
                              "Declare float variables (i.e. identifiers in the scene file): \n --declare_var name=value \n Example: --declare_var ang=10",
                              {'v', "declare_var"});
+  args::ValueFlag<string> bvh(render_arguments, "",
+                             "Bounding volume hierarchy builder: \n sah/binned/fast/lbvh \n (default sah)", {"bvh"});
+  args::ValueFlag<string> accel(render_arguments, "",
+                             "Acceleration structure: \n none/bvh/wide/grid/hashgrid \n (default bvh)", {"accel"});
+  args::ValueFlag<string> cache(render_arguments, "",
+                             "Directory where the bounding volume hierarchies are cached \n between renders of the same scene \n (default: no cache)", {"cache"});
+  args::Flag simd_spheres(render_arguments, "",
+                             "Pack nearby spheres in sets intersected \n with SIMD instructions", {"simd_spheres"});
+  args::Flag typed_shapes(render_arguments, "",
+                             "Store the shapes checked one by one \n in arrays sorted by type", {"typed_shapes"});
+  args::ValueFlag<int> packet(render_arguments, "",
+                             "Side of the blocks of pixels whose primary rays \n are traced together, 1 for single rays \n (default 8)", {"packet"});
+  args::ValueFlag<int> threads(render_arguments, "",
+                             "Number of rendering threads, 0 for all \n the available cores (default 0)", {"threads"});
+  args::ValueFlag<int> tile_size(render_arguments, "",
+                             "Side of the square tiles in which the image \n is split among the threads (default 32)", {"tile-size", "tile_size"});
+  args::ValueFlag<string> tile_order(render_arguments, "",
+                             "Order in which the tiles are handed out \n to the threads: rows/hilbert/spiral \n (default hilbert)", {"tile-order", "tile_order"});
   
   //args::HelpFlag helph(hdr2ldr, "help", "Display help menu", {'h', "help"});
   args::Positional<std::string> pfm_file(hdr2ldr, "HDR_IMAGE", "The input HDR image (PFM format) \n  (REQUIRED)");
@@ -151,8 +178,8 @@ int main(int argc, char **argv) {
     }
     
     
-    string _algorithm = "pathtracer", _output_file = get_path(args::get(scene_file))+"image_"+current_date_time()+".png";
-    int _n_rays = 10, _max_depth = 2, _state = 42, _seq = 54, _samples_per_pixel=0, _width = 640, _height = 480;
+    string _algorithm = "pathtracer", _bvh = "sah", _accel = "bvh", _cache = "", _tile_order = "hilbert", _output_file = get_path(args::get(scene_file))+"image_"+current_date_time()+".png";
+    int _n_rays = 10, _max_depth = 2, _state = 42, _seq = 54, _samples_per_pixel=0, _width = 640, _height = 480, _packet = RAY_PACKET_SIDE, _threads = 0, _tile_size = RENDER_TILE_SIZE;
     float _a_r = 1., _gamma_r = 1.;
     
     if (!scene_file){
@@ -172,9 +199,16 @@ int main(int argc, char **argv) {
     if (width) _width = args::get(width);
     if (height) _height = args::get(height);
     if (output_file) _output_file = args::get(output_file);
+    if (bvh) _bvh = args::get(bvh);
+    if (accel) _accel = args::get(accel);
+    if (cache) _cache = args::get(cache);
+    if (packet) _packet = args::get(packet);
+    if (threads) _threads = args::get(threads);
+    if (tile_size) _tile_size = args::get(tile_size);
+    if (tile_order) _tile_order = args::get(tile_order);
 
     image_render(args::get(scene_file), _algorithm, _n_rays, _max_depth, _state, _seq,
-                 _samples_per_pixel, _a_r, _gamma_r, _width, _height, _output_file, variables_list);
+                 _samples_per_pixel, _a_r, _gamma_r, _width, _height, _output_file, variables_list, _bvh, _accel, _cache, args::get(simd_spheres), args::get(typed_shapes), _packet, _threads, _tile_size, _tile_order);
   }
     
   else if (hdr2ldr) {
@@ -241,23 +275,82 @@ unordered_map<string, float> build_variable_dictionary(vector<string> variables_
 
 //––––––––––––
 void image_render(string scene_file, string algorithm, int n_rays, int max_depth, uint64_t state, uint64_t seq,
-                  int samples_per_pixel, float a, float gamma, int width, int height, string output_file, vector<string> variables_list) {
+                  int samples_per_pixel, float a, float gamma, int width, int height, string output_file, vector<string> variables_list, string bvh, string accel, string cache_directory, bool pack_spheres, bool typed_storage, int packet_side, int n_threads, int tile_size, string tile_order) {
 
   unordered_map<string, float> variables = build_variable_dictionary(variables_list);
 
+  BVHBuildMethod bvh_method;
+  if (bvh == "sah") {
+    bvh_method = BVHBuildMethod::SAH;
+  } else if (bvh == "binned") {
+    bvh_method = BVHBuildMethod::BINNED_SAH;
+  } else if (bvh == "fast") {
+    bvh_method = BVHBuildMethod::MIDPOINT;
+  } else if (bvh == "lbvh") {
+    bvh_method = BVHBuildMethod::LBVH;
+  } else {
+    cout << "Error: unknown bounding volume hierarchy builder '" + bvh + "' (choose among sah, binned, fast, lbvh)" << endl;
+    return;
+  }
+
+  TileOrder order;
+  if (tile_order == "rows") {
+    order = TileOrder::ROWS;
+  } else if (tile_order == "hilbert") {
+    order = TileOrder::HILBERT;
+  } else if (tile_order == "spiral") {
+    order = TileOrder::SPIRAL;
+  } else {
+    cout << "Error: unknown tile order '" + tile_order + "' (choose among rows, hilbert, spiral)" << endl;
+    return;
+  }
+
+  AcceleratorType accelerator_type;
+  if (accel == "none") {
+    accelerator_type = AcceleratorType::NONE;
+  } else if (accel == "bvh") {
+    accelerator_type = AcceleratorType::BVH;
+  } else if (accel == "wide") {
+    accelerator_type = AcceleratorType::WIDE_BVH;
+  } else if (accel == "grid") {
+    accelerator_type = AcceleratorType::GRID;
+  } else if (accel == "hashgrid") {
+    accelerator_type = AcceleratorType::HASHED_GRID;
+  } else {
+    cout << "Error: unknown acceleration structure '" + accel + "' (choose among none, bvh, wide, grid, hashgrid)" << endl;
+    return;
+  }
+
   ifstream in;
   in.open(scene_file);
   Scene scene;
 
   try {
     InputStream scene_stream(in);
-    scene = scene_stream.parse_scene(variables);
+    scene = scene_stream.parse_scene(variables, bvh_method, accelerator_type, cache_directory, pack_spheres, typed_storage);
 
   } catch (runtime_error &e) {
     cout << e.what() << endl;
     return;
   }
   
+  if (scene.world.bvh)
+    cout << "Bounding volume hierarchy ('" + bvh + "'): " + scene.world.bvh->stats.get_string() + "." << endl;
+  if (scene.world.accelerator)
+    cout << "Acceleration structure ('" + accel + "'): " + to_string(scene.world.accelerator->memory_footprint()) +
+                " bytes." << endl;
+  if (pack_spheres)
+    cout << "Spheres packed in " + to_string(scene.world.sphere_sets.size()) + " sets, intersected with " +
+                simd_level_name(best_simd_level()) + " instructions." << endl;
+  if (scene.world.typed_shapes)
+    cout << "Shapes checked one by one: " + to_string(scene.world.typed_shapes->spheres.size()) + " spheres, " +
+                to_string(scene.world.typed_shapes->planes.size()) + " planes, " +
+                to_string(scene.world.typed_shapes->boxes.size()) + " boxes, " +
+                to_string(scene.world.typed_shapes->others.size()) + " other shapes." << endl;
+  if (scene.bvh_cache)
+    cout << "Cache '" + cache_directory + "': " + to_string(scene.bvh_cache->n_hits) + " hierarchies loaded, " +
+                to_string(scene.bvh_cache->n_misses) + " built." << endl;
+
   HdrImage image(width, height);
   
   cout << "Creating a "+to_string(width)+"x"+to_string(height)+" image, using the \'"+algorithm+"\' rendering algorithm." <<endl;
@@ -275,20 +368,37 @@ void image_render(string scene_file, string algorithm, int n_rays, int max_depth
 
    // Run the ray-tracer
   ImageTracer tracer(image, scene.camera, samples_per_side, pcg);
+  tracer.tile_order = order;
+
+  if (packet_side < 1) {
+    cout << "Error: the side of the ray packets must be positive" << endl;
+    return;
+  }
+  if (n_threads < 0 || tile_size < 1) {
+    cout << "Error: the number of threads must be non-negative and the side of the tiles positive" << endl;
+    return;
+  }
 
-  shared_ptr<Renderer> renderer;
+  // The tiles are rendered in parallel, the random numbers of each sample being drawn from its own PCG;
+  // the renderer is passed with its own type, so that its kernel is called directly
+  auto render = [&](auto &renderer) { tracer.fire_ray_batches(renderer, n_threads, tile_size, packet_side); }; //***
   if (algorithm == "onoff") {
-    renderer = make_shared<OnOffRenderer>(scene.world);
+    OnOffRenderer renderer(scene.world);
+    render(renderer);
   } else if (algorithm == "flat") {
-    renderer = make_shared<FlatRenderer>(scene.world);
+    FlatRenderer renderer(scene.world);
+    render(renderer);
   } else if (algorithm == "pathtracer") {
-    renderer = make_shared<PathTracer>(scene.world, BLACK, pcg, n_rays, max_depth, rr_lim);
+    PathTracer renderer(scene.world, BLACK, pcg, n_rays, max_depth, rr_lim);
+    render(renderer);
   } else if (algorithm == "pointlight") {
-    renderer = make_shared<PointLightTracer>(scene.world, BLACK);
+    PointLightTracer renderer(scene.world, BLACK);
+    render(renderer);
+  } else {
+    cout << "Error: unknown rendering algorithm '" + algorithm + "' (choose among onoff, flat, pathtracer, pointlight)" << endl;
+    return;
   }
-
-  tracer.fire_all_rays(
-      [&](Ray ray) -> Color { return (*renderer)(ray); }); //***
+  cout << "Tiles ('" + tile_order_name(order) + "'): " + tracer.tile_stats.get_string() << endl;
 
   // Understand format output file (PFM/PNG/JPG)
   string format = get_format(output_file);
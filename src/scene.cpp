@@ -18,6 +18,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "scene.h"
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
@@ -28,6 +29,9 @@ unordered_map<string, Keyword> KEYWORDS = {
     {"plane", Keyword::PLANE},
     {"sphere", Keyword::SPHERE},
     {"box", Keyword::BOX},
+    {"mesh", Keyword::MESH},
+    {"group", Keyword::GROUP},
+    {"instance", Keyword::INSTANCE},
     {"light", Keyword::LIGHT},
     {"diffuse", Keyword::DIFFUSE},
     {"specular", Keyword::SPECULAR},
@@ -518,6 +522,92 @@ Box InputStream::parse_box(Scene scene) {
   return Box(point1, point2, transformation, scene.materials[material_name]);
 }
 
+// Mesh
+Mesh InputStream::parse_mesh(Scene scene) {
+  expect_symbol('(');
+
+  string material_name = expect_identifier();
+  if (scene.materials.find(material_name) == scene.materials.end()) {
+    // We raise the exception here because input_file is pointing to the end
+    // of the wrong identifier
+    throw GrammarError("unknown material '" + material_name + "'", location);
+  }
+
+  expect_symbol(',');
+  string file_name = expect_string();
+  expect_symbol(',');
+  Transformation transformation = parse_transformation(scene);
+  expect_symbol(')');
+
+  // The format is chosen from the extension of the file
+  string extension = file_name.substr(min(file_name.rfind('.'), file_name.size()));
+  transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+  if (extension == ".ply") return read_ply_file(file_name, transformation, scene.materials[material_name]);
+  return read_obj_file(file_name, transformation, scene.materials[material_name]);
+}
+
+// Group
+tuple<string, shared_ptr<ShapeGroup>> InputStream::parse_group(Scene scene) {
+  string name = expect_identifier();
+  shared_ptr<ShapeGroup> group = make_shared<ShapeGroup>();
+  group->pack_spheres = scene.pack_spheres;
+  group->typed_storage = scene.typed_storage;
+
+  expect_symbol('(');
+  while (true) {
+    Keyword keyword = expect_keyword(
+        vector{Keyword::SPHERE, Keyword::PLANE, Keyword::BOX, Keyword::MESH, Keyword::INSTANCE});
+
+    if (keyword == Keyword::SPHERE)
+      group->add_shape(make_shared<Sphere>(parse_sphere(scene)));
+    else if (keyword == Keyword::PLANE)
+      group->add_shape(make_shared<Plane>(parse_plane(scene)));
+    else if (keyword == Keyword::BOX)
+      group->add_shape(make_shared<Box>(parse_box(scene)));
+    else if (keyword == Keyword::MESH)
+      group->add_shape(make_shared<Mesh>(parse_mesh(scene)));
+    else if (keyword == Keyword::INSTANCE)
+      group->add_shape(make_shared<Instance>(parse_instance(scene)));
+
+    // Shapes are separated by commas, the list ends with ')'
+    Token next_token = read_token();
+    if (next_token.type == TokenType::SYMBOL && next_token.value.symbol == ')')
+      break;
+    if (next_token.type != TokenType::SYMBOL || next_token.value.symbol != ',')
+      throw GrammarError("expected ',' or ')' instead of '" + next_token.value_str() + "'",
+                         next_token.location);
+  }
+
+  group->build_accelerator(scene.accelerator_type, scene.bvh_method, scene.bvh_cache);
+  return tuple<string, shared_ptr<ShapeGroup>>{name, group};
+}
+
+// Instance
+Instance InputStream::parse_instance(Scene scene) {
+  expect_symbol('(');
+
+  string group_name = expect_identifier();
+  if (scene.groups.find(group_name) == scene.groups.end())
+    throw GrammarError("unknown group '" + group_name + "'", location);
+  expect_symbol(',');
+
+  // An optional material comes before the transformation, which always starts with a keyword
+  Token next_token = read_token();
+  if (next_token.type == TokenType::IDENTIFIER) {
+    string material_name = next_token.value.str;
+    if (scene.materials.find(material_name) == scene.materials.end())
+      throw GrammarError("unknown material '" + material_name + "'", location);
+    expect_symbol(',');
+    Transformation transformation = parse_transformation(scene);
+    expect_symbol(')');
+    return Instance(scene.groups[group_name], transformation, scene.materials[material_name]);
+  }
+
+  unread_token(next_token);
+  Transformation transformation = parse_transformation(scene);
+  expect_symbol(')');
+  return Instance(scene.groups[group_name], transformation);
+}
 
 // PointLight
 PointLight InputStream::parse_light(Scene scene) {
@@ -562,12 +652,22 @@ shared_ptr<Camera> InputStream::parse_camera(Scene scene) {
 
 //––––––––––––– Scene creation –––––––––––––
 
-Scene InputStream::parse_scene(unordered_map<string, float> variables) {
+Scene InputStream::parse_scene(unordered_map<string, float> variables, BVHBuildMethod bvh_method,
+                               AcceleratorType accelerator_type, string cache_directory, bool pack_spheres,
+                               bool typed_storage) {
   if(!stream_in){
     throw runtime_error("Error: scene file does not exist");
 }
   Scene scene;
   scene.float_variables = variables;
+  scene.bvh_method = bvh_method;
+  scene.accelerator_type = accelerator_type;
+  scene.pack_spheres = pack_spheres;
+  scene.world.pack_spheres = pack_spheres;
+  scene.typed_storage = typed_storage;
+  scene.world.typed_storage = typed_storage;
+  if (!cache_directory.empty())
+    scene.bvh_cache = make_shared<BVHCache>(cache_directory);
   for(auto var : variables)
     scene.overridden_variables.push_back(var.first);
 
@@ -614,6 +714,18 @@ Scene InputStream::parse_scene(unordered_map<string, float> variables) {
     } else if (what.value.keyword == Keyword::BOX) {
       scene.world.add_shape(make_shared<Box>(parse_box(scene)));
 
+    } else if (what.value.keyword == Keyword::MESH) {
+      scene.world.add_shape(make_shared<Mesh>(parse_mesh(scene)));
+
+    } else if (what.value.keyword == Keyword::GROUP) {
+      tuple<string, shared_ptr<ShapeGroup>> group = parse_group(scene);
+      if (scene.groups.find(get<string>(group)) != scene.groups.end())
+        throw GrammarError("group '" + get<string>(group) + "' cannot be redefined", location);
+      scene.groups[get<string>(group)] = get<shared_ptr<ShapeGroup>>(group);
+
+    } else if (what.value.keyword == Keyword::INSTANCE) {
+      scene.world.add_shape(make_shared<Instance>(parse_instance(scene)));
+
     } else if (what.value.keyword == Keyword::LIGHT) {
       scene.world.add_light(PointLight(parse_light(scene)));
 
@@ -627,5 +739,6 @@ Scene InputStream::parse_scene(unordered_map<string, float> variables) {
       scene.materials[get<string>(material)] = get<Material>(material);
     }
   }
+  scene.world.build_accelerator(scene.accelerator_type, scene.bvh_method, scene.bvh_cache);
   return scene;
 }
@@ -0,0 +1,197 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "scheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <thread>
+
+//––––––––––––– Tile orders –––––––––––––––––––––––––
+
+string tile_order_name(TileOrder order) {
+  if (order == TileOrder::ROWS) return "rows";
+  else if (order == TileOrder::HILBERT) return "hilbert";
+  else return "spiral";
+}
+
+/**
+ * Return the position of the cell (x, y) along the Hilbert curve filling an n x n grid (n a power of 2)
+ */
+static uint64_t hilbert_index(int n, int x, int y) {
+  uint64_t d = 0;
+  for (int s = n / 2; s > 0; s /= 2) {
+    int rx = (x & s) > 0, ry = (y & s) > 0;
+    d += uint64_t(s) * s * ((3 * rx) ^ ry);
+    // Rotate the quadrant, so that the curve of the next level starts where the previous one ends
+    if (ry == 0) {
+      if (rx == 1) {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      swap(x, y);
+    }
+  }
+  return d;
+}
+
+vector<Tile> split_in_tiles(int width, int height, int tile_size, TileOrder order) {
+  int n_cols = (width + tile_size - 1) / tile_size, n_rows = (height + tile_size - 1) / tile_size;
+  vector<Tile> tiles;
+  tiles.reserve(n_cols * n_rows);
+  auto add_tile = [&](int col, int row) {
+    tiles.push_back(Tile{col * tile_size, row * tile_size, min((col + 1) * tile_size, width),
+                         min((row + 1) * tile_size, height), row * n_cols + col});
+  };
+
+  if (order == TileOrder::ROWS) {
+    for (int row{}; row < n_rows; ++row) {
+      for (int col{}; col < n_cols; ++col)
+        add_tile(col, row);
+    }
+
+  } else if (order == TileOrder::HILBERT) {
+    // The curve of the smallest square grid covering the tiles, skipping the cells out of the image
+    int n = 1;
+    while (n < max(n_cols, n_rows)) n *= 2;
+    vector<pair<uint64_t, int>> keys;
+    for (int row{}; row < n_rows; ++row) {
+      for (int col{}; col < n_cols; ++col)
+        keys.push_back({hilbert_index(n, col, row), row * n_cols + col});
+    }
+    sort(keys.begin(), keys.end());
+    for (auto key : keys)
+      add_tile(key.second % n_cols, key.second / n_cols);
+
+  } else {
+    // Walk a square spiral around the central tile, skipping the cells out of the image
+    int col = (n_cols - 1) / 2, row = (n_rows - 1) / 2;
+    int dcol[4] = {1, 0, -1, 0}, drow[4] = {0, 1, 0, -1};
+    int n_tiles = n_cols * n_rows;
+    if (n_tiles > 0) add_tile(col, row);
+    for (int leg{}; tiles.size() < n_tiles; ++leg) {
+      for (int step{}; step < leg / 2 + 1; ++step) {
+        col += dcol[leg % 4];
+        row += drow[leg % 4];
+        if (col >= 0 && col < n_cols && row >= 0 && row < n_rows) add_tile(col, row);
+      }
+    }
+  }
+  return tiles;
+}
+
+//––––––––––––– Functions for Struct SchedulerStats –––––––––––––––––––––––––
+
+string SchedulerStats::get_string() {
+  ostringstream stream;
+  stream.precision(1);
+  stream << fixed << n_tiles.size() << " thread(s), " << wall_ms << " ms";
+  for (int i{}; i < n_tiles.size(); ++i)
+    stream << "\n - thread " << i << ": " << n_tiles[i] << " tiles (" << n_stolen[i] << " stolen), busy "
+           << busy_ms[i] << " ms, idle " << idle_ms[i] << " ms";
+  return stream.str();
+}
+
+//––––––––––––– Functions for Struct TileScheduler –––––––––––––––––––––––––
+
+// A run of tiles [begin, end) packed in a single word, so that it is updated with one compare-and-swap
+static uint64_t pack_run(uint32_t begin, uint32_t end) { return (uint64_t(begin) << 32) | end; }
+static uint32_t run_begin(uint64_t run) { return uint32_t(run >> 32); }
+static uint32_t run_end(uint64_t run) { return uint32_t(run); }
+
+void TileScheduler::run(int n_threads, function<void(const Tile &)> render_tile) {
+  using clock = chrono::steady_clock;
+
+  if (n_threads <= 0) n_threads = max(1, int(thread::hardware_concurrency()));
+  int n = tiles.size();
+  n_threads = max(1, min(n_threads, n));
+
+  vector<atomic<uint64_t>> runs(n_threads);
+  for (int i{}; i < n_threads; ++i)
+    runs[i] = pack_run(uint64_t(i) * n / n_threads, uint64_t(i + 1) * n / n_threads);
+
+  stats.n_tiles.assign(n_threads, 0);
+  stats.n_stolen.assign(n_threads, 0);
+  stats.busy_ms.assign(n_threads, 0.);
+  stats.idle_ms.assign(n_threads, 0.);
+
+  // Take the first tile of the run (-1 if the run is over)
+  auto take_front = [](atomic<uint64_t> &run) -> int {
+    uint64_t old_run = run.load();
+    while (run_begin(old_run) < run_end(old_run)) {
+      if (run.compare_exchange_weak(old_run, pack_run(run_begin(old_run) + 1, run_end(old_run))))
+        return run_begin(old_run);
+    }
+    return -1;
+  };
+
+  // Move the second half of the longest run left to the (empty) run of the thread, and return its size
+  auto steal = [&](int id) -> int {
+    while (true) {
+      int victim = -1;
+      uint64_t victim_run = 0;
+      for (int j{}; j < n_threads; ++j) {
+        uint64_t run = runs[j].load();
+        if (run_end(run) > run_begin(run) &&
+            (victim < 0 || run_end(run) - run_begin(run) > run_end(victim_run) - run_begin(victim_run))) {
+          victim = j;
+          victim_run = run;
+        }
+      }
+      if (victim < 0) return 0;
+
+      uint32_t begin = run_begin(victim_run), end = run_end(victim_run);
+      uint32_t middle = end - (end - begin + 1) / 2;
+      if (runs[victim].compare_exchange_strong(victim_run, pack_run(begin, middle))) {
+        runs[id] = pack_run(middle, end);
+        return end - middle;
+      }
+    }
+  };
+
+  auto start = clock::now();
+  auto work = [&](int id) {
+    while (true) {
+      int tile = take_front(runs[id]);
+      if (tile < 0) {
+        int n_stolen = steal(id);
+        if (n_stolen == 0) break;
+        stats.n_stolen[id] += n_stolen;
+        continue;
+      }
+
+      auto tile_start = clock::now();
+      render_tile(tiles[tile]);
+      stats.busy_ms[id] += chrono::duration<double, milli>(clock::now() - tile_start).count();
+      ++stats.n_tiles[id];
+    }
+  };
+
+  vector<thread> workers;
+  for (int i{1}; i < n_threads; ++i)
+    workers.push_back(thread(work, i));
+  work(0);
+  for (auto &worker : workers)
+    worker.join();
+
+  stats.wall_ms = chrono::duration<double, milli>(clock::now() - start).count();
+  for (int i{}; i < n_threads; ++i)
+    stats.idle_ms[i] = max(0., stats.wall_ms - stats.busy_ms[i]);
+}
@@ -18,6 +18,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "shapes.h"
+#include <typeinfo>
 
 //––––––––––––– Functions for Struct Sphere –––––––––––––––––––––––––
 
@@ -34,9 +35,9 @@ Normal sphere_normal(Point sp, Vec ray_dir) {
 
 //––––––––––––– Sub-struct Sphere ––––––––––––––––––––––––
 
-HitRecord Sphere::ray_intersection(Ray ray) {
+template <TransformationKind K> bool Sphere::distance(Ray ray, HitDistance &hit) {
 
-  Ray inv_ray(ray.transform(transformation.inverse()));
+  Ray inv_ray(ray.inverse_transform<K>(transformation));
   Vec origin_vec(inv_ray.origin.to_vec());
   float a = inv_ray.dir.squared_norm();
   float b = 2.0 * dot(origin_vec, inv_ray.dir);
@@ -44,30 +45,34 @@ HitRecord Sphere::ray_intersection(Ray ray) {
 
   float delta = b * b - 4.0 * a * c;
 
-  if (delta <= 0.0) return HitRecord();
+  if (delta <= 0.0) return false;
 
   float tmin = (-b - sqrt(delta)) / 2.0 / a;
   float tmax = (-b + sqrt(delta)) / 2.0 / a;
 
-  float t;
   if (tmin > inv_ray.tmin && tmin < inv_ray.tmax) {
-    t = tmin;
+    hit = HitDistance(tmin, this);
   } else if (tmax > inv_ray.tmin && tmax < inv_ray.tmax) {
-    t = tmax;
+    hit = HitDistance(tmax, this);
   } else {
-    return HitRecord();
+    return false;
   }
+  return true;
+}
+
+template <TransformationKind K> HitRecord Sphere::record(Ray ray, HitDistance hit) {
 
-  Point hit_point = inv_ray.at(t);
+  Ray inv_ray(ray.inverse_transform<K>(transformation));
+  Point hit_point = inv_ray.at(hit.t);
 
-  return HitRecord((transformation * hit_point),
-                   (transformation * sphere_normal(hit_point, inv_ray.dir)),
-                   (sphere_point_to_uv(hit_point)), t, ray, material);
+  return HitRecord((transformation.apply<K>(hit_point)),
+                   (transformation.apply<K>(sphere_normal(hit_point, inv_ray.dir))),
+                   (sphere_point_to_uv(hit_point)), hit.t, ray, material);
 }
 
-bool Sphere::check_if_intersection(Ray ray){
+template <TransformationKind K> bool Sphere::check_intersection(Ray ray) {
   
-  Ray inv_ray(ray.transform(transformation.inverse()));
+  Ray inv_ray(ray.inverse_transform<K>(transformation));
   Vec origin_vec(inv_ray.origin.to_vec());
   float a = inv_ray.dir.squared_norm();
   float b = 2.0 * dot(origin_vec, inv_ray.dir);
@@ -83,32 +88,106 @@ bool Sphere::check_if_intersection(Ray ray){
   return ((tmin > inv_ray.tmin && tmin < inv_ray.tmax) || (tmax > inv_ray.tmin && tmax < inv_ray.tmax));
 }
 
+bool Sphere::round_distance(Ray ray, HitDistance &hit) {
+
+  // |o + t d - c|^2 = r^2, with the same parameter t as in the unit sphere space
+  Vec center_to_origin(ray.origin - Point(transformation.m[0][3], transformation.m[1][3], transformation.m[2][3]));
+  float a = ray.dir.squared_norm();
+  float half_b = dot(center_to_origin, ray.dir);
+  float c = center_to_origin.squared_norm() - transformation.m[0][0] * transformation.m[0][0];
+
+  float quarter_delta = half_b * half_b - a * c;
+
+  if (quarter_delta <= 0.0) return false;
+
+  float sqrt_delta = sqrt(quarter_delta);
+  float tmin = (-half_b - sqrt_delta) / a;
+  float tmax = (-half_b + sqrt_delta) / a;
+
+  if (tmin > ray.tmin && tmin < ray.tmax) {
+    hit = HitDistance(tmin, this);
+  } else if (tmax > ray.tmin && tmax < ray.tmax) {
+    hit = HitDistance(tmax, this);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+HitRecord Sphere::round_record(Ray ray, HitDistance hit) {
+
+  Point world_point = ray.origin + ray.dir * hit.t;
+  // The hit point on the unit sphere, for the (u,v) coordinates and the direction of the normal
+  float inv_radius = transformation.invm[0][0];
+  Point sphere_point = Point(0.0, 0.0, 0.0) +
+                       (world_point - Point(transformation.m[0][3], transformation.m[1][3], transformation.m[2][3])) * inv_radius;
+
+  // As for the other spheres, the normal is the one of the unit sphere transformed (i.e. scaled by 1/r)
+  return HitRecord(world_point, sphere_normal(sphere_point, ray.dir * inv_radius) * inv_radius,
+                   sphere_point_to_uv(sphere_point), hit.t, ray, material);
+}
+
+bool Sphere::round_check(Ray ray) {
+  HitDistance hit;
+  return round_distance(ray, hit);
+}
+
+bool Sphere::hit_distance(Ray ray, HitDistance &hit) {
+  if (is_round()) return round_distance(ray, hit);
+  return with_kind(transformation.kind, [&](auto tag) { return distance<decltype(tag)::value>(ray, hit); });
+}
+
+HitRecord Sphere::hit_record(Ray ray, HitDistance hit) {
+  if (is_round()) return round_record(ray, hit);
+  return with_kind(transformation.kind, [&](auto tag) { return record<decltype(tag)::value>(ray, hit); });
+}
+
+bool Sphere::check_if_intersection(Ray ray) {
+  if (is_round()) return round_check(ray);
+  return with_kind(transformation.kind, [&](auto tag) { return check_intersection<decltype(tag)::value>(ray); });
+}
+
+AABB Sphere::bounding_box() {
+  // The extent along each axis of an ellipsoid is the norm of the corresponding row of the matrix
+  Point center = transformation * Point(0.0, 0.0, 0.0);
+  Vec half_size(Vec(transformation.m[0][0], transformation.m[0][1], transformation.m[0][2]).norm(),
+                Vec(transformation.m[1][0], transformation.m[1][1], transformation.m[1][2]).norm(),
+                Vec(transformation.m[2][0], transformation.m[2][1], transformation.m[2][2]).norm());
+  return AABB(center - half_size, center + half_size);
+}
+
 //––––––––––––– Sub-struct Plane ––––––––––––––––––––––––
 
-HitRecord Plane::ray_intersection(Ray ray){
-  Ray inv_ray(ray.transform(transformation.inverse()));
+template <TransformationKind K> bool Plane::distance(Ray ray, HitDistance &hit) {
+  Ray inv_ray(ray.inverse_transform<K>(transformation));
   
   if (fabs(inv_ray.dir.z)< 1e-5){ //i.e. parallel to xy plane
-    return HitRecord();
+    return false;
   }
   
   float t = - inv_ray.origin.z / inv_ray.dir.z;
 
-  if (t <= inv_ray.tmin || t >= inv_ray.tmax) return HitRecord();
+  if (t <= inv_ray.tmin || t >= inv_ray.tmax) return false;
 
-  Point hit_point = inv_ray.at(t);
+  hit = HitDistance(t, this);
+  return true;
+}
+
+template <TransformationKind K> HitRecord Plane::record(Ray ray, HitDistance hit) {
+  Ray inv_ray(ray.inverse_transform<K>(transformation));
+  Point hit_point = inv_ray.at(hit.t);
 
   float normal_z_dir=1.;
   if (inv_ray.dir.z > 0.0) normal_z_dir=-1.;
   
-  return HitRecord((transformation * hit_point),
-          transformation * Normal(0.0, 0.0, normal_z_dir),
-          Vec2d(hit_point.x - floor(hit_point.x), hit_point.y - floor(hit_point.y)), t, ray, material);
+  return HitRecord((transformation.apply<K>(hit_point)),
+          transformation.apply<K>(Normal(0.0, 0.0, normal_z_dir)),
+          Vec2d(hit_point.x - floor(hit_point.x), hit_point.y - floor(hit_point.y)), hit.t, ray, material);
 }
 
-bool Plane::check_if_intersection(Ray ray){
+template <TransformationKind K> bool Plane::check_intersection(Ray ray) {
     
-  Ray inv_ray(ray.transform(transformation.inverse()));
+  Ray inv_ray(ray.inverse_transform<K>(transformation));
   
   if (fabs(inv_ray.dir.z)< 1e-5) return false;
   
@@ -117,6 +196,20 @@ bool Plane::check_if_intersection(Ray ray){
   return (t > inv_ray.tmin && t < inv_ray.tmax);
 }
 
+bool Plane::hit_distance(Ray ray, HitDistance &hit) {
+  return with_kind(transformation.kind, [&](auto tag) { return distance<decltype(tag)::value>(ray, hit); });
+}
+
+HitRecord Plane::hit_record(Ray ray, HitDistance hit) {
+  return with_kind(transformation.kind, [&](auto tag) { return record<decltype(tag)::value>(ray, hit); });
+}
+
+bool Plane::check_if_intersection(Ray ray) {
+  return with_kind(transformation.kind, [&](auto tag) { return check_intersection<decltype(tag)::value>(ray); });
+}
+
+AABB Plane::bounding_box() { return AABB::unbounded(); }
+
 //––––––––––––– Sub-struct Box ––––––––––––––––––––––––
 
 /* box faces
@@ -130,109 +223,82 @@ bool Plane::check_if_intersection(Ray ray){
        |__1__|
 */
 
-HitRecord Box::ray_intersection(Ray ray) {
-
-  Ray inv_ray(ray.transform(transformation.inverse()));
-
-  float t1, t2;
-  float tmin = inv_ray.tmin;
-  float tmax = inv_ray.tmax;
-  int facemin, facemax;
-
-  for (int i{}; i < 3; ++i) {
-
-    t1 = (Pmin[i] - inv_ray.origin[i]) / inv_ray.dir[i];
-    t2 = (Pmax[i] - inv_ray.origin[i]) / inv_ray.dir[i];
-
-    if (t1 < t2) {
-      
-      if (t1 > tmin) {
-        tmin = t1;
-        facemin = i;
-      }
-      if (t2 < tmax) {
-        tmax = t2;
-        facemax = i + 3;
-      }
-
-    } else {
-
-      if (t2 > tmin) {
-        tmin = t2;
-        facemin = i + 3;
-      }
-      if (t1 < tmax) {
-        tmax = t1;
-        facemax = i;
-      }
-    }
-    
-    if (tmin > tmax) return HitRecord();
+/**
+ * Find where the ray enters and leaves the box from its slab distances (see 'slab_distances'),
+ * and the axes of the corresponding faces (the first one in case of ties).
+ * NaN distances, of rays lying on the plane of a face, fail the comparisons and are ignored.
+ */
+inline void box_range(float t_near[3], float t_far[3], float &tmin, float &tmax, int &axis_near, int &axis_far) {
+  tmin = -INFINITY;
+  tmax = INFINITY;
+  axis_near = axis_far = 0;
+  for (int a{}; a < 3; ++a) {
+    axis_near = (t_near[a] > tmin) ? a : axis_near;
+    tmin = (t_near[a] > tmin) ? t_near[a] : tmin;
+    axis_far = (t_far[a] < tmax) ? a : axis_far;
+    tmax = (t_far[a] < tmax) ? t_far[a] : tmax;
   }
+}
 
-  float t;
-  int face;
+template <TransformationKind K> bool Box::distance(Ray ray, HitDistance &hit) {
+
+  Ray inv_ray(ray.inverse_transform<K>(transformation));
+
+  float t_near[3], t_far[3], tmin, tmax;
+  int axis_near, axis_far;
+  slab_distances(Pmin, Pmax, inv_ray, t_near, t_far);
+  box_range(t_near, t_far, tmin, tmax, axis_near, axis_far);
+  if (tmin > tmax) return false;
+
+  // The faces are numbered 0, 1, 2 on the side of Pmin and 3, 4, 5 on the side of Pmax
   if (tmin > inv_ray.tmin && tmin < inv_ray.tmax) {
-    t = tmin;
-    face = facemin;
+    hit = HitDistance(tmin, this, axis_near + (inv_ray.dir_is_neg[axis_near] ? 3 : 0));
   } else if (tmax > inv_ray.tmin && tmax < inv_ray.tmax) {
-    t = tmax;
-    face = facemax;
+    hit = HitDistance(tmax, this, axis_far + (inv_ray.dir_is_neg[axis_far] ? 0 : 3));
   } else {
-    return HitRecord();
+    return false;
   }
+  return true;
+}
+
+template <TransformationKind K> HitRecord Box::record(Ray ray, HitDistance hit) {
 
-  Normal normal = box_normal(face, inv_ray.dir);
-  Point hit_point = inv_ray.at(t);
+  Ray inv_ray(ray.inverse_transform<K>(transformation));
+  Normal normal = box_normal(hit.face, inv_ray.dir);
+  Point hit_point = inv_ray.at(hit.t);
   
-  return HitRecord(transformation * hit_point,
-          transformation * normal,
-          box_point_to_uv(hit_point, face), t, ray, material);
+  return HitRecord(transformation.apply<K>(hit_point),
+          transformation.apply<K>(normal),
+          box_point_to_uv(hit_point, hit.face), hit.t, ray, material);
 }
 
-bool Box::check_if_intersection(Ray ray) {
+template <TransformationKind K> bool Box::check_intersection(Ray ray) {
   
-  Ray inv_ray(ray.transform(transformation.inverse()));
-
-  float t1, t2;
-  float tmin = inv_ray.tmin;
-  float tmax = inv_ray.tmax;
-  int facemin, facemax;
-
-  for (int i{}; i < 3; ++i) {
-
-    t1 = (Pmin[i] - inv_ray.origin[i]) / inv_ray.dir[i];
-    t2 = (Pmax[i] - inv_ray.origin[i]) / inv_ray.dir[i];
-
-    if (t1 < t2) {
-      
-      if (t1 > tmin) {
-        tmin = t1;
-        facemin = i;
-      }
-      if (t2 < tmax) {
-        tmax = t2;
-        facemax = i + 3;
-      }
-
-    } else {
-
-      if (t2 > tmin) {
-        tmin = t2;
-        facemin = i + 3;
-      }
-      if (t1 < tmax) {
-        tmax = t1;
-        facemax = i;
-      }
-    }
-    
-    if (tmin > tmax) return false;
-  }
+  Ray inv_ray(ray.inverse_transform<K>(transformation));
+
+  float t_near[3], t_far[3], tmin, tmax;
+  int axis_near, axis_far;
+  slab_distances(Pmin, Pmax, inv_ray, t_near, t_far);
+  box_range(t_near, t_far, tmin, tmax, axis_near, axis_far);
+  if (tmin > tmax) return false;
 
   return ((tmin > inv_ray.tmin && tmin < inv_ray.tmax) || (tmax > inv_ray.tmin && tmax < inv_ray.tmax));
 }
 
+bool Box::hit_distance(Ray ray, HitDistance &hit) {
+  return with_kind(transformation.kind, [&](auto tag) { return distance<decltype(tag)::value>(ray, hit); });
+}
+
+HitRecord Box::hit_record(Ray ray, HitDistance hit) {
+  return with_kind(transformation.kind, [&](auto tag) { return record<decltype(tag)::value>(ray, hit); });
+}
+
+bool Box::check_if_intersection(Ray ray) {
+  return with_kind(transformation.kind, [&](auto tag) { return check_intersection<decltype(tag)::value>(ray); });
+}
+
+AABB Box::bounding_box() { return transformation * AABB(Pmin, Pmax); }
+
 Vec2d Box::box_point_to_uv(Point hit_point, int face) {
 
   float u, v;
@@ -267,3 +333,65 @@ Normal Box::box_normal(int face, Vec ray_dir) {
   else
     return -normal;
 }
+
+//––––––––––––– Struct ShapeArrays ––––––––––––––––––––––––
+
+ShapeArrays::ShapeArrays(const vector<shared_ptr<Shape>> &shapes) {
+  for (auto shape : shapes) {
+    Shape &s = *shape;
+    if (typeid(s) == typeid(Sphere))
+      spheres.push_back(static_cast<Sphere &>(s));
+    else if (typeid(s) == typeid(Plane))
+      planes.push_back(static_cast<Plane &>(s));
+    else if (typeid(s) == typeid(Box))
+      boxes.push_back(static_cast<Box &>(s));
+    else
+      others.push_back(shape);
+  }
+}
+
+bool ShapeArrays::hit_distance(Ray ray, HitDistance &hit) {
+  // The qualified calls are not virtual, and are inlined in the loops
+  bool found = false;
+  for (auto &sphere : spheres) {
+    if (sphere.Sphere::hit_distance(ray, hit)) {
+      ray.tmax = hit.t;
+      found = true;
+    }
+  }
+  for (auto &box : boxes) {
+    if (box.Box::hit_distance(ray, hit)) {
+      ray.tmax = hit.t;
+      found = true;
+    }
+  }
+  for (auto &plane : planes) {
+    if (plane.Plane::hit_distance(ray, hit)) {
+      ray.tmax = hit.t;
+      found = true;
+    }
+  }
+  for (auto &shape : others) {
+    if (shape->hit_distance(ray, hit)) {
+      ray.tmax = hit.t;
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool ShapeArrays::check_if_intersection(Ray ray) {
+  for (auto &sphere : spheres) {
+    if (sphere.Sphere::check_if_intersection(ray)) return true;
+  }
+  for (auto &box : boxes) {
+    if (box.Box::check_if_intersection(ray)) return true;
+  }
+  for (auto &plane : planes) {
+    if (plane.Plane::check_if_intersection(ray)) return true;
+  }
+  for (auto &shape : others) {
+    if (shape->check_if_intersection(ray)) return true;
+  }
+  return false;
+}
@@ -0,0 +1,344 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "sphere_set.h"
+#include <iostream>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define SPHERE_SET_X86
+#include <immintrin.h>
+#endif
+
+//––––––––––––– Functions for SphereSet ––––––––––––––––––––––––
+
+SimdLevel best_simd_level() {
+  static SimdLevel level = [] {
+#ifdef SPHERE_SET_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+    return SimdLevel::SSE;
+#else
+    return SimdLevel::SCALAR;
+#endif
+  }();
+  return level;
+}
+
+string simd_level_name(SimdLevel level) {
+  if (level == SimdLevel::SCALAR) return "scalar";
+  else if (level == SimdLevel::SSE) return "sse";
+  else return "avx2";
+}
+
+/*
+ * The kernels below compute the distance of the hit of each sphere with the same operations as 'Sphere',
+ * so that the results are exactly the same:
+ * - round spheres (see 'Sphere::round_distance'), in world space, from the vector c' = o - center:
+ *     a = d.d,  b/2 = c'.d,  c = c'.c' - r^2,  delta/4 = (b/2)^2 - a c,  t = (-b/2 -+ sqrt(delta/4)) / a
+ * - ellipsoids (see 'Sphere::distance'), in sphere space (o' = o * scale + offset, d' = d * scale):
+ *     a = d'.d',  b = 2 o'.d',  c = o'.o' - 1,  delta = b^2 - 4 a c,  t = (-b -+ sqrt(delta)) / 2 / a
+ *   where delta is computed in double precision, as in 'Sphere'; the other operations give the same floats
+ *   in single precision (a float operation rounded to double and then to float is rounded only once).
+ * Of the two solutions, the first one within [tmin, tmax] is the hit of the sphere.
+ */
+
+unsigned int intersect_scalar(SphereSet &set, Ray &ray, float t[SPHERE_SET_SIZE]) {
+  unsigned int mask = 0;
+  float a_round = ray.dir.squared_norm();
+  for (int i{}; i < set.spheres.size(); ++i) {
+    float t0, t1;
+    if (set.round_mask & (1u << i)) {
+      Vec center_to_origin(ray.origin - Point(set.center[0][i], set.center[1][i], set.center[2][i]));
+      float half_b = dot(center_to_origin, ray.dir);
+      float c = center_to_origin.squared_norm() - set.radius2[i];
+      float quarter_delta = half_b * half_b - a_round * c;
+      if (quarter_delta <= 0.0) continue;
+      float sqrt_delta = sqrt(quarter_delta);
+      t0 = (-half_b - sqrt_delta) / a_round;
+      t1 = (-half_b + sqrt_delta) / a_round;
+    } else {
+      Vec origin_vec(ray.origin.x * set.scale[0][i] + set.offset[0][i], ray.origin.y * set.scale[1][i] + set.offset[1][i],
+                     ray.origin.z * set.scale[2][i] + set.offset[2][i]);
+      Vec dir(ray.dir.x * set.scale[0][i], ray.dir.y * set.scale[1][i], ray.dir.z * set.scale[2][i]);
+      float a = dir.squared_norm();
+      float b = 2.0 * dot(origin_vec, dir);
+      float c = origin_vec.squared_norm() - 1.0;
+      float delta = b * b - 4.0 * a * c;
+      if (delta <= 0.0) continue;
+      t0 = (-b - sqrt(delta)) / 2.0 / a;
+      t1 = (-b + sqrt(delta)) / 2.0 / a;
+    }
+    if (t0 > ray.tmin && t0 < ray.tmax)
+      t[i] = t0;
+    else if (t1 > ray.tmin && t1 < ray.tmax)
+      t[i] = t1;
+    else
+      continue;
+    mask |= 1u << i;
+  }
+  return mask;
+}
+
+#ifdef SPHERE_SET_X86
+
+/*
+ * The SIMD kernels compute the discriminants of both kinds of spheres, and stop if no sphere is hit. The two cases
+ * are then merged, lane by lane, in t = (-B -+ sqrt(D)) * k / A, with B = b/2, D = delta/4, k = 1 and A = a for
+ * the round spheres, and B = b, D = delta, k = 1/2 and A = a for the ellipsoids (as the multiplication by 1
+ * and by 1/2 are exact, this is the same as the division by 2 of 'Sphere').
+ */
+
+// The spheres from 'first' to 'first + 3', with SSE2 instructions
+unsigned int intersect_sse(SphereSet &set, Ray &ray, int first, float t[SPHERE_SET_SIZE]) {
+  __m128 o[3] = {_mm_set1_ps(ray.origin.x), _mm_set1_ps(ray.origin.y), _mm_set1_ps(ray.origin.z)};
+  __m128 d[3] = {_mm_set1_ps(ray.dir.x), _mm_set1_ps(ray.dir.y), _mm_set1_ps(ray.dir.z)};
+  __m128 zero = _mm_setzero_ps();
+  __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+  unsigned int round_bits = (set.round_mask >> first) & 0xf;
+  __m128 round = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(round_bits), bits), bits));
+
+  __m128 A = zero, B = zero, D = zero, k = _mm_and_ps(round, _mm_set1_ps(1.f));
+  if (round_bits != 0) {
+    __m128 a = _mm_set1_ps(ray.dir.squared_norm());
+    __m128 co[3];
+    for (int axis{}; axis < 3; ++axis)
+      co[axis] = _mm_sub_ps(o[axis], _mm_loadu_ps(set.center[axis] + first));
+    __m128 half_b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(co[0], d[0]), _mm_mul_ps(co[1], d[1])), _mm_mul_ps(co[2], d[2]));
+    __m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(co[0], co[0]), _mm_mul_ps(co[1], co[1])), _mm_mul_ps(co[2], co[2]));
+    c = _mm_sub_ps(c, _mm_loadu_ps(set.radius2 + first));
+    A = _mm_and_ps(round, a);
+    B = _mm_and_ps(round, half_b);
+    D = _mm_and_ps(round, _mm_sub_ps(_mm_mul_ps(half_b, half_b), _mm_mul_ps(a, c)));
+  }
+  if (round_bits != 0xf) {
+    __m128 os[3], ds[3];
+    for (int axis{}; axis < 3; ++axis) {
+      __m128 scale = _mm_loadu_ps(set.scale[axis] + first);
+      os[axis] = _mm_add_ps(_mm_mul_ps(o[axis], scale), _mm_loadu_ps(set.offset[axis] + first));
+      ds[axis] = _mm_mul_ps(d[axis], scale);
+    }
+    __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ds[0], ds[0]), _mm_mul_ps(ds[1], ds[1])), _mm_mul_ps(ds[2], ds[2]));
+    __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(os[0], ds[0]), _mm_mul_ps(os[1], ds[1])), _mm_mul_ps(os[2], ds[2]));
+    b = _mm_add_ps(b, b);
+    __m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(os[0], os[0]), _mm_mul_ps(os[1], os[1])), _mm_mul_ps(os[2], os[2]));
+    c = _mm_sub_ps(c, _mm_set1_ps(1.f));
+    // b^2 - 4 a c in double precision, two spheres at a time
+    __m128 b2 = _mm_mul_ps(b, b);
+    __m128d four = _mm_set1_pd(4.0);
+    __m128d delta_low = _mm_sub_pd(_mm_cvtps_pd(b2), _mm_mul_pd(_mm_mul_pd(four, _mm_cvtps_pd(a)), _mm_cvtps_pd(c)));
+    __m128d delta_high = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(b2, b2)),
+                                    _mm_mul_pd(_mm_mul_pd(four, _mm_cvtps_pd(_mm_movehl_ps(a, a))),
+                                               _mm_cvtps_pd(_mm_movehl_ps(c, c))));
+    __m128 delta = _mm_movelh_ps(_mm_cvtpd_ps(delta_low), _mm_cvtpd_ps(delta_high));
+    A = _mm_or_ps(A, _mm_andnot_ps(round, a));
+    B = _mm_or_ps(B, _mm_andnot_ps(round, b));
+    D = _mm_or_ps(D, _mm_andnot_ps(round, delta));
+    k = _mm_or_ps(k, _mm_andnot_ps(round, _mm_set1_ps(0.5f)));
+  }
+  __m128 valid = _mm_cmpgt_ps(D, zero);
+  if (_mm_movemask_ps(valid) == 0) return 0;
+
+  __m128 sqrt_D = _mm_sqrt_ps(D), minus_B = _mm_xor_ps(B, _mm_set1_ps(-0.f));
+  __m128 t0 = _mm_div_ps(_mm_mul_ps(_mm_sub_ps(minus_B, sqrt_D), k), A);
+  __m128 t1 = _mm_div_ps(_mm_mul_ps(_mm_add_ps(minus_B, sqrt_D), k), A);
+  __m128 tmin = _mm_set1_ps(ray.tmin), tmax = _mm_set1_ps(ray.tmax);
+  __m128 in0 = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t0, tmin), _mm_cmplt_ps(t0, tmax)));
+  __m128 in1 = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t1, tmin), _mm_cmplt_ps(t1, tmax)));
+  _mm_storeu_ps(t + first, _mm_or_ps(_mm_and_ps(in0, t0), _mm_andnot_ps(in0, t1)));
+  return unsigned(_mm_movemask_ps(_mm_or_ps(in0, in1))) << first;
+}
+
+unsigned int intersect_sse(SphereSet &set, Ray &ray, float t[SPHERE_SET_SIZE]) {
+  unsigned int mask = 0;
+  for (int first{}; first < set.spheres.size(); first += 4)
+    mask |= intersect_sse(set, ray, first, t);
+  return mask;
+}
+
+// Only this function is compiled for AVX2 (without FMA, to keep the same roundings as 'Sphere')
+__attribute__((target("avx2"))) unsigned int intersect_avx2(SphereSet &set, Ray &ray, float t[SPHERE_SET_SIZE]) {
+  __m256 o[3] = {_mm256_set1_ps(ray.origin.x), _mm256_set1_ps(ray.origin.y), _mm256_set1_ps(ray.origin.z)};
+  __m256 d[3] = {_mm256_set1_ps(ray.dir.x), _mm256_set1_ps(ray.dir.y), _mm256_set1_ps(ray.dir.z)};
+  __m256 zero = _mm256_setzero_ps();
+  __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  unsigned int round_bits = set.round_mask & 0xff;
+  __m256 round =
+      _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(round_bits), bits), bits));
+
+  __m256 A = zero, B = zero, D = zero, k = _mm256_set1_ps(1.f);
+  if (round_bits != 0) {
+    A = _mm256_set1_ps(ray.dir.squared_norm());
+    __m256 co[3];
+    for (int axis{}; axis < 3; ++axis)
+      co[axis] = _mm256_sub_ps(o[axis], _mm256_loadu_ps(set.center[axis]));
+    B = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(co[0], d[0]), _mm256_mul_ps(co[1], d[1])), _mm256_mul_ps(co[2], d[2]));
+    __m256 c = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(co[0], co[0]), _mm256_mul_ps(co[1], co[1])),
+                             _mm256_mul_ps(co[2], co[2]));
+    c = _mm256_sub_ps(c, _mm256_loadu_ps(set.radius2));
+    D = _mm256_sub_ps(_mm256_mul_ps(B, B), _mm256_mul_ps(A, c));
+  }
+  if (round_bits != 0xff) {
+    __m256 os[3], ds[3];
+    for (int axis{}; axis < 3; ++axis) {
+      __m256 scale = _mm256_loadu_ps(set.scale[axis]);
+      os[axis] = _mm256_add_ps(_mm256_mul_ps(o[axis], scale), _mm256_loadu_ps(set.offset[axis]));
+      ds[axis] = _mm256_mul_ps(d[axis], scale);
+    }
+    __m256 a =
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ds[0], ds[0]), _mm256_mul_ps(ds[1], ds[1])), _mm256_mul_ps(ds[2], ds[2]));
+    __m256 b =
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(os[0], ds[0]), _mm256_mul_ps(os[1], ds[1])), _mm256_mul_ps(os[2], ds[2]));
+    b = _mm256_add_ps(b, b);
+    __m256 c =
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(os[0], os[0]), _mm256_mul_ps(os[1], os[1])), _mm256_mul_ps(os[2], os[2]));
+    c = _mm256_sub_ps(c, _mm256_set1_ps(1.f));
+    // b^2 - 4 a c in double precision, four spheres at a time
+    __m256 b2 = _mm256_mul_ps(b, b);
+    __m256d four = _mm256_set1_pd(4.0);
+    __m256d delta_low =
+        _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(b2)),
+                      _mm256_mul_pd(_mm256_mul_pd(four, _mm256_cvtps_pd(_mm256_castps256_ps128(a))),
+                                    _mm256_cvtps_pd(_mm256_castps256_ps128(c))));
+    __m256d delta_high =
+        _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(b2, 1)),
+                      _mm256_mul_pd(_mm256_mul_pd(four, _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1))),
+                                    _mm256_cvtps_pd(_mm256_extractf128_ps(c, 1))));
+    __m256 delta =
+        _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(delta_low)), _mm256_cvtpd_ps(delta_high), 1);
+    A = _mm256_blendv_ps(a, A, round);
+    B = _mm256_blendv_ps(b, B, round);
+    D = _mm256_blendv_ps(delta, D, round);
+    k = _mm256_blendv_ps(_mm256_set1_ps(0.5f), k, round);
+  }
+  __m256 valid = _mm256_cmp_ps(D, zero, _CMP_GT_OQ);
+  if (_mm256_movemask_ps(valid) == 0) return 0;
+
+  __m256 sqrt_D = _mm256_sqrt_ps(D), minus_B = _mm256_xor_ps(B, _mm256_set1_ps(-0.f));
+  __m256 t0 = _mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(minus_B, sqrt_D), k), A);
+  __m256 t1 = _mm256_div_ps(_mm256_mul_ps(_mm256_add_ps(minus_B, sqrt_D), k), A);
+  __m256 tmin = _mm256_set1_ps(ray.tmin), tmax = _mm256_set1_ps(ray.tmax);
+  __m256 in0 = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t0, tmin, _CMP_GT_OQ), _mm256_cmp_ps(t0, tmax, _CMP_LT_OQ)));
+  __m256 in1 = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t1, tmin, _CMP_GT_OQ), _mm256_cmp_ps(t1, tmax, _CMP_LT_OQ)));
+  _mm256_storeu_ps(t, _mm256_blendv_ps(t1, t0, in0));
+  return unsigned(_mm256_movemask_ps(_mm256_or_ps(in0, in1)));
+}
+
+#endif
+
+//––––––––––––– Sub-struct SphereSet ––––––––––––––––––––––––
+
+SphereSet::SphereSet(vector<shared_ptr<Sphere>> s)
+    : Shape(Transformation(), Material(nullptr, nullptr)), spheres{s}, simd{best_simd_level()} {
+  if (spheres.size() > SPHERE_SET_SIZE) {
+    cerr << "Error: a sphere set cannot hold more than " << SPHERE_SET_SIZE << " spheres" << endl;
+    abort();
+  }
+  if (!update()) {
+    cerr << "Error: only spheres with a diagonal transformation can be packed in a sphere set" << endl;
+    abort();
+  }
+}
+
+bool SphereSet::can_pack(Sphere &sphere) {
+  TransformationKind kind = sphere.transformation.kind;
+  return kind == TransformationKind::IDENTITY || kind == TransformationKind::TRANSLATION ||
+         kind == TransformationKind::SCALING;
+}
+
+bool SphereSet::update() {
+  for (auto sphere : spheres) {
+    if (!can_pack(*sphere)) return false;
+  }
+
+  box = AABB();
+  round_mask = 0;
+  materials.clear();
+  for (int i{}; i < SPHERE_SET_SIZE; ++i) {
+    if (i >= spheres.size()) {
+      // Unused slots hold an ellipsoid that no ray can hit (a null scale gives a null direction)
+      members[i] = nullptr;
+      radius2[i] = 0.;
+      material_id[i] = 0;
+      for (int axis{}; axis < 3; ++axis) {
+        center[axis][i] = 0.;
+        scale[axis][i] = 0.;
+        offset[axis][i] = 2.;
+      }
+      continue;
+    }
+
+    Sphere &sphere = *spheres[i];
+    Transformation &tr = sphere.transformation;
+    members[i] = &sphere;
+    if (sphere.is_round()) round_mask |= 1u << i;
+    radius2[i] = tr.m[0][0] * tr.m[0][0];
+    for (int axis{}; axis < 3; ++axis) {
+      center[axis][i] = tr.m[axis][3];
+      scale[axis][i] = tr.invm[axis][axis];
+      offset[axis][i] = tr.invm[axis][3];
+    }
+
+    // Spheres with the same BRDF and pigment share the material
+    int id{};
+    while (id < materials.size() && (materials[id].brdf != sphere.material.brdf ||
+                                     materials[id].emitted_radiance != sphere.material.emitted_radiance))
+      ++id;
+    if (id == materials.size()) materials.push_back(sphere.material);
+    material_id[i] = id;
+
+    box.expand(sphere.bounding_box());
+  }
+  return true;
+}
+
+unsigned int SphereSet::intersect(Ray &ray, float t[SPHERE_SET_SIZE]) {
+  unsigned int valid = (1u << spheres.size()) - 1;
+  SimdLevel level = min(simd, best_simd_level());
+
+#ifdef SPHERE_SET_X86
+  if (level == SimdLevel::AVX2) return intersect_avx2(*this, ray, t) & valid;
+  if (level == SimdLevel::SSE) return intersect_sse(*this, ray, t) & valid;
+#endif
+  return intersect_scalar(*this, ray, t) & valid;
+}
+
+bool SphereSet::hit_distance(Ray ray, HitDistance &hit) {
+  float t[SPHERE_SET_SIZE];
+  unsigned int mask = intersect(ray, t);
+  if (!mask) return false;
+
+  int closest = __builtin_ctz(mask);
+  for (mask &= mask - 1; mask; mask &= mask - 1) {
+    int i = __builtin_ctz(mask);
+    if (t[i] < t[closest]) closest = i;
+  }
+  hit = HitDistance(t[closest], this, closest);
+  return true;
+}
+
+HitRecord SphereSet::hit_record(Ray ray, HitDistance hit) {
+  // The qualified call is not virtual
+  Sphere *sphere = members[hit.face];
+  return sphere->Sphere::hit_record(ray, HitDistance(hit.t, sphere));
+}
+
+bool SphereSet::check_if_intersection(Ray ray) {
+  float t[SPHERE_SET_SIZE];
+  return intersect(ray, t) != 0;
+}
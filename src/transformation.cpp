@@ -28,6 +28,21 @@ float IDENTITY_MATR4x4[4][4] = {{1.0, 0.0, 0.0, 0.0},
 
 //––––––––––––– Functions for Struct Transformation –––––––––––––––––––––––––
 
+TransformationKind compose_kinds(TransformationKind k1, TransformationKind k2) {
+  if (k1 == TransformationKind::IDENTITY) return k2;
+  if (k2 == TransformationKind::IDENTITY) return k1;
+  if (k1 == TransformationKind::TRANSLATION && k2 == TransformationKind::TRANSLATION)
+    return TransformationKind::TRANSLATION;
+  // Translations are both scalings (with unit factors) and rigid motions (with no rotation)
+  bool scaling1 = (k1 == TransformationKind::TRANSLATION || k1 == TransformationKind::SCALING);
+  bool scaling2 = (k2 == TransformationKind::TRANSLATION || k2 == TransformationKind::SCALING);
+  if (scaling1 && scaling2) return TransformationKind::SCALING;
+  bool rigid1 = (k1 == TransformationKind::TRANSLATION || k1 == TransformationKind::RIGID);
+  bool rigid2 = (k2 == TransformationKind::TRANSLATION || k2 == TransformationKind::RIGID);
+  if (rigid1 && rigid2) return TransformationKind::RIGID;
+  return TransformationKind::GENERAL;
+}
+
 bool are_matr_close(float m1[4][4], float m2[4][4]) {
   for (int i{}; i < 4; ++i) {
     for (int j{}; j < 4; ++j) {
@@ -50,7 +65,7 @@ void matr_prod(const float m1[4][4], const float m2[4][4], float m3[4][4]) {
 
 //––––––––––––– Struct Transformation ––––––––––––––––––––––––
 
-Transformation::Transformation(float M[4][4], float invM[4][4]) {
+Transformation::Transformation(float M[4][4], float invM[4][4], TransformationKind k) : kind{k} {
   for (int i{}; i < 4; ++i) {
     for (int j{}; j < 4; ++j) {
       m[i][j] = M[i][j];
@@ -81,19 +96,23 @@ bool Transformation::is_consistent() {
   return are_matr_close(prod, IDENTITY_MATR4x4);
 }
 
-Transformation Transformation::inverse() { return Transformation{invm, m}; }
+// The inverse of each kind of transformation is of the same kind
+Transformation Transformation::inverse() { return Transformation{invm, m, kind}; }
 
 //––––––––––––– Transformation operators ––––––––––––––––––––––––
 
-Transformation operator*(Transformation t1, Transformation t2){
+Transformation operator*(const Transformation &t1, const Transformation &t2){
   float m_prod[4][4] = {};
   float invm_prod[4][4] = {};
   matr_prod(t1.m, t2.m, m_prod);
   matr_prod(t2.invm, t1.invm, invm_prod); // Reverse order (A B)^-1 = B^-1 A^-1
-  return Transformation(m_prod, invm_prod);
+  return Transformation(m_prod, invm_prod, compose_kinds(t1.kind, t2.kind));
 }
 
-Point operator*(Transformation t, Point p){
+Point operator*(const Transformation &t, Point p){
+  if (t.kind != TransformationKind::GENERAL)
+    return with_kind(t.kind, [&](auto tag) { return t.apply<decltype(tag)::value>(p); });
+
   Point newp(p.x * t.m[0][0] + p.y * t.m[0][1] + p.z * t.m[0][2] + t.m[0][3],
             p.x * t.m[1][0] + p.y * t.m[1][1] + p.z * t.m[1][2] + t.m[1][3],
             p.x * t.m[2][0] + p.y * t.m[2][1] + p.z * t.m[2][2] + t.m[2][3]);
@@ -104,13 +123,17 @@ Point operator*(Transformation t, Point p){
   else return Point(newp.x / w, newp.y / w, newp.z / w);
 }
 
-Vec operator*(Transformation t, Vec v){
+Vec operator*(const Transformation &t, Vec v){
+  if (t.kind != TransformationKind::GENERAL)
+    return with_kind(t.kind, [&](auto tag) { return t.apply<decltype(tag)::value>(v); });
   return Vec(v.x * t.m[0][0] + v.y * t.m[0][1] + v.z * t.m[0][2],
               v.x * t.m[1][0] + v.y * t.m[1][1] + v.z * t.m[1][2],
               v.x * t.m[2][0] + v.y * t.m[2][1] + v.z * t.m[2][2]);
 }
 
-Normal operator*(Transformation t, Normal n){ // n'=(M-1)^t * n
+Normal operator*(const Transformation &t, Normal n){ // n'=(M-1)^t * n
+  if (t.kind != TransformationKind::GENERAL)
+    return with_kind(t.kind, [&](auto tag) { return t.apply<decltype(tag)::value>(n); });
   return Normal(n.x * t.invm[0][0] + n.y * t.invm[1][0] + n.z * t.invm[2][0],
                 n.x * t.invm[0][1] + n.y * t.invm[1][1] + n.z * t.invm[2][1],
                 n.x * t.invm[0][2] + n.y * t.invm[1][2] + n.z * t.invm[2][2]);
@@ -130,7 +153,7 @@ Transformation translation(Vec v){
                     {0.0, 0.0, 1.0, -v.z},
                     {0.0, 0.0, 0.0, 1.0}};
 
-  return Transformation(mt, invmt);
+  return Transformation(mt, invmt, TransformationKind::TRANSLATION);
 }
 
 //––––––––––––– Scaling ––––––––––––––––––––––––
@@ -147,7 +170,7 @@ Transformation scaling(Vec v){
                     {0.0, 0.0, 1/v.z, 0.0},
                     {0.0, 0.0, 0.0, 1.0}};
 
-  return Transformation(ms, invms);
+  return Transformation(ms, invms, TransformationKind::SCALING);
 }
 
 //––––––––––––– Rotations ––––––––––––––––––––––––
@@ -174,7 +197,7 @@ Transformation rotation_x(float theta){
                     {0.0, -sinT, cosT, 0.0},
                     {0.0, 0.0, 0.0, 1.0}};
 
-  return Transformation(mrx, invmrx);
+  return Transformation(mrx, invmrx, TransformationKind::RIGID);
 }
 
 //––––––––––––– Y-rotation ––––––––––––––––––––––––
@@ -199,7 +222,7 @@ Transformation rotation_y(float theta){
                     {sinT, 0.0, cosT, 0.0},
                     {0.0, 0.0, 0.0, 1.0}};
 
-  return Transformation(mry, invmry);
+  return Transformation(mry, invmry, TransformationKind::RIGID);
 }
 //––––––––––––– Y-rotation ––––––––––––––––––––––––
 
@@ -223,5 +246,5 @@ Transformation rotation_z(float theta){
                     {0.0, 0.0, 1.0, 0.0},
                     {0.0, 0.0, 0.0, 1.0}};
 
-  return Transformation(mrz, invmrz);
+  return Transformation(mrz, invmrz, TransformationKind::RIGID);
 }
@@ -0,0 +1,302 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "wide_bvh.h"
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Return 2^e as a float, building its bits directly (e must be in [-126, 127])
+ */
+inline float exp2i(int e) {
+  uint32_t bits = uint32_t(e + 127) << 23;
+  float value;
+  memcpy(&value, &bits, sizeof(float));
+  return value;
+}
+
+/**
+ * Return 1/d, replacing the infinity of a null component with a huge finite value:
+ * a ray lying on the plane of a box face then gives 0 instead of NaN, and is not lost
+ */
+inline float safe_inverse(float d) { return (d == 0.) ? copysign(1e30f, d) : 1. / d; }
+
+inline float dequantize(float origin, uint8_t q, float scale) { return origin + float(q) * scale; }
+
+/**
+ * Intersect the ray with the boxes of all the children of the node
+ *
+ * @param t_near Set to the entry distance of the ray into each child box
+ * @return a bit mask of the children hit within [tmin, tmax]
+ */
+inline int intersect_children(WideBVHNode &node, const float origin[3], const float inv_dir[3], float tmin,
+                              float tmax, float t_near[WIDE_BVH_WIDTH]) {
+  int valid = (1 << node.n_children) - 1;
+
+#if defined(__SSE2__)
+  __m128 near = _mm_set1_ps(tmin), far = _mm_set1_ps(tmax);
+  __m128i zero = _mm_setzero_si128();
+  for (int a{}; a < 3; ++a) {
+    __m128 scale = _mm_set1_ps(exp2i(node.exponent[a]));
+    __m128 base = _mm_set1_ps(node.origin[a]);
+    int32_t qmin, qmax;
+    memcpy(&qmin, node.qmin[a], sizeof(int32_t));
+    memcpy(&qmax, node.qmax[a], sizeof(int32_t));
+    __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(qmin), zero), zero));
+    __m128 hi = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(qmax), zero), zero));
+    lo = _mm_add_ps(base, _mm_mul_ps(lo, scale));
+    hi = _mm_add_ps(base, _mm_mul_ps(hi, scale));
+
+    __m128 o = _mm_set1_ps(origin[a]), inv = _mm_set1_ps(inv_dir[a]);
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, o), inv);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, o), inv);
+    near = _mm_max_ps(_mm_min_ps(t0, t1), near);
+    far = _mm_min_ps(_mm_max_ps(t0, t1), far);
+  }
+  _mm_storeu_ps(t_near, near);
+  return _mm_movemask_ps(_mm_cmple_ps(near, far)) & valid;
+
+#else
+  int mask = 0;
+  for (int c{}; c < node.n_children; ++c) {
+    float near = tmin, far = tmax;
+    for (int a{}; a < 3; ++a) {
+      float scale = exp2i(node.exponent[a]);
+      float t0 = (dequantize(node.origin[a], node.qmin[a][c], scale) - origin[a]) * inv_dir[a];
+      float t1 = (dequantize(node.origin[a], node.qmax[a][c], scale) - origin[a]) * inv_dir[a];
+      near = fmax(fmin(t0, t1), near);
+      far = fmin(fmax(t0, t1), far);
+    }
+    t_near[c] = near;
+    if (near <= far) mask |= 1 << c;
+  }
+  return mask & valid;
+#endif
+}
+
+//––––––––––––– Struct WideBVH –––––––––––––––––––––––––
+
+WideBVH::WideBVH(BVH &bvh) : primitives{bvh.primitives} {
+  if (bvh.nodes.empty()) return;
+  nodes.reserve(bvh.nodes.size() / 2 + 1);
+  collapse(bvh, 0);
+}
+
+int WideBVH::collapse(BVH &bvh, int binary_index) {
+
+  // Open the largest inner child until the node is full
+  int children[WIDE_BVH_WIDTH];
+  int n_children = 0;
+  if (bvh.nodes[binary_index].is_leaf())
+    children[n_children++] = binary_index;
+  else {
+    children[n_children++] = binary_index + 1;
+    children[n_children++] = bvh.nodes[binary_index].offset;
+  }
+  while (n_children < WIDE_BVH_WIDTH) {
+    int largest = -1;
+    for (int c{}; c < n_children; ++c) {
+      BVHNode &node = bvh.nodes[children[c]];
+      if (!node.is_leaf() && (largest < 0 || node.box.surface_area() > bvh.nodes[children[largest]].box.surface_area()))
+        largest = c;
+    }
+    if (largest < 0) break;
+    int opened = children[largest];
+    children[largest] = opened + 1;
+    children[n_children++] = bvh.nodes[opened].offset;
+  }
+
+  int node_index = nodes.size();
+  nodes.push_back(WideBVHNode());
+
+  AABB box;
+  for (int c{}; c < n_children; ++c)
+    box.expand(bvh.nodes[children[c]].box);
+
+  WideBVHNode node;
+  node.n_children = n_children;
+  float scale[3];
+  for (int a{}; a < 3; ++a) {
+    node.origin[a] = coordinate(box.pmin, a);
+
+    // The smallest power of two such that 255 steps cover the whole node
+    float extent = coordinate(box.pmax, a) - node.origin[a];
+    int exponent = -126;
+    if (extent > 0.) frexp(extent / 255., &exponent);
+    exponent = min(max(exponent, -126), 127);
+    while (exponent < 127 && dequantize(node.origin[a], 255, exp2i(exponent)) < coordinate(box.pmax, a))
+      exponent++;
+    node.exponent[a] = exponent;
+    scale[a] = exp2i(exponent);
+  }
+
+  for (int c{}; c < WIDE_BVH_WIDTH; ++c) {
+    if (c >= n_children) {
+      // Unused slots are never tested, but are left as empty boxes
+      for (int a{}; a < 3; ++a) {
+        node.qmin[a][c] = 255;
+        node.qmax[a][c] = 0;
+      }
+      node.child[c] = 0;
+      node.count[c] = 0;
+      continue;
+    }
+
+    AABB child_box = bvh.nodes[children[c]].box;
+    for (int a{}; a < 3; ++a) {
+      float lo = coordinate(child_box.pmin, a), hi = coordinate(child_box.pmax, a);
+      int qmin = min(max(int(floor((lo - node.origin[a]) / scale[a])), 0), 255);
+      int qmax = min(max(int(ceil((hi - node.origin[a]) / scale[a])), 0), 255);
+      // Round outwards, whatever the rounding of the divisions above
+      while (qmin > 0 && dequantize(node.origin[a], qmin, scale[a]) > lo)
+        qmin--;
+      while (qmax < 255 && dequantize(node.origin[a], qmax, scale[a]) < hi)
+        qmax++;
+      node.qmin[a][c] = qmin;
+      node.qmax[a][c] = qmax;
+    }
+
+    BVHNode &binary_child = bvh.nodes[children[c]];
+    if (binary_child.is_leaf()) {
+      if (binary_child.count > 255) {
+        cerr << "Error: the leaves of a wide BVH cannot hold more than 255 shapes" << endl;
+        abort();
+      }
+      node.child[c] = binary_child.offset;
+      node.count[c] = binary_child.count;
+    } else {
+      node.child[c] = collapse(bvh, children[c]);
+      node.count[c] = 0;
+    }
+  }
+
+  nodes[node_index] = node;
+  return node_index;
+}
+
+AABB WideBVH::bounding_box() {
+  AABB box;
+  if (nodes.empty()) return box;
+  WideBVHNode &root = nodes[0];
+  for (int c{}; c < root.n_children; ++c) {
+    float lo[3], hi[3];
+    for (int a{}; a < 3; ++a) {
+      float scale = exp2i(root.exponent[a]);
+      lo[a] = dequantize(root.origin[a], root.qmin[a][c], scale);
+      hi[a] = dequantize(root.origin[a], root.qmax[a][c], scale);
+    }
+    box.expand(AABB(Point(lo[0], lo[1], lo[2]), Point(hi[0], hi[1], hi[2])));
+  }
+  return box;
+}
+
+bool WideBVH::hit_distance(Ray ray, HitDistance &hit) {
+
+  if (nodes.empty()) return false;
+
+  float origin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+  float inv_dir[3] = {safe_inverse(ray.dir.x), safe_inverse(ray.dir.y), safe_inverse(ray.dir.z)};
+
+  // The query ray is shortened every time a closer hit is found
+  Ray query(ray);
+  HitDistance closest;
+
+  // Each entry keeps the distance at which the ray enters the node, to skip it once a closer hit is known
+  int stack[WIDE_BVH_WIDTH * BVH_MAX_DEPTH];
+  float stack_t[WIDE_BVH_WIDTH * BVH_MAX_DEPTH];
+  int stack_size = 0;
+  stack[stack_size] = 0;
+  stack_t[stack_size++] = ray.tmin;
+
+  float t_near[WIDE_BVH_WIDTH];
+  while (stack_size > 0) {
+    --stack_size;
+    if (stack_t[stack_size] > query.tmax) continue;
+    WideBVHNode &node = nodes[stack[stack_size]];
+
+    int mask = intersect_children(node, origin, inv_dir, ray.tmin, query.tmax, t_near);
+    if (!mask) continue;
+
+    // Sort the children hit from the nearest to the farthest
+    int order[WIDE_BVH_WIDTH];
+    int n_hit = 0;
+    for (int c{}; c < node.n_children; ++c) {
+      if (!(mask & (1 << c))) continue;
+      int i = n_hit++;
+      while (i > 0 && t_near[order[i - 1]] > t_near[c]) {
+        order[i] = order[i - 1];
+        --i;
+      }
+      order[i] = c;
+    }
+
+    // Leaves are intersected right away, inner children are pushed so that the nearest is popped first
+    for (int i{}; i < n_hit; ++i) {
+      int c = order[i];
+      if (node.count[c] == 0 || t_near[c] > query.tmax) continue;
+      for (int p{node.child[c]}; p < node.child[c] + node.count[c]; ++p) {
+        if (primitives[p]->hit_distance(query, closest)) query.tmax = closest.t;
+      }
+    }
+    for (int i{n_hit - 1}; i >= 0; --i) {
+      int c = order[i];
+      if (node.count[c] != 0 || t_near[c] > query.tmax) continue;
+      stack[stack_size] = node.child[c];
+      stack_t[stack_size++] = t_near[c];
+    }
+  }
+
+  if (!closest.shape) return false;
+  hit = closest;
+  return true;
+}
+
+bool WideBVH::check_if_intersection(Ray ray) {
+
+  if (nodes.empty()) return false;
+
+  float origin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+  float inv_dir[3] = {safe_inverse(ray.dir.x), safe_inverse(ray.dir.y), safe_inverse(ray.dir.z)};
+
+  int stack[WIDE_BVH_WIDTH * BVH_MAX_DEPTH];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+
+  float t_near[WIDE_BVH_WIDTH];
+  while (stack_size > 0) {
+    WideBVHNode &node = nodes[stack[--stack_size]];
+
+    int mask = intersect_children(node, origin, inv_dir, ray.tmin, ray.tmax, t_near);
+    for (int c{}; c < node.n_children; ++c) {
+      if (!(mask & (1 << c))) continue;
+      if (node.count[c] == 0) {
+        stack[stack_size++] = node.child[c];
+        continue;
+      }
+      for (int p{node.child[c]}; p < node.child[c] + node.count[c]; ++p) {
+        if (primitives[p]->check_if_intersection(ray)) return true;
+      }
+    }
+  }
+  return false;
+}
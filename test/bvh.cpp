@@ -0,0 +1,282 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "camera.h"
+#include "world.h"
+#include "random_scene.h"
+#include "catch_amalgamated.hpp"
+
+#define CATCH_CONFIG_MAIN
+
+// Setup: a random cloud of spheres and boxes, above a plane
+RandomScene above_plane() {
+  RandomScene scene;
+  scene.plane = true;
+  return scene;
+}
+
+TEST_CASE("BVH structure", "[bvh]") {
+
+  PCG pcg;
+  World world = random_world(500, pcg, above_plane());
+  world.build_bvh();
+
+  REQUIRE(world.bvh);
+  REQUIRE(world.unbounded_shapes.size() == 1);
+  REQUIRE(world.bvh->primitives.size() == 500);
+
+  // Every leaf box contains its shapes and every interior box contains its children
+  int n_prims = 0;
+  for (int i{}; i < world.bvh->nodes.size(); ++i) {
+    BVHNode node = world.bvh->nodes[i];
+    if (node.is_leaf()) {
+      REQUIRE(node.count <= world.bvh->max_leaf_size);
+      n_prims += node.count;
+      for (int p{node.offset}; p < node.offset + node.count; ++p) {
+        AABB box = world.bvh->primitives[p]->bounding_box();
+        REQUIRE(merge(node.box, box).surface_area() == node.box.surface_area());
+      }
+    } else {
+      REQUIRE(merge(node.box, world.bvh->nodes[i + 1].box).surface_area() == node.box.surface_area());
+      REQUIRE(merge(node.box, world.bvh->nodes[node.offset].box).surface_area() == node.box.surface_area());
+    }
+  }
+  REQUIRE(n_prims == 500);
+
+  // Adding a shape invalidates the hierarchy
+  world.add_shape(make_shared<Sphere>());
+  REQUIRE(!world.bvh);
+}
+
+TEST_CASE("BVH closest hit", "[bvh]") {
+
+  PCG pcg;
+  World brute_force = random_world(300, pcg, above_plane());
+  World world = brute_force;
+  world.build_bvh();
+
+  for (int i{}; i < 2000; ++i) {
+    Ray ray = random_ray(pcg);
+    HitRecord expected = brute_force.ray_intersection(ray);
+    HitRecord hit = world.ray_intersection(ray);
+
+    REQUIRE(hit.init == expected.init);
+    if (expected.init) {
+      REQUIRE(are_close(hit.t, expected.t));
+      REQUIRE(hit.is_close(expected));
+    }
+  }
+}
+
+TEST_CASE("BVH packets", "[bvh]") {
+
+  PCG pcg;
+  World world = random_world(300, pcg, above_plane());
+  world.build_bvh();
+
+  auto check_packet = [&](vector<Ray> rays) {
+    vector<HitRecord> hits(rays.size());
+    world.ray_intersection(rays, hits);
+    for (int i{}; i < rays.size(); ++i) {
+      HitRecord expected = world.ray_intersection(rays[i]);
+      REQUIRE(hits[i].init == expected.init);
+      if (expected.init) {
+        REQUIRE(hits[i].t == expected.t);
+        REQUIRE(hits[i].is_close(expected));
+      }
+    }
+  };
+
+  // Coherent packets: blocks of primary rays of a camera looking at the cloud (more than one packet per block)
+  PerspectiveCamera camera(1.0, 1.0, translation(Vec(-15, 0, 10)));
+  for (int block{}; block < 20; ++block) {
+    float u0 = pcg.random_float(), v0 = pcg.random_float();
+    vector<Ray> rays;
+    for (int row{}; row < 10; ++row) {
+      for (int col{}; col < 10; ++col)
+        rays.push_back(camera.fire_ray(u0 + col * 0.002, v0 + row * 0.002));
+    }
+    check_packet(rays);
+  }
+
+  // Incoherent packets fall back to the tests of the single rays, as do the rays parallel to an axis
+  vector<Ray> random_rays;
+  for (int i{}; i < 100; ++i)
+    random_rays.push_back(random_ray(pcg));
+  check_packet(random_rays);
+
+  vector<Ray> parallel_rays;
+  for (int i{}; i < 16; ++i)
+    parallel_rays.push_back(Ray(Point(-15, 20. * pcg.random_float() - 10., 20. * pcg.random_float()), VEC_X));
+  check_packet(parallel_rays);
+}
+
+TEST_CASE("BVH empty and single shape", "[bvh]") {
+
+  World world;
+  world.build_bvh();
+  REQUIRE(!world.ray_intersection(Ray(Point(0, 0, 0), VEC_X)).init);
+
+  world.add_shape(make_shared<Sphere>(translation(VEC_X * 2)));
+  world.build_bvh();
+  HitRecord hit = world.ray_intersection(Ray(Point(0, 0, 0), VEC_X));
+  REQUIRE(hit.init);
+  REQUIRE(hit.world_point.is_close(Point(1.0, 0.0, 0.0)));
+}
+
+TEST_CASE("BVH any hit", "[bvh]") {
+
+  PCG pcg;
+  World brute_force = random_world(300, pcg, above_plane());
+  World world = brute_force;
+  world.build_bvh();
+
+  vector<Point> points;
+  for (int i{}; i < 100; ++i)
+    points.push_back(random_ray(pcg).origin);
+
+  for (int i{}; i < 50; ++i) {
+    Point observer = random_ray(pcg).origin;
+    vector<bool> visible = world.are_points_visible(points, observer);
+    vector<bool> expected_batch = brute_force.are_points_visible(points, observer);
+
+    for (int p{}; p < points.size(); ++p) {
+      bool expected = brute_force.is_point_visible(points[p], observer);
+      REQUIRE(world.is_point_visible(points[p], observer) == expected);
+      REQUIRE(visible[p] == expected);
+      REQUIRE(expected_batch[p] == expected);
+    }
+  }
+}
+
+TEST_CASE("BVH build methods", "[bvh]") {
+
+  // Enough shapes for the big subtrees to be handed to other threads
+  PCG pcg;
+  World world = random_world(10000, pcg, above_plane());
+  vector<shared_ptr<Shape>> bounded_shapes(world.shapes.begin(), world.shapes.end() - 1);
+  World brute_force;
+  for (auto shape : bounded_shapes)
+    brute_force.add_shape(shape);
+
+  for (BVHBuildMethod method :
+       {BVHBuildMethod::SAH, BVHBuildMethod::BINNED_SAH, BVHBuildMethod::MIDPOINT, BVHBuildMethod::LBVH}) {
+    for (int n_threads : {1, 4}) {
+      BVH bvh(bounded_shapes, method, 4, n_threads);
+
+      REQUIRE(bvh.method == method);
+      REQUIRE(bvh.primitives.size() == 10000);
+      REQUIRE(bvh.stats.n_threads == n_threads);
+      REQUIRE(bvh.stats.n_nodes == bvh.nodes.size());
+      REQUIRE(bvh.stats.n_leaves == (bvh.stats.n_nodes + 1) / 2);
+      REQUIRE(bvh.stats.max_depth < BVH_MAX_DEPTH);
+      REQUIRE(are_close(bvh.stats.sah_cost, bvh.sah_cost()));
+
+      int n_prims = 0;
+      for (auto &node : bvh.nodes)
+        if (node.is_leaf()) n_prims += node.count;
+      REQUIRE(n_prims == 10000);
+
+      for (int i{}; i < 100; ++i) {
+        Ray ray = random_ray(pcg);
+        HitRecord expected = brute_force.ray_intersection(ray);
+        HitRecord hit = bvh.ray_intersection(ray);
+
+        REQUIRE(hit.init == expected.init);
+        if (expected.init)
+          REQUIRE(are_close(hit.t, expected.t));
+      }
+    }
+  }
+
+  // The SAH builders produce cheaper trees than the midpoint one
+  BVH sah(bounded_shapes, BVHBuildMethod::SAH);
+  BVH binned(bounded_shapes, BVHBuildMethod::BINNED_SAH);
+  BVH fast(bounded_shapes, BVHBuildMethod::MIDPOINT);
+  BVH lbvh(bounded_shapes, BVHBuildMethod::LBVH);
+  REQUIRE(sah.sah_cost() <= fast.sah_cost());
+  REQUIRE(binned.sah_cost() <= fast.sah_cost());
+  REQUIRE(sah.sah_cost() <= lbvh.sah_cost());
+}
+
+TEST_CASE("BVH parallel build", "[bvh]") {
+
+  // Enough shapes for the top nodes to be binned in parallel
+  PCG pcg;
+  RandomScene scene;
+  scene.min_corner = Point(0, 0, 0);
+  scene.max_corner = Point(100, 100, 100);
+  scene.min_size = scene.max_size = 0.1;
+  scene.rotate = false;
+  scene.boxes = false;
+  vector<shared_ptr<Shape>> shapes = random_shapes(100000, pcg, scene);
+
+  // The same tree is built whatever the number of threads
+  for (BVHBuildMethod method : {BVHBuildMethod::BINNED_SAH, BVHBuildMethod::LBVH}) {
+    BVH serial(shapes, method, 4, 1);
+    BVH parallel(shapes, method, 4, 8);
+    REQUIRE(serial.nodes.size() == parallel.nodes.size());
+    REQUIRE(serial.primitives == parallel.primitives);
+    for (int i{}; i < serial.nodes.size(); ++i)
+      REQUIRE(serial.nodes[i].offset == parallel.nodes[i].offset);
+  }
+}
+
+TEST_CASE("BVH refit", "[bvh]") {
+
+  PCG pcg;
+  World world = random_world(2000, pcg, above_plane());
+  world.build_bvh(BVHBuildMethod::BINNED_SAH);
+  shared_ptr<BVH> bvh = world.bvh;
+  REQUIRE(are_close(bvh->degradation(), 1.0));
+
+  // A small motion: the bounds are refitted, the topology is kept
+  for (auto shape : world.shapes)
+    shape->transformation = translation(Vec(0.1 * pcg.random_float(), 0.1 * pcg.random_float(), 0.0)) * shape->transformation;
+  REQUIRE(!world.update_bvh());
+  REQUIRE(world.bvh == bvh);
+  REQUIRE(bvh->stats.n_refits == 1);
+
+  World brute_force;
+  for (auto shape : world.shapes)
+    brute_force.add_shape(shape);
+  for (int i{}; i < 500; ++i) {
+    Ray ray = random_ray(pcg);
+    HitRecord expected = brute_force.ray_intersection(ray);
+    HitRecord hit = world.ray_intersection(ray);
+    REQUIRE(hit.init == expected.init);
+    if (expected.init)
+      REQUIRE(are_close(hit.t, expected.t));
+  }
+
+  // Shuffling the shapes makes the old topology useless: the tree is rebuilt with the same method
+  for (auto shape : world.shapes) {
+    Vec position(20. * pcg.random_float() - 10., 20. * pcg.random_float() - 10., 20. * pcg.random_float());
+    if (shape->bounding_box().is_bounded())
+      shape->transformation = translation(position) * scaling(Vec(0.2, 0.2, 0.2));
+  }
+  float degradation = world.bvh->degradation();
+  world.bvh->refit();
+  REQUIRE(world.bvh->degradation() > degradation);
+  REQUIRE(world.update_bvh());
+  REQUIRE(world.bvh != bvh);
+  REQUIRE(world.bvh->method == BVHBuildMethod::BINNED_SAH);
+  REQUIRE(world.bvh->stats.n_refits == 0);
+  REQUIRE(are_close(world.bvh->degradation(), 1.0));
+}
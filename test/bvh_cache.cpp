@@ -0,0 +1,198 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "world.h"
+#include "random_scene.h"
+#include "catch_amalgamated.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#define CATCH_CONFIG_MAIN
+
+// Setup: an empty cache directory
+shared_ptr<BVHCache> empty_cache(string name) {
+  filesystem::path dir = filesystem::temp_directory_path() / name;
+  filesystem::remove_all(dir);
+  return make_shared<BVHCache>(dir.string());
+}
+
+TEST_CASE("BVH cache round trip", "[bvh_cache]") {
+
+  shared_ptr<BVHCache> cache = empty_cache("prt_bvh_cache_test");
+  REQUIRE(filesystem::is_directory(cache->directory));
+
+  PCG pcg;
+  World world = random_world(1000, pcg);
+  world.build_accelerator(AcceleratorType::BVH, BVHBuildMethod::BINNED_SAH, cache);
+  REQUIRE(cache->n_misses == 1);
+  REQUIRE(cache->n_hits == 0);
+  REQUIRE(!world.bvh->stats.cached);
+  REQUIRE(filesystem::exists(cache->path(cache->key(world.shapes, BVHBuildMethod::BINNED_SAH, 4))));
+
+  // The same geometry, created again from scratch, is loaded
+  PCG pcg_again;
+  World same_world = random_world(1000, pcg_again);
+  same_world.build_accelerator(AcceleratorType::BVH, BVHBuildMethod::BINNED_SAH, cache);
+  REQUIRE(cache->n_hits == 1);
+  REQUIRE(same_world.bvh->stats.cached);
+  REQUIRE(same_world.bvh->stats.n_nodes == world.bvh->stats.n_nodes);
+  REQUIRE(same_world.bvh->nodes.size() == world.bvh->nodes.size());
+  for (int i{}; i < world.bvh->nodes.size(); ++i) {
+    REQUIRE(same_world.bvh->nodes[i].offset == world.bvh->nodes[i].offset);
+    REQUIRE(same_world.bvh->nodes[i].count == world.bvh->nodes[i].count);
+    REQUIRE(same_world.bvh->nodes[i].box.surface_area() == world.bvh->nodes[i].box.surface_area());
+  }
+
+  // The loaded hierarchy refers to the shapes of the new world
+  REQUIRE(same_world.bvh->primitives.size() == 1000);
+  for (auto shape : same_world.bvh->primitives)
+    REQUIRE(find(same_world.shapes.begin(), same_world.shapes.end(), shape) != same_world.shapes.end());
+
+  PCG ray_pcg;
+  for (int i{}; i < 500; ++i) {
+    Ray ray(Point(30. * ray_pcg.random_float() - 15., 30. * ray_pcg.random_float() - 15., -5.),
+            Vec(ray_pcg.random_float() - 0.5, ray_pcg.random_float() - 0.5, 1.));
+    HitRecord expected = world.ray_intersection(ray);
+    HitRecord hit = same_world.ray_intersection(ray);
+    REQUIRE(hit.init == expected.init);
+    if (hit.init) REQUIRE(hit.world_point.is_close(expected.world_point));
+  }
+
+  // A wide hierarchy is collapsed from the cached binary one
+  PCG pcg_wide;
+  World wide_world = random_world(1000, pcg_wide);
+  wide_world.build_accelerator(AcceleratorType::WIDE_BVH, BVHBuildMethod::BINNED_SAH, cache);
+  REQUIRE(cache->n_hits == 2);
+  REQUIRE(wide_world.accelerator != wide_world.bvh);
+
+  filesystem::remove_all(cache->directory);
+}
+
+TEST_CASE("BVH cache keys", "[bvh_cache]") {
+
+  shared_ptr<BVHCache> cache = empty_cache("prt_bvh_cache_keys_test");
+
+  PCG pcg;
+  World world = random_world(100, pcg);
+  uint64_t key = cache->key(world.shapes, BVHBuildMethod::SAH, 4);
+
+  // Another method, another leaf size or moved shapes give another key
+  REQUIRE(cache->key(world.shapes, BVHBuildMethod::LBVH, 4) != key);
+  REQUIRE(cache->key(world.shapes, BVHBuildMethod::SAH, 2) != key);
+  world.shapes[10]->transformation = translation(Vec(0, 0, 0.01)) * world.shapes[10]->transformation;
+  REQUIRE(cache->key(world.shapes, BVHBuildMethod::SAH, 4) != key);
+
+  world.build_accelerator(AcceleratorType::BVH, BVHBuildMethod::SAH, cache);
+  world.build_accelerator(AcceleratorType::BVH, BVHBuildMethod::LBVH, cache);
+  REQUIRE(cache->n_misses == 2);
+  REQUIRE(cache->n_hits == 0);
+
+  // Grids and linear scans do not use the cache
+  world.build_accelerator(AcceleratorType::GRID, BVHBuildMethod::SAH, cache);
+  world.build_accelerator(AcceleratorType::NONE, BVHBuildMethod::SAH, cache);
+  REQUIRE(cache->n_misses + cache->n_hits == 2);
+
+  filesystem::remove_all(cache->directory);
+}
+
+TEST_CASE("BVH cache damaged entries", "[bvh_cache]") {
+
+  shared_ptr<BVHCache> cache = empty_cache("prt_bvh_cache_damaged_test");
+
+  PCG pcg;
+  World world = random_world(200, pcg);
+  world.build_accelerator(AcceleratorType::BVH, BVHBuildMethod::SAH, cache);
+  string path = cache->path(cache->key(world.shapes, BVHBuildMethod::SAH, 4));
+
+  // A truncated entry is ignored and written again
+  filesystem::resize_file(path, filesystem::file_size(path) / 2);
+  REQUIRE(!cache->load(world.shapes, BVHBuildMethod::SAH));
+  world.build_accelerator(AcceleratorType::BVH, BVHBuildMethod::SAH, cache);
+  REQUIRE(cache->n_misses == 2);
+  REQUIRE(cache->load(world.shapes, BVHBuildMethod::SAH));
+
+  // So is a file of garbage
+  ofstream(path, ios::binary) << string(4096, 'x');
+  REQUIRE(!cache->load(world.shapes, BVHBuildMethod::SAH));
+
+  filesystem::remove_all(cache->directory);
+}
+
+// Setup: replace the nodes of a cache entry with a chain of 'depth' internal nodes, each having a leaf as its
+// second child (the same file layout, 36 bytes per node, and the same number of nodes); the nodes left are leaves
+void write_chain(string path, int n_nodes, int n_primitives, int depth, bool shared_leaf = false) {
+  ifstream in(path, ios::binary);
+  string entry((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  in.close();
+  size_t header_size = entry.size() - n_nodes * 36 - n_primitives * sizeof(int32_t);
+
+  for (int i{}; i < n_nodes; ++i) {
+    float bounds[6] = {-100, -100, -100, 100, 100, 100};
+    int32_t fields[3] = {0, 1, 0}; // A leaf with the first primitive
+    if (i < depth) {
+      // The first child is the next node, the second a leaf (or, with 'shared_leaf', the first child again)
+      fields[0] = (shared_leaf && i == depth - 1) ? depth : depth + 1 + i;
+      fields[1] = 0;
+    }
+    memcpy(&entry[header_size + i * 36], bounds, sizeof(bounds));
+    memcpy(&entry[header_size + i * 36 + sizeof(bounds)], fields, sizeof(fields));
+  }
+  ofstream(path, ios::binary) << entry;
+}
+
+TEST_CASE("BVH cache too deep entries", "[bvh_cache]") {
+
+  shared_ptr<BVHCache> cache = empty_cache("prt_bvh_cache_deep_test");
+
+  PCG pcg;
+  World world = random_world(400, pcg);
+  world.build_accelerator(AcceleratorType::BVH, BVHBuildMethod::SAH, cache);
+  string path = cache->path(cache->key(world.shapes, BVHBuildMethod::SAH, 4));
+  int n_nodes = world.bvh->nodes.size();
+  REQUIRE(n_nodes >= 2 * BVH_MAX_DEPTH + 1);
+
+  // The deepest leaves of a chain of 63 internal nodes fit the traversal stack
+  write_chain(path, n_nodes, 400, BVH_MAX_DEPTH - 1);
+  shared_ptr<BVH> bvh = cache->load(world.shapes, BVHBuildMethod::SAH);
+  REQUIRE(bvh);
+  HitDistance hit;
+  bvh->hit_distance(Ray(Point(-50, 0, 0), Vec(1, 0, 0)), hit);
+
+  // One more level would overflow it
+  write_chain(path, n_nodes, 400, BVH_MAX_DEPTH);
+  REQUIRE(!cache->load(world.shapes, BVHBuildMethod::SAH));
+
+  // A node reached twice is not a tree
+  write_chain(path, n_nodes, 400, 10, true);
+  REQUIRE(!cache->load(world.shapes, BVHBuildMethod::SAH));
+
+  // Neither is an entry without a root for its shapes
+  ifstream in(path, ios::binary);
+  string entry((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  in.close();
+  size_t header_size = entry.size() - n_nodes * 36 - 400 * sizeof(int32_t);
+  string empty_entry = entry.substr(0, header_size) + entry.substr(header_size + n_nodes * 36);
+  int32_t no_nodes = 0;
+  memcpy(&empty_entry[28], &no_nodes, sizeof(no_nodes)); // 'n_nodes' follows magic, version, method, key, max leaf size
+  ofstream(path, ios::binary) << empty_entry;
+  REQUIRE(!cache->load(world.shapes, BVHBuildMethod::SAH));
+
+  filesystem::remove_all(cache->directory);
+}
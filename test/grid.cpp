@@ -0,0 +1,139 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "world.h"
+#include "catch_amalgamated.hpp"
+
+#define CATCH_CONFIG_MAIN
+
+// Setup: spheres and boxes in a cube of the given side, centered in 'center', above a plane
+void add_shapes(World &world, int n_shapes, Vec center, float side, PCG &pcg) {
+  for (int i{}; i < n_shapes; ++i) {
+    Vec position = center + Vec(pcg.random_float() - 0.5, pcg.random_float() - 0.5, pcg.random_float() - 0.5) * side;
+    float size = 0.1 + 0.2 * pcg.random_float();
+    if (i % 2 == 0)
+      world.add_shape(make_shared<Sphere>(translation(position) * scaling(Vec(size, size, size))));
+    else
+      world.add_shape(make_shared<Box>(Point(0, 0, 0), Point(size, 2 * size, size),
+                                       translation(position) * rotation_z(90. * pcg.random_float())));
+  }
+}
+
+Ray random_ray(PCG &pcg, float side) {
+  Point origin(side * (pcg.random_float() - 0.5), side * (pcg.random_float() - 0.5), side * (pcg.random_float() - 0.5));
+  Vec dir(2. * pcg.random_float() - 1., 2. * pcg.random_float() - 1., 2. * pcg.random_float() - 1.);
+  return Ray(origin, dir);
+}
+
+// Compare the closest and the any hits of the world, with the given accelerator, with a brute-force search
+void check_against_brute_force(World brute_force, AcceleratorType type, float side, PCG &pcg) {
+  World world = brute_force;
+  world.build_accelerator(type);
+
+  for (int i{}; i < 2000; ++i) {
+    Ray ray = random_ray(pcg, side);
+    HitRecord expected = brute_force.ray_intersection(ray);
+    HitRecord hit = world.ray_intersection(ray);
+
+    REQUIRE(hit.init == expected.init);
+    if (expected.init) {
+      REQUIRE(are_close(hit.t, expected.t));
+      REQUIRE(hit.is_close(expected));
+    }
+
+    Ray segment(ray.origin, ray.dir, 1e-5, 0.5, 0);
+    REQUIRE(world.check_if_intersection(segment) == brute_force.check_if_intersection(segment));
+  }
+}
+
+TEST_CASE("Grid: dense field", "[grid]") {
+
+  PCG pcg;
+  World world;
+  add_shapes(world, 2000, Vec(0, 0, 0), 20., pcg);
+  world.add_shape(make_shared<Plane>(translation(Vec(0, 0, -11))));
+
+  Grid grid(vector<shared_ptr<Shape>>(world.shapes.begin(), world.shapes.end() - 1));
+  int n_cells = grid.resolution[0] * grid.resolution[1] * grid.resolution[2];
+  REQUIRE(n_cells >= 2000);
+  REQUIRE(n_cells <= 4 * GRID_DENSITY * 2000);
+  REQUIRE(grid.cell_start.size() == n_cells + 1);
+  REQUIRE(grid.cell_start.back() == grid.cell_primitives.size());
+
+  check_against_brute_force(world, AcceleratorType::GRID, 30., pcg);
+  check_against_brute_force(world, AcceleratorType::HASHED_GRID, 30., pcg);
+}
+
+TEST_CASE("Grid: sparse clusters", "[grid]") {
+
+  // Two small clusters far apart: most of the cells are empty
+  PCG pcg;
+  World world;
+  add_shapes(world, 500, Vec(-50, -50, -50), 5., pcg);
+  add_shapes(world, 500, Vec(50, 50, 50), 5., pcg);
+
+  Grid dense(world.shapes);
+  Grid hashed(world.shapes, true);
+  REQUIRE(hashed.cells.size() < hashed.resolution[0] * hashed.resolution[1] * hashed.resolution[2]);
+  REQUIRE(hashed.memory_footprint() < dense.memory_footprint());
+
+  // Rays from one cluster towards the other cross the empty space between them
+  for (int i{}; i < 500; ++i) {
+    Ray random = random_ray(pcg, 10.);
+    Ray ray(random.origin + Vec(-50, -50, -50), Vec(100, 100, 100) + random.dir * 5.);
+    HitRecord expected = World(world).ray_intersection(ray);
+    REQUIRE(hashed.ray_intersection(ray).init == expected.init);
+    REQUIRE(dense.ray_intersection(ray).init == expected.init);
+  }
+
+  check_against_brute_force(world, AcceleratorType::GRID, 120., pcg);
+  check_against_brute_force(world, AcceleratorType::HASHED_GRID, 120., pcg);
+}
+
+TEST_CASE("Grid: flat and empty scenes", "[grid]") {
+
+  // All the shapes on the plane z=0
+  PCG pcg;
+  World world;
+  for (int i{}; i < 300; ++i)
+    world.add_shape(make_shared<Box>(Point(0, 0, 0), Point(0.2, 0.2, 0),
+                                     translation(Vec(10. * pcg.random_float() - 5., 10. * pcg.random_float() - 5., 0.))));
+  Grid grid(world.shapes);
+  REQUIRE(grid.resolution[2] == 1);
+  check_against_brute_force(world, AcceleratorType::GRID, 10., pcg);
+
+  World empty;
+  empty.build_accelerator(AcceleratorType::GRID);
+  REQUIRE(!empty.ray_intersection(Ray(Point(0, 0, 0), VEC_X)).init);
+  REQUIRE(empty.is_point_visible(Point(1, 0, 0), Point(0, 0, 0)));
+}
+
+TEST_CASE("No accelerator", "[grid]") {
+
+  PCG pcg;
+  World world;
+  add_shapes(world, 100, Vec(0, 0, 0), 10., pcg);
+  world.add_shape(make_shared<Plane>(translation(Vec(0, 0, -6))));
+  world.build_accelerator(AcceleratorType::NONE);
+
+  REQUIRE(!world.accelerator);
+  REQUIRE(!world.bvh);
+  REQUIRE(!world.update_bvh());
+  check_against_brute_force(world, AcceleratorType::NONE, 15., pcg);
+}
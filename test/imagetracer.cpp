@@ -18,6 +18,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "imagetracer.h"
+#include <mutex>
 #include "catch_amalgamated.hpp"
 
 #define CATCH_CONFIG_MAIN
@@ -79,4 +80,146 @@ TEST_CASE("ImageTracer antialiasing", "[imagetracer]") {
   });
 
   REQUIRE(n_rays == 100);
-}
\ No newline at end of file
+}
+
+TEST_CASE("ImageTracer ray packets", "[imagetracer]") {
+
+  // Packets cover the image exactly once, also when the blocks do not fit it
+  HdrImage packet_image(11, 6), single_image(11, 6);
+  shared_ptr<Camera> camera = make_shared<PerspectiveCamera>(1.0, 11.0 / 6.0);
+  ImageTracer packet_tracer(packet_image, camera), single_tracer(single_image, camera);
+
+  auto ray_color = [](Ray ray) -> Color { return Color(ray.dir.y, ray.dir.z, 1.0); };
+  int n_rays = 0;
+  packet_tracer.fire_ray_packets([&](vector<Ray> &rays) -> vector<Color> {
+    REQUIRE(rays.size() <= 16);
+    n_rays += rays.size();
+    vector<Color> colors;
+    for (auto ray : rays)
+      colors.push_back(ray_color(ray));
+    return colors;
+  }, 4);
+  single_tracer.fire_all_rays(ray_color);
+
+  REQUIRE(n_rays == 66);
+  for (int row{}; row < 6; ++row) {
+    for (int col{}; col < 11; ++col)
+      REQUIRE(packet_tracer.image.get_pixel(col, row).is_close(single_tracer.image.get_pixel(col, row)));
+  }
+
+  // With antialiasing, the samples of each pixel make a packet, drawn in the same order as single rays
+  HdrImage small_packet(3, 2), small_single(3, 2);
+  ImageTracer aa_packet_tracer(small_packet, camera, 3, PCG()), aa_single_tracer(small_single, camera, 3, PCG());
+  aa_packet_tracer.fire_ray_packets([&](vector<Ray> &rays) -> vector<Color> {
+    REQUIRE(rays.size() == 9);
+    vector<Color> colors;
+    for (auto ray : rays)
+      colors.push_back(ray_color(ray));
+    return colors;
+  });
+  aa_single_tracer.fire_all_rays(ray_color);
+
+  for (int row{}; row < 2; ++row) {
+    for (int col{}; col < 3; ++col)
+      REQUIRE(aa_packet_tracer.image.get_pixel(col, row).is_close(aa_single_tracer.image.get_pixel(col, row)));
+  }
+}
+
+TEST_CASE("ImageTracer multithreaded tiles", "[imagetracer]") {
+
+  // The tiles do not fit the image; the color of every sample also depends on its random numbers
+  shared_ptr<Camera> camera = make_shared<PerspectiveCamera>(1.0, 37.0 / 21.0);
+  auto ray_color = [](Ray ray, PCG &pcg) -> Color { return Color(ray.dir.y, ray.dir.z, pcg.random_float()); };
+
+  vector<HdrImage> images;
+  for (int n_threads : {1, 3, 8}) {
+    ImageTracer tracer(HdrImage(37, 21), camera, 2, PCG(7, 11));
+    tracer.fire_all_rays(ray_color, n_threads, 8);
+    images.push_back(tracer.image);
+  }
+  // The images must be bit for bit the same
+  auto same_pixels = [](HdrImage &a, HdrImage &b) -> bool {
+    for (int i{}; i < a.pixels.size(); ++i) {
+      if (a.pixels[i].r != b.pixels[i].r || a.pixels[i].g != b.pixels[i].g || a.pixels[i].b != b.pixels[i].b)
+        return false;
+    }
+    return true;
+  };
+  for (int i{1}; i < images.size(); ++i)
+    REQUIRE(same_pixels(images[i], images[0]));
+
+  // Every pixel is rendered exactly once, and the packets give the same image as single rays
+  for (int n_threads : {1, 3}) {
+    ImageTracer packet_tracer(HdrImage(37, 21), camera, 2, PCG(7, 11));
+    atomic<int> n_rays{0};
+    packet_tracer.fire_ray_packets([&](vector<Ray> &rays, vector<PCG> &pcgs) -> vector<Color> {
+      n_rays += rays.size();
+      vector<Color> colors;
+      for (int i{}; i < rays.size(); ++i)
+        colors.push_back(ray_color(rays[i], pcgs[i]));
+      return colors;
+    }, n_threads, 8, 4);
+
+    REQUIRE(n_rays == 37 * 21 * 4);
+    REQUIRE(same_pixels(packet_tracer.image, images[0]));
+  }
+
+  // Without antialiasing, the blocks of pixels are cut at the border of the tiles
+  ImageTracer block_tracer(HdrImage(37, 21), camera), single_tracer(HdrImage(37, 21), camera);
+  int largest_packet = 0;
+  mutex packet_mutex;
+  block_tracer.fire_ray_packets([&](vector<Ray> &rays, vector<PCG> &) -> vector<Color> {
+    lock_guard<mutex> lock(packet_mutex);
+    largest_packet = max(largest_packet, int(rays.size()));
+    vector<Color> colors;
+    for (auto ray : rays)
+      colors.push_back(Color(ray.dir.y, ray.dir.z, 1.0));
+    return colors;
+  }, 2, 6, 4);
+  single_tracer.fire_all_rays([](Ray ray) -> Color { return Color(ray.dir.y, ray.dir.z, 1.0); });
+
+  REQUIRE(largest_packet == 16);
+  REQUIRE(same_pixels(block_tracer.image, single_tracer.image));
+}
+
+TEST_CASE("ImageTracer random numbers of each sample", "[imagetracer]") {
+
+  // Every sample has its own generator: the image does not depend on the order the pixels are visited in
+  shared_ptr<Camera> camera = make_shared<PerspectiveCamera>(1.0, 2.0);
+  auto ray_color = [](Ray ray, PCG &pcg) -> Color {
+    float x = pcg.random_float();
+    return Color(ray.dir.y + x, ray.dir.z, pcg.random_float());
+  };
+
+  ImageTracer full_tracer(HdrImage(24, 12), camera, 3, PCG(5, 9));
+  full_tracer.fire_all_rays(ray_color, 1, 24);
+
+  for (auto order : {TileOrder::ROWS, TileOrder::HILBERT, TileOrder::SPIRAL}) {
+    for (int tile_size : {1, 5, 16}) {
+      ImageTracer tracer(HdrImage(24, 12), camera, 3, PCG(5, 9));
+      tracer.tile_order = order;
+      tracer.fire_all_rays(ray_color, 2, tile_size);
+      for (int i{}; i < tracer.image.pixels.size(); ++i) {
+        REQUIRE(tracer.image.pixels[i].r == full_tracer.image.pixels[i].r);
+        REQUIRE(tracer.image.pixels[i].b == full_tracer.image.pixels[i].b);
+      }
+    }
+  }
+
+  // Rendering a region alone gives the same pixels, and the tracer's generator is never advanced
+  ImageTracer region_tracer(HdrImage(24, 12), camera, 3, PCG(5, 9));
+  function<Color(Ray, PCG &)> kernel = ray_color;
+  region_tracer.fire_rays_in_region(7, 3, 11, 9, kernel);
+  for (int row{3}; row < 9; ++row) {
+    for (int col{7}; col < 11; ++col)
+      REQUIRE(region_tracer.image.get_pixel(col, row).r == full_tracer.image.get_pixel(col, row).r);
+  }
+  REQUIRE(region_tracer.pcg.state == PCG(5, 9).state);
+
+  // Different samples, pixels and seeds draw different numbers
+  REQUIRE(full_tracer.sample_pcg(0, 0).random() != full_tracer.sample_pcg(1, 0).random());
+  REQUIRE(full_tracer.sample_pcg(0, 0).random() != full_tracer.sample_pcg(0, 1).random());
+  REQUIRE(full_tracer.sample_pcg(3, 2, 0).random() != full_tracer.sample_pcg(3, 2, 1).random());
+  ImageTracer other_tracer(HdrImage(24, 12), camera, 3, PCG(6, 9));
+  REQUIRE(full_tracer.sample_pcg(3, 2).random() != other_tracer.sample_pcg(3, 2).random());
+}
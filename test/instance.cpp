@@ -0,0 +1,183 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "world.h"
+#include "catch_amalgamated.hpp"
+
+#define CATCH_CONFIG_MAIN
+
+// Setup: a "tree" made of a box trunk and a spherical crown
+shared_ptr<ShapeGroup> tree() {
+  shared_ptr<ShapeGroup> group = make_shared<ShapeGroup>();
+  group->add_shape(make_shared<Box>(Point(-0.1, -0.1, 0.0), Point(0.1, 0.1, 1.0)));
+  group->add_shape(make_shared<Sphere>(translation(Vec(0.0, 0.0, 1.5)) * scaling(Vec(0.5, 0.5, 0.5))));
+  group->build_bvh();
+  return group;
+}
+
+TEST_CASE("Instance: Hit", "[instance]") {
+
+  Transformation transformation = translation(Vec(5.0, 0.0, 0.0)) * rotation_z(30);
+  Instance instance(tree(), transformation);
+
+  // The same shapes, transformed one by one
+  World reference;
+  reference.add_shape(make_shared<Box>(Point(-0.1, -0.1, 0.0), Point(0.1, 0.1, 1.0), transformation));
+  reference.add_shape(make_shared<Sphere>(transformation * translation(Vec(0.0, 0.0, 1.5)) * scaling(Vec(0.5, 0.5, 0.5))));
+
+  PCG pcg;
+  for (int i{}; i < 500; ++i) {
+    Ray ray(Point(5.0 + 2.0 * pcg.random_float() - 1.0, -5.0, 2.5 * pcg.random_float()), VEC_Y);
+    HitRecord hit = instance.ray_intersection(ray);
+    HitRecord expected = reference.ray_intersection(ray);
+
+    REQUIRE(hit.init == expected.init);
+    REQUIRE(instance.check_if_intersection(ray) == expected.init);
+    if (expected.init) {
+      REQUIRE(are_close(hit.t, expected.t));
+      REQUIRE(hit.world_point.is_close(expected.world_point));
+      REQUIRE(hit.normal.normalize().is_close(expected.normal));
+    }
+  }
+
+  AABB box = instance.bounding_box();
+  REQUIRE(are_close(box.pmin.z, 0.0));
+  REQUIRE(are_close(box.pmax.z, 2.0));
+}
+
+TEST_CASE("Instance: Material", "[instance]") {
+
+  shared_ptr<ShapeGroup> group = tree();
+  Material red(make_shared<DiffuseBRDF>(make_shared<UniformPigment>(Color(1.0, 0.0, 0.0))));
+
+  Instance plain(group, translation(Vec(0.0, 5.0, 0.0)));
+  Instance painted(group, translation(Vec(0.0, -5.0, 0.0)), red);
+
+  HitRecord hit1 = plain.ray_intersection(Ray(Point(-5.0, 5.0, 1.5), VEC_X));
+  HitRecord hit2 = painted.ray_intersection(Ray(Point(-5.0, -5.0, 1.5), VEC_X));
+
+  REQUIRE(hit1.init);
+  REQUIRE(hit2.init);
+  REQUIRE(hit1.material.brdf == group->shapes[1]->material.brdf);
+  REQUIRE(hit2.material.brdf == red.brdf);
+  REQUIRE(!plain.material.brdf);
+
+  // The same materials when the closest hit is shaded after the search through the world hierarchy
+  World world;
+  world.add_shape(make_shared<Instance>(group, translation(Vec(0.0, 5.0, 0.0))));
+  world.add_shape(make_shared<Instance>(group, translation(Vec(0.0, -5.0, 0.0)), red));
+  world.build_bvh();
+  HitRecord hit3 = world.ray_intersection(Ray(Point(-5.0, 5.0, 1.5), VEC_X));
+  HitRecord hit4 = world.ray_intersection(Ray(Point(-5.0, -5.0, 1.5), VEC_X));
+  REQUIRE(hit3.world_point.is_close(hit1.world_point));
+  REQUIRE(hit4.world_point.is_close(hit2.world_point));
+  REQUIRE(hit3.material.brdf == group->shapes[1]->material.brdf);
+  REQUIRE(hit4.material.brdf == red.brdf);
+}
+
+TEST_CASE("Instance: Shared geometry", "[instance]") {
+
+  // A forest of identical trees shares a single group and its hierarchy
+  shared_ptr<ShapeGroup> group = tree();
+  World world;
+  for (int i{}; i < 100; ++i)
+    for (int j{}; j < 100; ++j)
+      world.add_shape(make_shared<Instance>(group, translation(Vec(2.0 * i, 2.0 * j, 0.0))));
+  world.build_bvh();
+
+  REQUIRE(group.use_count() == 10001);
+  REQUIRE(group->accelerator == group->bvh);
+  REQUIRE(group->bvh.use_count() == 2);
+
+  HitRecord hit = world.ray_intersection(Ray(Point(20.0, 20.0, 10.0), -VEC_Z));
+  REQUIRE(hit.init);
+  REQUIRE(hit.world_point.is_close(Point(20.0, 20.0, 2.0)));
+
+  REQUIRE(!world.is_point_visible(Point(20.0, 20.0, 10.0), Point(20.0, 20.0, -1.0)));
+  REQUIRE(world.is_point_visible(Point(21.0, 21.0, 10.0), Point(21.0, 21.0, -1.0)));
+}
+
+// Setup: a sphere counting the searches that reach it
+struct CountingSphere : public Sphere {
+  int n_searches = 0;
+
+  CountingSphere(Transformation t) : Sphere(t) {}
+
+  bool hit_distance(Ray ray, HitDistance &hit) {
+    ++n_searches;
+    return Sphere::hit_distance(ray, hit);
+  }
+};
+
+TEST_CASE("Instance: Shading the closest hit", "[instance]") {
+
+  // The record of an instance hit comes from the shape hit in the group, with no new search
+  shared_ptr<CountingSphere> sphere = make_shared<CountingSphere>(scaling(Vec(0.5, 0.5, 0.5)));
+  shared_ptr<ShapeGroup> group = make_shared<ShapeGroup>();
+  group->add_shape(sphere);
+  Instance instance(group, translation(Vec(3.0, 0.0, 0.0)));
+
+  Ray ray(Point(0.0, 0.0, 0.0), VEC_X);
+  HitDistance hit;
+  REQUIRE(instance.hit_distance(ray, hit));
+  REQUIRE(hit.shape == &instance);
+  REQUIRE(hit.n_inner == 1);
+  REQUIRE(hit.inner_shapes[0] == sphere.get());
+  REQUIRE(sphere->n_searches == 1);
+
+  HitRecord record = instance.hit_record(ray, hit);
+  REQUIRE(sphere->n_searches == 1);
+  REQUIRE(record.world_point.is_close(Point(2.5, 0.0, 0.0)));
+  REQUIRE(record.ray.is_close(ray));
+
+  // Nested instances give the same records as the search through every level, also when they are nested
+  // more than the hits can keep (the inner levels are then searched again)
+  Material red(make_shared<DiffuseBRDF>(make_shared<UniformPigment>(Color(1.0, 0.0, 0.0))));
+  shared_ptr<ShapeGroup> level = tree();
+  for (int depth{1}; depth <= HIT_MAX_INNER_SHAPES + 2; ++depth) {
+    shared_ptr<ShapeGroup> outer = make_shared<ShapeGroup>();
+    if (depth == 2)
+      outer->add_shape(make_shared<Instance>(level, translation(Vec(0.0, 0.5, 0.0)) * rotation_z(20), red));
+    else
+      outer->add_shape(make_shared<Instance>(level, translation(Vec(0.0, 0.5, 0.0)) * rotation_z(20)));
+    outer->add_shape(make_shared<Box>(Point(1.0, -0.5, 0.0), Point(1.5, 0.5, 0.2)));
+    outer->build_bvh();
+    level = outer;
+
+    World world;
+    world.add_shape(make_shared<Instance>(level, translation(Vec(5.0, 0.0, 0.0))));
+    world.build_bvh();
+    Instance top(level, translation(Vec(5.0, 0.0, 0.0)));
+
+    PCG pcg;
+    for (int i{}; i < 200; ++i) {
+      Ray ray(Point(5.0 + 4.0 * pcg.random_float() - 2.0, 4.0 * pcg.random_float() - 2.0, 10.0), -VEC_Z);
+      HitRecord hit = world.ray_intersection(ray);
+      HitRecord expected = top.ray_intersection(ray);
+
+      REQUIRE(hit.init == expected.init);
+      if (expected.init) {
+        REQUIRE(are_close(hit.t, expected.t));
+        REQUIRE(hit.world_point.is_close(expected.world_point));
+        REQUIRE(hit.normal.is_close(expected.normal.normalize()));
+        REQUIRE(hit.material.brdf == expected.material.brdf);
+      }
+    }
+  }
+}
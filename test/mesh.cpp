@@ -0,0 +1,338 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "mesh.h"
+#include "scene.h"
+#include "catch_amalgamated.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#define CATCH_CONFIG_MAIN
+
+// Setup: write an OBJ file in the temporary directory
+string write_obj_file(string name, string content) {
+  filesystem::path path = filesystem::temp_directory_path() / name;
+  ofstream stream(path);
+  stream << content;
+  return path.string();
+}
+
+// Setup: append the bytes of a value to a binary buffer
+template <typename T> void put(string &buffer, T value) { buffer.append(reinterpret_cast<char *>(&value), sizeof(value)); }
+
+// Setup: a square of side 1 on the xy plane, split in n x n cells of two triangles each
+Mesh square_mesh(int n, Transformation transformation = Transformation()) {
+  vector<Point> vertices;
+  vector<MeshTriangle> triangles;
+  for (int j{}; j <= n; ++j)
+    for (int i{}; i <= n; ++i)
+      vertices.push_back(Point(float(i) / n, float(j) / n, 0));
+  for (int j{}; j < n; ++j) {
+    for (int i{}; i < n; ++i) {
+      int v = j * (n + 1) + i;
+      triangles.push_back(MeshTriangle{{v, v + 1, v + n + 2}, {-1, -1, -1}});
+      triangles.push_back(MeshTriangle{{v, v + n + 2, v + n + 1}, {-1, -1, -1}});
+    }
+  }
+  return Mesh(vertices, {}, triangles, transformation);
+}
+
+TEST_CASE("Mesh: Triangle hit", "[mesh]") {
+
+  Mesh mesh({Point(0, 0, 0), Point(1, 0, 0), Point(0, 1, 0)}, {}, {MeshTriangle{{0, 1, 2}, {-1, -1, -1}}});
+  REQUIRE(mesh.triangles.size() == 1);
+  REQUIRE(mesh.bounding_box().pmax.is_close(Point(1, 1, 0)));
+
+  HitRecord hit = mesh.ray_intersection(Ray(Point(0.25, 0.5, 2), -VEC_Z));
+  REQUIRE(hit.init);
+  REQUIRE(are_close(hit.t, 2.));
+  REQUIRE(hit.world_point.is_close(Point(0.25, 0.5, 0)));
+  REQUIRE(hit.normal.is_close(Normal(0, 0, 1)));
+  REQUIRE(hit.surface_point.is_close(Vec2d(0.25, 0.5)));
+
+  // The normal always faces the incoming ray
+  hit = mesh.ray_intersection(Ray(Point(0.25, 0.25, -2), VEC_Z));
+  REQUIRE(hit.init);
+  REQUIRE(hit.normal.is_close(Normal(0, 0, -1)));
+
+  REQUIRE(!mesh.ray_intersection(Ray(Point(0.75, 0.75, 2), -VEC_Z)).init);
+  REQUIRE(!mesh.ray_intersection(Ray(Point(0.25, 0.25, 2), VEC_Z)).init);
+  REQUIRE(!mesh.ray_intersection(Ray(Point(0.25, 0.25, 2), -VEC_Z, 1e-5, 1., 0)).init);
+  REQUIRE(mesh.check_if_intersection(Ray(Point(0.25, 0.25, 2), -VEC_Z)));
+  REQUIRE(!mesh.check_if_intersection(Ray(Point(0.75, 0.75, 2), -VEC_Z)));
+
+  // An empty mesh is never hit
+  Mesh empty;
+  REQUIRE(!empty.ray_intersection(Ray(Point(0, 0, 0), VEC_X)).init);
+  REQUIRE(empty.bounding_box().is_empty());
+}
+
+TEST_CASE("Mesh: Watertight edges", "[mesh]") {
+
+  // The rays through the shared edges and vertices of the cells never slip between the triangles
+  Transformation transformation = rotation_x(20) * translation(Vec(-0.5, -0.5, 0));
+  Mesh mesh = square_mesh(8, transformation);
+  for (int j{1}; j < 16; ++j) {
+    for (int i{1}; i < 16; ++i) {
+      Point target = transformation * Point(i / 16., j / 16., 0);
+      for (Vec dir : {Vec(0, 0, -1), Vec(0.3, -0.2, -1), Vec(-1, 1, -1)}) {
+        Ray ray(target - dir * 3, dir);
+        REQUIRE(mesh.check_if_intersection(ray));
+        REQUIRE(mesh.ray_intersection(ray).init);
+      }
+    }
+  }
+}
+
+TEST_CASE("Mesh: Closest hit", "[mesh]") {
+
+  // A soup of random triangles, compared with the triangles checked one by one
+  PCG pcg;
+  vector<Point> vertices;
+  vector<MeshTriangle> triangles;
+  for (int i{}; i < 1000; ++i) {
+    Point center(10. * pcg.random_float(), 10. * pcg.random_float(), 10. * pcg.random_float());
+    for (int k{}; k < 3; ++k)
+      vertices.push_back(center + Vec(pcg.random_float() - 0.5, pcg.random_float() - 0.5, pcg.random_float() - 0.5));
+    triangles.push_back(MeshTriangle{{3 * i, 3 * i + 1, 3 * i + 2}, {-1, -1, -1}});
+  }
+  Transformation transformation = translation(Vec(1, 2, 3)) * rotation_z(30) * scaling(Vec(1, 2, 1));
+  Mesh mesh(vertices, {}, triangles, transformation);
+  REQUIRE(mesh.stats.n_nodes == mesh.nodes.size());
+
+  World brute_force;
+  for (auto &triangle : triangles)
+    brute_force.add_shape(make_shared<Mesh>(vertices, vector<Normal>{}, vector<MeshTriangle>{triangle}, transformation));
+
+  for (int i{}; i < 1000; ++i) {
+    Point origin(20. * pcg.random_float() - 5., 20. * pcg.random_float() - 5., 20. * pcg.random_float() - 5.);
+    Ray ray(origin, Point(5 + 5 * pcg.random_float(), 8 * pcg.random_float(), 5 + 5 * pcg.random_float()) - origin);
+    HitRecord expected = brute_force.ray_intersection(ray);
+    HitRecord hit = mesh.ray_intersection(ray);
+
+    REQUIRE(hit.init == expected.init);
+    REQUIRE(mesh.check_if_intersection(ray) == expected.init);
+    if (expected.init) {
+      REQUIRE(hit.t == expected.t);
+      REQUIRE(hit.world_point.is_close(expected.world_point));
+    }
+  }
+}
+
+TEST_CASE("Mesh: OBJ file", "[mesh]") {
+
+  // A square made of a quad with vertex normals and of a triangle with relative indices, plus ignored lines
+  string file_name = write_obj_file("prt_mesh_test.obj",
+                                    "# A test mesh\n"
+                                    "o square\n"
+                                    "v 0 0 0\n"
+                                    "v 1 0 0\r\n"
+                                    "v 1 1 0\n"
+                                    "  v 0 1 0\n"
+                                    "vt 0 0\n"
+                                    "vn 0 0 1\n"
+                                    "vn 0.6 0 0.8\n"
+                                    "usemtl none\n"
+                                    "f 1//1 2//2 3//2 4//1\n"
+                                    "v 0 0 1\n"
+                                    "f -1/1 1/1 2/1\n");
+
+  Mesh mesh = read_obj_file(file_name, translation(Vec(0, 0, 1)));
+  REQUIRE(mesh.vertices.size() == 5);
+  REQUIRE(mesh.normals.size() == 2);
+  REQUIRE(mesh.triangles.size() == 3);
+  REQUIRE(mesh.vertices[4].is_close(Point(0, 0, 1)));
+
+  int n_flat = 0;
+  for (auto &triangle : mesh.triangles) {
+    if (triangle.normal[0] < 0) {
+      n_flat++;
+      vector<int> corners(triangle.vertex, triangle.vertex + 3);
+      sort(corners.begin(), corners.end());
+      REQUIRE(corners == vector<int>{0, 1, 4});
+    }
+  }
+  REQUIRE(n_flat == 1);
+
+  // The vertex normals are interpolated
+  HitRecord hit = mesh.ray_intersection(Ray(Point(1, 0.5, 3), -VEC_Z));
+  REQUIRE(hit.init);
+  REQUIRE(hit.world_point.is_close(Point(1, 0.5, 1)));
+  REQUIRE(hit.normal.is_close(Normal(0.6, 0, 0.8)));
+
+  // Errors are reported with their line
+  string wrong_index = write_obj_file("prt_mesh_wrong_index.obj", "v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1 2 4\n");
+  try {
+    read_obj_file(wrong_index);
+    REQUIRE(false);
+  } catch (InvalidMeshFileFormat &e) {
+    REQUIRE(string(e.what()).find("line 4") != string::npos);
+  }
+  string wrong_vertex = write_obj_file("prt_mesh_wrong_vertex.obj", "v 0 0\nv 1 0 0\nv 1 1 0\nf 1 2 3\n");
+  REQUIRE_THROWS_AS(read_obj_file(wrong_vertex), InvalidMeshFileFormat);
+  REQUIRE_THROWS_AS(read_obj_file(file_name + ".missing"), InvalidMeshFileFormat);
+}
+
+TEST_CASE("Mesh: Parallel OBJ parsing", "[mesh]") {
+
+  // A file big enough to be split in several chunks, where relative indices cross the chunk boundaries
+  stringstream content;
+  int n = 60;
+  for (int j{}; j <= n; ++j)
+    for (int i{}; i <= n; ++i)
+      content << "v " << float(i) / n << " " << float(j) / n << " " << 0.1 * sin(i + j) << "\n";
+  for (int j{}; j < n; ++j) {
+    for (int i{}; i < n; ++i) {
+      int v = j * (n + 1) + i + 1;
+      content << "f " << v << " " << v + 1 << " " << v + n + 2 << " " << v + n + 1 << "\n";
+      content << "v " << float(i) / n << " " << float(j) / n << " 1\n";
+      content << "f -1 " << v << " " << v + 1 << "\n";
+    }
+  }
+  string file_name = write_obj_file("prt_mesh_parallel.obj", content.str());
+
+  Mesh serial = read_obj_file(file_name, Transformation(), Material(), 1);
+  Mesh parallel = read_obj_file(file_name, Transformation(), Material(), 4);
+  REQUIRE(serial.vertices.size() == (n + 1) * (n + 1) + n * n);
+  REQUIRE(serial.triangles.size() == 3 * n * n);
+  REQUIRE(parallel.vertices.size() == serial.vertices.size());
+  REQUIRE(parallel.triangles.size() == serial.triangles.size());
+
+  auto sorted_triangles = [](Mesh &mesh) {
+    vector<tuple<int, int, int>> result;
+    for (auto &triangle : mesh.triangles)
+      result.push_back({triangle.vertex[0], triangle.vertex[1], triangle.vertex[2]});
+    sort(result.begin(), result.end());
+    return result;
+  };
+  for (int i{}; i < serial.vertices.size(); ++i)
+    REQUIRE(parallel.vertices[i].is_close(serial.vertices[i]));
+  REQUIRE(sorted_triangles(parallel) == sorted_triangles(serial));
+}
+
+TEST_CASE("Mesh: PLY file read in place", "[mesh]") {
+
+  // The unit square with its normals tilted along x, and a color making the records unaligned
+  string content = "ply\nformat binary_little_endian 1.0\ncomment test square\nelement vertex 4\n"
+                   "property float x\nproperty float y\nproperty float z\n"
+                   "property float nx\nproperty float ny\nproperty float nz\nproperty uchar red\n"
+                   "element face 2\nproperty list uchar int vertex_indices\nend_header\n";
+  float xy[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+  for (int i{}; i < 4; ++i) {
+    for (float value : {xy[i][0], xy[i][1], 0.f, (i == 1 || i == 2) ? 0.6f : 0.f, 0.f, (i == 1 || i == 2) ? 0.8f : 1.f})
+      put(content, value);
+    put(content, uint8_t(255));
+  }
+  for (auto face : {vector<int32_t>{0, 1, 2}, vector<int32_t>{0, 2, 3}}) {
+    put(content, uint8_t(3));
+    for (int32_t v : face)
+      put(content, v);
+  }
+  string file_name = write_obj_file("prt_mesh_test.ply", content);
+
+  Mesh mesh = read_ply_file(file_name, translation(Vec(0, 0, 1)));
+  REQUIRE(mesh.mapping);
+  REQUIRE(mesh.vertices.empty());
+  REQUIRE(mesh.triangles.empty());
+  REQUIRE(mesh.n_vertices() == 4);
+  REQUIRE(mesh.n_triangles() == 2);
+  REQUIRE(mesh.vertex(2).is_close(Point(1, 1, 0)));
+  REQUIRE(mesh.normal(1).is_close(Normal(0.6, 0, 0.8)));
+
+  HitRecord hit = mesh.ray_intersection(Ray(Point(1, 0.5, 3), -VEC_Z));
+  REQUIRE(hit.init);
+  REQUIRE(hit.world_point.is_close(Point(1, 0.5, 1)));
+  REQUIRE(hit.normal.is_close(Normal(0.6, 0, 0.8)));
+  REQUIRE(mesh.check_if_intersection(Ray(Point(0.1, 0.9, 3), -VEC_Z)));
+  REQUIRE(!mesh.check_if_intersection(Ray(Point(1.1, 0.5, 3), -VEC_Z)));
+
+  // Indices out of range are rejected before any intersection
+  content[content.size() - 1] = 4;
+  string wrong_index = write_obj_file("prt_mesh_wrong_index.ply", content);
+  REQUIRE_THROWS_AS(read_ply_file(wrong_index), InvalidMeshFileFormat);
+}
+
+TEST_CASE("Mesh: PLY file converted", "[mesh]") {
+
+  // Double coordinates, a quad with an extra property, and an element that is not read
+  string content = "ply\nformat binary_little_endian 1.0\nelement vertex 4\n"
+                   "property double x\nproperty double y\nproperty double z\n"
+                   "element face 1\nproperty list uchar uint vertex_indices\nproperty uchar flags\n"
+                   "element edge 1\nproperty int vertex1\nproperty int vertex2\nend_header\n";
+  for (double value : {0., 0., 0., 1., 0., 0., 1., 1., 0., 0., 1., 0.})
+    put(content, value);
+  put(content, uint8_t(4));
+  for (uint32_t v : {0, 1, 2, 3})
+    put(content, v);
+  put(content, uint8_t(7));
+  put(content, int32_t(0));
+  put(content, int32_t(1));
+  string file_name = write_obj_file("prt_mesh_converted.ply", content);
+
+  Mesh mesh = read_ply_file(file_name);
+  REQUIRE(!mesh.mapping);
+  REQUIRE(mesh.vertices.size() == 4);
+  REQUIRE(mesh.triangles.size() == 2);
+  REQUIRE(mesh.triangles[0].normal[0] == -1);
+
+  HitRecord hit = mesh.ray_intersection(Ray(Point(0.2, 0.7, 3), -VEC_Z));
+  REQUIRE(hit.init);
+  REQUIRE(hit.world_point.is_close(Point(0.2, 0.7, 0)));
+  REQUIRE(hit.normal.is_close(Normal(0, 0, 1)));
+
+  // Truncated files and other formats are rejected
+  string truncated = write_obj_file("prt_mesh_truncated.ply", content.substr(0, content.size() - 12));
+  REQUIRE_THROWS_AS(read_ply_file(truncated), InvalidMeshFileFormat);
+  string ascii = write_obj_file("prt_mesh_ascii.ply", "ply\nformat ascii 1.0\nelement vertex 0\nend_header\n");
+  REQUIRE_THROWS_AS(read_ply_file(ascii), InvalidMeshFileFormat);
+  REQUIRE_THROWS_AS(read_ply_file(file_name + ".missing"), InvalidMeshFileFormat);
+}
+
+TEST_CASE("Mesh: Scene keyword", "[mesh]") {
+
+  string file_name = write_obj_file("prt_mesh_scene.obj", "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3 4\n");
+
+  stringstream sstr;
+  sstr << "material gray(diffuse(uniform(<0.5, 0.5, 0.5>)), uniform(<0, 0, 0>))"
+          "\nmesh(gray, \"" << file_name << "\", translation([0, 0, 1]))"
+          "\ngroup tiles(mesh(gray, \"" << file_name << "\", identity))"
+          "\n";
+
+  InputStream stream(sstr);
+  unordered_map<string, float> variables;
+  Scene scene = stream.parse_scene(variables);
+
+  REQUIRE(scene.world.shapes.size() == 1);
+  shared_ptr<Mesh> mesh = dynamic_pointer_cast<Mesh>(scene.world.shapes[0]);
+  REQUIRE(mesh);
+  REQUIRE(mesh->triangles.size() == 2);
+  REQUIRE(scene.groups["tiles"]->shapes.size() == 1);
+
+  HitRecord hit = scene.world.ray_intersection(Ray(Point(0.5, 0.2, 3), -VEC_Z));
+  REQUIRE(hit.init);
+  REQUIRE(hit.world_point.is_close(Point(0.5, 0.2, 1)));
+
+  // Unknown materials raise a GrammarError
+  stringstream wrong;
+  wrong << "mesh(unknown, \"" << file_name << "\", identity)";
+  InputStream wrong_stream(wrong);
+  REQUIRE_THROWS_AS(wrong_stream.parse_scene(variables), GrammarError);
+}
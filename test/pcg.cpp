@@ -19,6 +19,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "pcg.h"
 #include "catch_amalgamated.hpp"
+#include <cstdlib>
 
 #define CATCH_CONFIG_MAIN
 
@@ -36,3 +37,63 @@ TEST_CASE("PCG", "[pcg]") {
     REQUIRE(expected[i] == pcg.random());
   }
 }
+
+TEST_CASE("PCG advance", "[pcg]") {
+
+  // Jumping ahead by n gives the same state as drawing n numbers
+  for (uint64_t n : {0, 1, 2, 3, 7, 64, 1000, 12345}) {
+    PCG stepped(17, 3), jumped(17, 3);
+    for (uint64_t i{}; i < n; ++i)
+      stepped.random();
+    jumped.advance(n);
+
+    REQUIRE(jumped.state == stepped.state);
+    REQUIRE(jumped.random() == stepped.random());
+  }
+
+  // Jumps compose, and a jump by -n goes back by n numbers
+  PCG pcg, composed, back;
+  pcg.advance(1000);
+  composed.advance(400);
+  composed.advance(600);
+  REQUIRE(composed.state == pcg.state);
+
+  for (int i{}; i < 5; ++i)
+    back.random();
+  back.advance(uint64_t(-5));
+  REQUIRE(back.state == PCG().state);
+}
+
+TEST_CASE("PCG streams", "[pcg]") {
+
+  PCG pcg(11, 13);
+  uint64_t initial_state = pcg.state;
+
+  // A substream is always the same, and does not change the parent generator
+  PCG first = pcg.substream(0), again = pcg.substream(0), second = pcg.substream(1);
+  REQUIRE(pcg.state == initial_state);
+  REQUIRE(first.state == again.state);
+  REQUIRE(first.inc == again.inc);
+  REQUIRE(first.inc != second.inc);
+
+  // Splitting advances the parent by four numbers, and gives generators drawing different numbers
+  PCG expected(pcg);
+  expected.advance(4);
+  PCG child = pcg.split();
+  REQUIRE(pcg.state == expected.state);
+  PCG sibling = pcg.split();
+  REQUIRE(child.inc != sibling.inc);
+
+  // Close streams are not correlated: their numbers agree about as often as random bits
+  auto equal_bits = [](PCG a, PCG b) -> int {
+    int n_equal = 0;
+    for (int i{}; i < 1000; ++i) {
+      uint32_t x = a.random() ^ b.random();
+      for (int bit{}; bit < 32; ++bit)
+        n_equal += ((x >> bit) & 1) == 0;
+    }
+    return n_equal;
+  };
+  REQUIRE(abs(equal_bits(first, second) - 16000) < 1000);
+  REQUIRE(abs(equal_bits(child, sibling) - 16000) < 1000);
+}
@@ -0,0 +1,127 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "world.h"
+#include <memory>
+#include <vector>
+
+#ifndef _random_scene_h_
+#define _random_scene_h_
+
+// Random scenes shared by the tests and the benchmarks of the acceleration structures
+
+/**
+ * Parameters of a random cloud of shapes
+ *
+ * @param min_corner lowest corner of the region where shapes are placed
+ * @param max_corner highest corner of the region where shapes are placed
+ * @param min_size smallest size of a shape
+ * @param max_size largest size of a shape
+ * @param rotate if true, shapes are also rotated by a random angle around the z axis
+ * @param boxes if true, every other shape is a box instead of a sphere
+ * @param plane if true, a plane is added below the cloud
+ */
+struct RandomScene {
+  Point min_corner = Point(-10, -10, 0);
+  Point max_corner = Point(10, 10, 20);
+  float min_size = 0.1, max_size = 0.6;
+  bool rotate = true;
+  bool boxes = true;
+  bool plane = false;
+};
+
+/**
+ * Return a point drawn uniformly in the box with the given corners
+ *
+ * @param pcg random number generator
+ * @param min_corner lowest corner of the box
+ * @param max_corner highest corner of the box
+ */
+inline Point random_point(PCG &pcg, Point min_corner, Point max_corner) {
+  float x = min_corner.x + (max_corner.x - min_corner.x) * pcg.random_float();
+  float y = min_corner.y + (max_corner.y - min_corner.y) * pcg.random_float();
+  float z = min_corner.z + (max_corner.z - min_corner.z) * pcg.random_float();
+  return Point(x, y, z);
+}
+
+/**
+ * Return the transformation placing a random shape of the cloud
+ *
+ * @param pcg random number generator
+ * @param scene parameters of the cloud
+ */
+inline Transformation random_placement(PCG &pcg, const RandomScene &scene = RandomScene()) {
+  Vec position = random_point(pcg, scene.min_corner, scene.max_corner).to_vec();
+  float size = scene.min_size + (scene.max_size - scene.min_size) * pcg.random_float();
+  Transformation scale = scaling(Vec(size, size, size));
+  if (!scene.rotate) return translation(position) * scale;
+  return translation(position) * rotation_z(90. * pcg.random_float()) * scale;
+}
+
+/**
+ * Return a random cloud of spheres and boxes
+ *
+ * @param n_shapes number of shapes in the cloud (the plane excluded)
+ * @param pcg random number generator
+ * @param scene parameters of the cloud
+ */
+inline vector<shared_ptr<Shape>> random_shapes(int n_shapes, PCG &pcg, const RandomScene &scene = RandomScene()) {
+  vector<shared_ptr<Shape>> shapes;
+  for (int i{}; i < n_shapes; ++i) {
+    Transformation placement = random_placement(pcg, scene);
+    if (scene.boxes && i % 2 == 1)
+      shapes.push_back(make_shared<Box>(Point(0, 0, 0), Point(1, 2, 1), placement));
+    else
+      shapes.push_back(make_shared<Sphere>(placement));
+  }
+  if (scene.plane) shapes.push_back(make_shared<Plane>(translation(Vec(0, 0, scene.min_corner.z - 1))));
+  return shapes;
+}
+
+/**
+ * Return a world holding a random cloud of spheres and boxes
+ *
+ * @param n_shapes number of shapes in the cloud (the plane excluded)
+ * @param pcg random number generator
+ * @param scene parameters of the cloud
+ */
+inline World random_world(int n_shapes, PCG &pcg, const RandomScene &scene = RandomScene()) {
+  World world;
+  for (auto &shape : random_shapes(n_shapes, pcg, scene))
+    world.add_shape(shape);
+  return world;
+}
+
+/**
+ * Return a ray with origin and direction drawn uniformly in the given boxes
+ *
+ * @param pcg random number generator
+ * @param min_origin lowest corner of the box of origins
+ * @param max_origin highest corner of the box of origins
+ * @param min_dir lowest corner of the box of directions
+ * @param max_dir highest corner of the box of directions
+ */
+inline Ray random_ray(PCG &pcg, Point min_origin = Point(-15, -15, -5), Point max_origin = Point(15, 15, 25),
+                      Point min_dir = Point(-1, -1, -1), Point max_dir = Point(1, 1, 1)) {
+  Point origin = random_point(pcg, min_origin, max_origin);
+  Vec dir = random_point(pcg, min_dir, max_dir).to_vec();
+  return Ray(origin, dir);
+}
+
+#endif
@@ -48,3 +48,28 @@ TEST_CASE("Ray transform", "[ray]") {
   REQUIRE(transformed.origin.is_close(Point(11.0, 8.0, 14.0)));
   REQUIRE(transformed.dir.is_close(Vec(6.0, -4.0, 5.0)));
 }
+
+TEST_CASE("Ray inverse_transform", "[ray]") {
+  Ray back = transformed.inverse_transform(tr);
+  REQUIRE(back.is_close(ray5));
+  REQUIRE(back.is_close(transformed.transform(tr.inverse())));
+}
+
+TEST_CASE("Ray reciprocal direction", "[ray]") {
+  REQUIRE(ray1.inv_dir.is_close(Vec(0.2, 0.25, -1.0)));
+  REQUIRE(!ray1.dir_is_neg[0]);
+  REQUIRE(!ray1.dir_is_neg[1]);
+  REQUIRE(ray1.dir_is_neg[2]);
+
+  // Transformed rays get the reciprocal of their new direction
+  REQUIRE(transformed.inv_dir.is_close(Vec(1. / 6., -0.25, 0.2)));
+  REQUIRE(transformed.dir_is_neg[1]);
+
+  // Null components give infinities with the same sign
+  Ray parallel(Point(0.0, 0.0, 0.0), Vec(0.0, -0.0, 2.0));
+  REQUIRE(parallel.inv_dir.x == INFINITY);
+  REQUIRE(parallel.inv_dir.y == -INFINITY);
+  REQUIRE(!parallel.dir_is_neg[0]);
+  REQUIRE(parallel.dir_is_neg[1]);
+  REQUIRE(are_close(parallel.inv_dir.z, 0.5));
+}
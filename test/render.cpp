@@ -76,6 +76,35 @@ TEST_CASE("FlatRenderer constructor", "[renderer]") {
   REQUIRE(tracer.image.get_pixel(2, 2).is_close(BLACK));
 }
 
+TEST_CASE("Renderers with ray packets", "[renderer]") {
+
+  // A few spheres in a hierarchy, rendered by blocks of pixels: the images are the same as with single rays
+  World world;
+  for (int i{}; i < 5; ++i)
+    world.add_shape(make_shared<Sphere>(translation(Vec(2.0, 0.3 * i - 0.6, 0.1 * i)) * scaling(Vec(0.2, 0.2, 0.2)),
+                                        Material(make_shared<DiffuseBRDF>(make_shared<UniformPigment>(Color(i, 1, 2))))));
+  world.build_bvh();
+
+  FlatRenderer flat(world);
+  OnOffRenderer onoff(world);
+  for (int r{}; r < 2; ++r) {
+    ImageTracer single_tracer(HdrImage(13, 9), make_shared<OrthogonalCamera>());
+    ImageTracer packet_tracer(HdrImage(13, 9), make_shared<OrthogonalCamera>());
+    if (r == 0) {
+      single_tracer.fire_all_rays(flat);
+      packet_tracer.fire_ray_packets(flat, 4);
+    } else {
+      single_tracer.fire_all_rays(onoff);
+      packet_tracer.fire_ray_packets(onoff, 4);
+    }
+
+    for (int row{}; row < 9; ++row) {
+      for (int col{}; col < 13; ++col)
+        REQUIRE(packet_tracer.image.get_pixel(col, row).is_close(single_tracer.image.get_pixel(col, row)));
+    }
+  }
+}
+
 TEST_CASE("PathTracer constructor", "[renderer]") { // Furnace test
 
   PCG pcg;
@@ -103,3 +132,68 @@ TEST_CASE("PathTracer constructor", "[renderer]") { // Furnace test
     REQUIRE(are_close(expected, color.b, 1e-3));
   }
 }
+
+TEST_CASE("PathTracer with multithreaded tiles", "[renderer]") {
+
+  // Diffuse spheres lit by an emitting plane: the same seed gives the same image for any number of threads
+  World world;
+  Material sky(make_shared<DiffuseBRDF>(make_shared<UniformPigment>(BLACK)), make_shared<UniformPigment>(WHITE));
+  world.add_shape(make_shared<Plane>(translation(Vec(0, 0, 5)), sky));
+  for (int i{}; i < 3; ++i)
+    world.add_shape(make_shared<Sphere>(translation(Vec(2.0, 0.6 * i - 0.6, 0)) * scaling(Vec(0.3, 0.3, 0.3)),
+                                        Material(make_shared<DiffuseBRDF>(make_shared<UniformPigment>(Color(0.5, 0.7, 0.9))))));
+  world.build_bvh();
+
+  PathTracer path_tracer(world, BLACK, PCG(), 2, 3, 2);
+  vector<HdrImage> images;
+  for (int n_threads : {1, 2, 5}) {
+    ImageTracer tracer(HdrImage(15, 10), make_shared<PerspectiveCamera>(1.0, 1.5), 1, PCG(3, 5));
+    tracer.fire_all_rays([&](Ray ray, PCG &pcg) -> Color { return path_tracer.trace(ray, pcg); }, n_threads, 4);
+    images.push_back(tracer.image);
+  }
+
+  for (int i{1}; i < images.size(); ++i) {
+    for (int p{}; p < images[0].pixels.size(); ++p) {
+      REQUIRE(images[i].pixels[p].r == images[0].pixels[p].r);
+      REQUIRE(images[i].pixels[p].g == images[0].pixels[p].g);
+      REQUIRE(images[i].pixels[p].b == images[0].pixels[p].b);
+    }
+  }
+}
+
+TEST_CASE("Renderers as render kernels", "[renderer]") {
+
+  // A renderer passed as a kernel gives the same image as the same renderer wrapped in a function
+  World world;
+  Material sky(make_shared<DiffuseBRDF>(make_shared<UniformPigment>(BLACK)), make_shared<UniformPigment>(WHITE));
+  world.add_shape(make_shared<Plane>(translation(Vec(0, 0, 5)), sky));
+  for (int i{}; i < 3; ++i)
+    world.add_shape(make_shared<Sphere>(translation(Vec(2.0, 0.6 * i - 0.6, 0)) * scaling(Vec(0.3, 0.3, 0.3)),
+                                        Material(make_shared<DiffuseBRDF>(make_shared<UniformPigment>(Color(0.5, 0.7, 0.9))))));
+  world.add_light(PointLight(Point(0, 0, 3), WHITE));
+  world.build_bvh();
+
+  OnOffRenderer onoff(world);
+  FlatRenderer flat(world);
+  PathTracer path_tracer(world, BLACK, PCG(), 2, 3, 2);
+  PointLightTracer point_light(world);
+  vector<Renderer *> renderers = {&onoff, &flat, &path_tracer, &point_light};
+
+  for (int samples : {0, 2}) {
+    for (int r{}; r < renderers.size(); ++r) {
+      ImageTracer function_tracer(HdrImage(15, 10), make_shared<PerspectiveCamera>(1.0, 1.5), samples, PCG(3, 5));
+      ImageTracer kernel_tracer(HdrImage(15, 10), make_shared<PerspectiveCamera>(1.0, 1.5), samples, PCG(3, 5));
+      function_tracer.fire_all_rays([&](Ray ray, PCG &pcg) -> Color { return renderers[r]->trace(ray, pcg); }, 2, 4);
+      if (r == 0) kernel_tracer.fire_ray_batches(onoff, 2, 4, 3);
+      else if (r == 1) kernel_tracer.fire_ray_batches(flat, 2, 4, 3);
+      else if (r == 2) kernel_tracer.fire_ray_batches(path_tracer, 2, 4, 3);
+      else kernel_tracer.fire_ray_batches(point_light, 2, 4, 3);
+
+      for (int p{}; p < kernel_tracer.image.pixels.size(); ++p) {
+        REQUIRE(kernel_tracer.image.pixels[p].r == function_tracer.image.pixels[p].r);
+        REQUIRE(kernel_tracer.image.pixels[p].g == function_tracer.image.pixels[p].g);
+        REQUIRE(kernel_tracer.image.pixels[p].b == function_tracer.image.pixels[p].b);
+      }
+    }
+  }
+}
@@ -19,6 +19,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "scene.h"
 #include "catch_amalgamated.hpp"
+#include <cstring>
+#include <new>
 
 #define CATCH_CONFIG_MAIN
 
@@ -169,6 +171,28 @@ TEST_CASE("Lexer", "[token]") {
     
 }
 
+TEST_CASE("Default token", "[token]") {
+
+  // A default token (e.g. the saved token of a stream) is a stop token, whatever the memory it is built on
+  alignas(Token) unsigned char buffer[sizeof(Token)];
+  memset(buffer, 0xff, sizeof(buffer));
+  Token *token = new (buffer) Token();
+  REQUIRE(token->type == TokenType::STOPTOKEN);
+
+  // So that it is copied without reading any string
+  Token copy(*token);
+  REQUIRE(copy.type == TokenType::STOPTOKEN);
+  copy = *token;
+  REQUIRE(copy.type == TokenType::STOPTOKEN);
+  token->~Token();
+
+  stringstream sstr;
+  sstr << "abc";
+  InputStream stream(sstr);
+  REQUIRE(stream.saved_token.type == TokenType::STOPTOKEN);
+  REQUIRE(stream.read_token().value.str == "abc");
+}
+
 TEST_CASE("Parser", "[scene]") {
 
     stringstream sstr;
@@ -235,6 +259,51 @@ TEST_CASE("Parser", "[scene]") {
     REQUIRE(are_close(scene.camera->aspect_ratio, 1.0));
 }
 
+TEST_CASE("Parser - groups and instances", "[scene]") {
+
+    stringstream sstr;
+    sstr << "material leaf_material(diffuse(uniform(<0, 1, 0>)), uniform(<0, 0, 0>))"
+        "\nmaterial red_material(diffuse(uniform(<1, 0, 0>)), uniform(<0, 0, 0>))"
+        "\n"
+        "\ngroup tree("
+        "\n    box(leaf_material, {-0.1, -0.1, 0}, {0.1, 0.1, 1}, identity),"
+        "\n    sphere(leaf_material, translation([0, 0, 1.5]) * scaling([0.5, 0.5, 0.5]))"
+        "\n)"
+        "\n"
+        "\ninstance(tree, translation([2, 0, 0]))"
+        "\ninstance(tree, red_material, translation([4, 0, 0]) * rotation_z(30))"
+        "\n";
+
+    InputStream stream(sstr);
+    unordered_map<string, float> variables;
+
+    Scene scene = stream.parse_scene(variables);
+
+    REQUIRE(scene.groups.size() == 1);
+    REQUIRE(scene.groups["tree"]->shapes.size() == 2);
+    REQUIRE(scene.groups["tree"]->bvh);
+
+    REQUIRE(scene.world.shapes.size() == 2);
+    shared_ptr<Instance> instance1 = dynamic_pointer_cast<Instance>(scene.world.shapes[0]);
+    shared_ptr<Instance> instance2 = dynamic_pointer_cast<Instance>(scene.world.shapes[1]);
+    REQUIRE(instance1);
+    REQUIRE(instance2);
+    REQUIRE(instance1->group == instance2->group);
+    REQUIRE(!instance1->material_override);
+    REQUIRE(instance2->material_override);
+    REQUIRE(instance2->transformation.is_close(translation(Vec(4, 0, 0)) * rotation_z(30)));
+
+    HitRecord hit = scene.world.ray_intersection(Ray(Point(2, 0, 10), -VEC_Z));
+    REQUIRE(hit.init);
+    REQUIRE(hit.world_point.is_close(Point(2, 0, 2)));
+
+    // Instances of unknown groups raise a GrammarError
+    stringstream wrong;
+    wrong << "instance(forest, identity)";
+    InputStream wrong_stream(wrong);
+    REQUIRE_THROWS_AS(wrong_stream.parse_scene(variables), GrammarError);
+}
+
 TEST_CASE("Parser - undefined material", "[scene]") {
 
     // Check that unknown materials raises a GrammarError
@@ -0,0 +1,94 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "scheduler.h"
+#include "catch_amalgamated.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#define CATCH_CONFIG_MAIN
+
+TEST_CASE("Tile orders", "[scheduler]") {
+
+  // Every order covers the image exactly once, also when the tiles do not fit it
+  for (auto order : {TileOrder::ROWS, TileOrder::HILBERT, TileOrder::SPIRAL}) {
+    vector<Tile> tiles = split_in_tiles(70, 45, 16, order);
+    REQUIRE(tiles.size() == 5 * 3);
+
+    vector<int> coverage(70 * 45, 0);
+    for (auto tile : tiles) {
+      REQUIRE(tile.index == (tile.row_begin / 16) * 5 + tile.col_begin / 16);
+      for (int row{tile.row_begin}; row < tile.row_end; ++row) {
+        for (int col{tile.col_begin}; col < tile.col_end; ++col)
+          ++coverage[row * 70 + col];
+      }
+    }
+    for (auto count : coverage)
+      REQUIRE(count == 1);
+  }
+
+  // Along the Hilbert curve of a square grid the next tile is always a neighbour
+  vector<Tile> hilbert = split_in_tiles(64, 64, 8, TileOrder::HILBERT);
+  REQUIRE(hilbert[0].index == 0);
+  for (int i{1}; i < hilbert.size(); ++i)
+    REQUIRE(abs(hilbert[i].col_begin - hilbert[i - 1].col_begin) + abs(hilbert[i].row_begin - hilbert[i - 1].row_begin) == 8);
+
+  // The spiral starts from the center and goes round it
+  vector<Tile> spiral = split_in_tiles(50, 50, 10, TileOrder::SPIRAL);
+  REQUIRE(spiral[0].index == 12);
+  REQUIRE(spiral[1].index == 13);
+  REQUIRE(spiral[2].index == 18);
+  REQUIRE(spiral[3].index == 17);
+
+  REQUIRE(split_in_tiles(0, 0, 8, TileOrder::SPIRAL).empty());
+}
+
+TEST_CASE("Work-stealing TileScheduler", "[scheduler]") {
+
+  TileScheduler scheduler(split_in_tiles(100, 60, 10, TileOrder::ROWS));
+  for (int n_threads : {1, 4}) {
+    vector<atomic<int>> rendered(scheduler.tiles.size());
+    scheduler.run(n_threads, [&](const Tile &tile) { ++rendered[tile.index]; });
+
+    for (auto &count : rendered)
+      REQUIRE(count == 1);
+    REQUIRE(scheduler.stats.n_tiles.size() == n_threads);
+    int n_tiles = 0;
+    for (int i{}; i < n_threads; ++i) {
+      n_tiles += scheduler.stats.n_tiles[i];
+      REQUIRE(scheduler.stats.busy_ms[i] <= scheduler.stats.wall_ms);
+    }
+    REQUIRE(n_tiles == 60);
+  }
+
+  // The first half of the tiles is much slower: the second thread runs out of work and steals from the first one
+  scheduler.run(2, [&](const Tile &tile) {
+    if (tile.index < 30) this_thread::sleep_for(chrono::milliseconds(2));
+  });
+  REQUIRE(scheduler.stats.n_stolen[1] > 0);
+  REQUIRE(scheduler.stats.n_tiles[1] > 30);
+  REQUIRE(scheduler.stats.n_tiles[0] + scheduler.stats.n_tiles[1] == 60);
+
+  // More threads than tiles
+  TileScheduler small(split_in_tiles(10, 10, 8));
+  atomic<int> n_rendered{0};
+  small.run(16, [&](const Tile &) { ++n_rendered; });
+  REQUIRE(n_rendered == 4);
+}
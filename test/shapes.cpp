@@ -133,6 +133,54 @@ TEST_CASE("Sphere: uv coordinates", "[sphere]"){
   REQUIRE(sphere.ray_intersection(ray6).surface_point.is_close(Vec2d(0.0, 2./3)));
 }
 
+TEST_CASE("Sphere: bounding box", "[sphere]"){
+  Sphere sphere(translation(Vec(1.0, 2.0, 3.0)) * scaling(Vec(2.0, 1.0, 0.5)));
+  AABB box = sphere.bounding_box();
+
+  REQUIRE(box.is_bounded());
+  REQUIRE(box.pmin.is_close(Point(-1.0, 1.0, 2.5)));
+  REQUIRE(box.pmax.is_close(Point(3.0, 3.0, 3.5)));
+
+  // A rotated ellipsoid gets the tightest box, not the box of its rotated bounding cube
+  Sphere rotated(rotation_z(45) * scaling(Vec(2.0, 1.0, 1.0)));
+  AABB rotated_box = rotated.bounding_box();
+  float half_size = sqrt(2.5);
+
+  REQUIRE(rotated_box.pmin.is_close(Point(-half_size, -half_size, -1.0)));
+  REQUIRE(rotated_box.pmax.is_close(Point(half_size, half_size, 1.0)));
+}
+
+TEST_CASE("Sphere: Round spheres", "[sphere]"){
+
+  // Translated and uniformly scaled spheres are intersected in world space, with the same results
+  Transformation round = translation(Vec(1.0, -2.0, 0.5)) * scaling(Vec(1.5, 1.5, 1.5));
+  Transformation ellipsoid = translation(Vec(1.0, -2.0, 0.5)) * scaling(Vec(1.5, 1.5, 1.6));
+  REQUIRE(Sphere(round).is_round());
+  REQUIRE(Sphere().is_round());
+  REQUIRE(!Sphere(ellipsoid).is_round());
+  REQUIRE(!Sphere(rotation_z(30) * round).is_round());
+
+  Sphere sphere(round);
+  Sphere reference(Transformation(round.m, round.invm));
+  REQUIRE(!reference.is_round());
+
+  PCG pcg;
+  for (int i{}; i < 200; ++i) {
+    Ray ray(Point(6. * pcg.random_float() - 2., 6. * pcg.random_float() - 5., 6. * pcg.random_float() - 2.5),
+            Vec(pcg.random_float() - 0.5, pcg.random_float() - 0.5, pcg.random_float() - 0.5));
+    HitRecord hit = sphere.ray_intersection(ray);
+    HitRecord expected = reference.ray_intersection(ray);
+    REQUIRE(hit.init == expected.init);
+    REQUIRE(sphere.check_if_intersection(ray) == expected.init);
+    if (expected.init) {
+      REQUIRE(are_close(hit.t, expected.t, 1e-4));
+      REQUIRE(hit.world_point.is_close(expected.world_point, 1e-4));
+      REQUIRE(hit.normal.is_close(expected.normal, 1e-4));
+      REQUIRE(hit.surface_point.is_close(expected.surface_point));
+    }
+  }
+}
+
 // –––––––––––––––––  Test Plane –––––––––––––––––
 
 TEST_CASE("Plane: Hit", "[plane]"){
@@ -184,6 +232,14 @@ TEST_CASE("Plane: Transformation", "[plane]"){
   REQUIRE(!plane.check_if_intersection(ray4));
 }
 
+TEST_CASE("Plane: bounding box", "[plane]"){
+  Plane plane(translation(Vec(0.0, 0.0, 1.0)));
+  AABB box = plane.bounding_box();
+
+  REQUIRE(!box.is_empty());
+  REQUIRE(!box.is_bounded());
+}
+
 TEST_CASE("Plane: uv coordinates", "[plane]"){
   Plane plane;
 
@@ -238,6 +294,38 @@ TEST_CASE("Box: Internal Hit", "[box]") {
                                           Vec2d(0.583333, 0.583333), 0.5, ray)));
 }
 
+TEST_CASE("Box: Rays parallel to the faces", "[box]") {
+  Box box;
+
+  // A ray lying on the plane of a face still hits the box (no NaN in the slab test)
+  Ray on_face(Point(0.0, 0.5, 2.0), -VEC_Z);
+  HitRecord intersection = box.ray_intersection(on_face);
+  REQUIRE(intersection.init);
+  REQUIRE(box.check_if_intersection(on_face));
+  REQUIRE(intersection.world_point.is_close(Point(0.0, 0.5, 1.0)));
+  REQUIRE(intersection.normal.is_close(Normal(0.0, 0.0, 1.0)));
+
+  // Parallel rays outside the slab of an axis miss, in both directions
+  REQUIRE(!box.ray_intersection(Ray(Point(1.5, 0.5, 2.0), -VEC_Z)).init);
+  REQUIRE(!box.ray_intersection(Ray(Point(-0.5, 0.5, -2.0), VEC_Z)).init);
+  REQUIRE(!box.check_if_intersection(Ray(Point(0.5, -0.5, -2.0), VEC_Z)));
+
+  // The exit face is found also for rays starting inside along a negative direction
+  HitRecord exit = box.ray_intersection(Ray(Point(0.5, 0.5, 0.5), -VEC_Y));
+  REQUIRE(exit.init);
+  REQUIRE(exit.is_close(HitRecord(Point(0.5, 0.0, 0.5), Normal(0.0, 1.0, 0.0),
+                                  Vec2d(0.25, 0.25), 0.5, Ray(Point(0.5, 0.5, 0.5), -VEC_Y))));
+}
+
+TEST_CASE("Box: Swapped vertices", "[box]") {
+  Box box(Point(1, 1, 1), Point(0, 0, 0));
+  REQUIRE(box.Pmin.is_close(Point(0, 0, 0)));
+  REQUIRE(box.Pmax.is_close(Point(1, 1, 1)));
+
+  Ray ray(Point(2, 0.5, 0.5), -VEC_X);
+  REQUIRE(box.ray_intersection(ray).is_close(Box().ray_intersection(ray)));
+}
+
 TEST_CASE("Box: Transformation", "[box]"){
   Box box(Point(0, 0, 0), Point(1, 1, 1), translation(Vec(10.0, 0.0, 0.0)));
   
@@ -281,6 +369,27 @@ TEST_CASE("Box: Normal Direction", "[box]"){
   REQUIRE(intersection.normal.normalize().is_close(Normal(0.0, -1.0, 0.0).normalize()));
 }
 
+TEST_CASE("Box: bounding box", "[box]"){
+  Box box(Point(1.0, 1.0, 1.0), Point(-1.0, 0.0, 2.0), translation(Vec(10.0, 0.0, 0.0)));
+  AABB aabb = box.bounding_box();
+
+  REQUIRE(aabb.pmin.is_close(Point(9.0, 0.0, 1.0)));
+  REQUIRE(aabb.pmax.is_close(Point(11.0, 1.0, 2.0)));
+
+  // Every vertex of a rotated box lies inside its bounding box
+  Box rotated(Point(0.0, 0.0, 0.0), Point(1.0, 2.0, 3.0), rotation_x(30) * rotation_z(60));
+  AABB rotated_aabb = rotated.bounding_box();
+  for (int i{}; i < 8; ++i) {
+    Point vertex = rotated.transformation * Point(i & 1, (i & 2) ? 2.0 : 0.0, (i & 4) ? 3.0 : 0.0);
+    REQUIRE(vertex.x >= rotated_aabb.pmin.x - 1e-5);
+    REQUIRE(vertex.y >= rotated_aabb.pmin.y - 1e-5);
+    REQUIRE(vertex.z >= rotated_aabb.pmin.z - 1e-5);
+    REQUIRE(vertex.x <= rotated_aabb.pmax.x + 1e-5);
+    REQUIRE(vertex.y <= rotated_aabb.pmax.y + 1e-5);
+    REQUIRE(vertex.z <= rotated_aabb.pmax.z + 1e-5);
+  }
+}
+
 TEST_CASE("Box: uv coordinates", "[box]"){
   Box box;
 
@@ -301,4 +410,65 @@ TEST_CASE("Box: uv coordinates", "[box]"){
 
   Ray ray6(Point(0.5, 0.5, -1.0), VEC_Z); //P6 (0.5,0.5,0.)
   REQUIRE(box.ray_intersection(ray6).surface_point.is_close(Vec2d(0.416667, 0.416667)));
-}
\ No newline at end of file
+}
+// –––––––––––––––––  Test specialized transformations –––––––––––––––––
+
+TEST_CASE("Shapes: specialized transformation kernels", "[shapes]"){
+
+  // Each shape gives the same answers whether its transformation is tagged with its kind or as a general one
+  Transformation transformations[] = {Transformation(), translation(Vec(0.2, -0.1, 0.3)),
+                                      translation(Vec(0.1, 0.2, 0.0)) * scaling(Vec(1.5, 0.8, 1.2)),
+                                      translation(Vec(-0.2, 0.1, 0.1)) * rotation_z(20.) * rotation_x(15.),
+                                      rotation_y(10.) * scaling(Vec(1.2, 0.7, 1.0))};
+  Ray rays[] = {Ray(Point(-3.0, 0.4, 0.3), Vec(1.0, 0.05, 0.02)), Ray(Point(0.3, 0.4, 4.0), Vec(0.01, 0.02, -1.0)),
+                Ray(Point(0.4, -3.0, 0.6), Vec(0.1, 1.0, -0.05)), Ray(Point(5.0, 5.0, 5.0), Vec(1.0, 0.0, 0.1))};
+
+  for (Transformation tr : transformations) {
+    Transformation general(tr.m, tr.invm);
+    vector<pair<shared_ptr<Shape>, shared_ptr<Shape>>> shapes = {
+        {make_shared<Sphere>(tr), make_shared<Sphere>(general)},
+        {make_shared<Plane>(tr), make_shared<Plane>(general)},
+        {make_shared<Box>(Point(-0.5, 0., 0.), Point(1., 1., 1.), tr), make_shared<Box>(Point(-0.5, 0., 0.), Point(1., 1., 1.), general)}};
+
+    for (auto &pair : shapes) {
+      for (Ray ray : rays) {
+        HitRecord hit = pair.first->ray_intersection(ray);
+        HitRecord expected = pair.second->ray_intersection(ray);
+        REQUIRE(hit.init == expected.init);
+        REQUIRE(pair.first->check_if_intersection(ray) == pair.second->check_if_intersection(ray));
+        if (hit.init) REQUIRE(hit.is_close(expected));
+      }
+    }
+  }
+}
+
+TEST_CASE("Shapes: two-phase intersection", "[shapes]"){
+
+  // The distance of the first phase and the record of the second one match the full intersection
+  vector<shared_ptr<Shape>> shapes = {make_shared<Sphere>(translation(Vec(0.1, 0.2, 0.0)) * scaling(Vec(1.5, 0.8, 1.2))),
+                                      make_shared<Plane>(rotation_x(15.)),
+                                      make_shared<Box>(Point(-0.5, 0., 0.), Point(1., 1., 1.), rotation_z(20.))};
+  Ray rays[] = {Ray(Point(-3.0, 0.4, 0.3), Vec(1.0, 0.05, 0.02)), Ray(Point(0.3, 0.4, 4.0), Vec(0.01, 0.02, -1.0)),
+                Ray(Point(0.4, -3.0, 0.6), Vec(0.1, 1.0, -0.05)), Ray(Point(0.5, 0.5, 0.5), Vec(0.0, 0.0, 1.0))};
+
+  for (auto shape : shapes) {
+    for (Ray ray : rays) {
+      HitRecord expected = shape->ray_intersection(ray);
+      HitDistance hit;
+      REQUIRE(shape->hit_distance(ray, hit) == expected.init);
+      if (!expected.init) {
+        REQUIRE(!hit.shape);
+        continue;
+      }
+      REQUIRE(hit.shape == shape.get());
+      REQUIRE(hit.t == expected.t);
+      REQUIRE(shape->hit_record(ray, hit).is_close(expected));
+
+      // Hits beyond tmax are ignored, and leave the previous hit untouched
+      Ray shorter(ray.origin, ray.dir, ray.tmin, expected.t, 0);
+      HitDistance previous(expected.t, nullptr, 7);
+      REQUIRE(!shape->hit_distance(shorter, previous));
+      REQUIRE(previous.face == 7);
+    }
+  }
+}
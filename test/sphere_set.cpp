@@ -0,0 +1,183 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "world.h"
+#include "catch_amalgamated.hpp"
+
+#define CATCH_CONFIG_MAIN
+
+// Setup: spheres translated and scaled (also non-uniformly) in a cube of side 4
+vector<shared_ptr<Sphere>> random_spheres(int n_spheres, PCG &pcg) {
+  vector<shared_ptr<Sphere>> spheres;
+  for (int i{}; i < n_spheres; ++i) {
+    Vec position(4. * pcg.random_float() - 2., 4. * pcg.random_float() - 2., 4. * pcg.random_float() - 2.);
+    float size = 0.2 + 0.5 * pcg.random_float();
+    Vec factors = (i % 3 == 0) ? Vec(size, 0.5 * size, 1.5 * size) : Vec(size, size, size);
+    if (i % 4 == 0)
+      spheres.push_back(make_shared<Sphere>(translation(position)));
+    else
+      spheres.push_back(make_shared<Sphere>(translation(position) * scaling(factors)));
+  }
+  return spheres;
+}
+
+// Rays aimed at the silhouette of a sphere, barely hitting or missing it, and random rays
+Ray random_ray(vector<shared_ptr<Sphere>> &spheres, PCG &pcg, int i) {
+  Point origin(10. * pcg.random_float() - 5., 10. * pcg.random_float() - 5., -6.);
+  if (i % 2 == 0) return Ray(origin, Vec(pcg.random_float() - 0.5, pcg.random_float() - 0.5, 1.));
+
+  Sphere &target = *spheres[i % spheres.size()];
+  Point center = target.transformation * Point(0., 0., 0.);
+  float radius = (target.transformation * Vec(1., 0., 0.)).norm();
+  Vec dir = (center - origin).normalize();
+  Vec side = cross(dir, Vec(0., 0., 1.)).normalize();
+  float distance = radius * (1. + (pcg.random_float() - 0.5) * 1e-5);
+  return Ray(origin, (center + side * distance - origin).normalize());
+}
+
+TEST_CASE("SphereSet: same hits as the single spheres", "[sphere_set]") {
+
+  for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::SSE, SimdLevel::AVX2}) {
+    if (level > best_simd_level()) continue;
+    INFO("Kernel: " + simd_level_name(level));
+
+    PCG pcg;
+    for (int n{1}; n <= SPHERE_SET_SIZE; ++n) {
+      vector<shared_ptr<Sphere>> spheres = random_spheres(n, pcg);
+      SphereSet set(spheres);
+      set.simd = level;
+      REQUIRE(set.bounding_box().is_bounded());
+
+      for (int i{}; i < 2000; ++i) {
+        Ray ray = random_ray(spheres, pcg, i);
+        if (i % 5 == 0) ray.tmax = 6. + 2. * pcg.random_float();
+
+        HitRecord expected;
+        bool any = false;
+        for (auto sphere : spheres) {
+          HitRecord hit = sphere->ray_intersection(ray);
+          if (hit.init && (!expected.init || hit.t < expected.t)) expected = hit;
+          any = any || sphere->check_if_intersection(ray);
+        }
+
+        HitRecord hit = set.ray_intersection(ray);
+        REQUIRE(hit.init == expected.init);
+        REQUIRE(set.check_if_intersection(ray) == any);
+        if (!hit.init) continue;
+        // Exactly the same record, not just a close one
+        REQUIRE(hit.t == expected.t);
+        REQUIRE(hit.world_point.x == expected.world_point.x);
+        REQUIRE(hit.world_point.y == expected.world_point.y);
+        REQUIRE(hit.world_point.z == expected.world_point.z);
+        REQUIRE(hit.normal.x == expected.normal.x);
+        REQUIRE(hit.normal.y == expected.normal.y);
+        REQUIRE(hit.normal.z == expected.normal.z);
+        REQUIRE(hit.surface_point.u == expected.surface_point.u);
+        REQUIRE(hit.surface_point.v == expected.surface_point.v);
+      }
+    }
+  }
+}
+
+TEST_CASE("SphereSet: packing", "[sphere_set]") {
+
+  Sphere translated(translation(Vec(1., 2., 3.)));
+  Sphere scaled(translation(Vec(1., 2., 3.)) * scaling(Vec(2., 1., 3.)));
+  Sphere rotated(translation(Vec(1., 2., 3.)) * rotation_x(30.));
+  REQUIRE(SphereSet::can_pack(translated));
+  REQUIRE(SphereSet::can_pack(scaled));
+  REQUIRE(!SphereSet::can_pack(rotated));
+
+  auto sphere = make_shared<Sphere>(translation(Vec(1., 0., 0.)));
+  SphereSet set({sphere, make_shared<Sphere>()});
+  REQUIRE(set.bounding_box().pmax.is_close(Point(2., 1., 1.)));
+
+  // The set follows the spheres when updated, unless they cannot be packed any more
+  sphere->transformation = translation(Vec(3., 0., 0.));
+  REQUIRE(set.update());
+  REQUIRE(set.bounding_box().pmax.is_close(Point(4., 1., 1.)));
+  REQUIRE(set.check_if_intersection(Ray(Point(3., 0., -5.), Vec(0., 0., 1.))));
+
+  // A hit refers to the set, with the index of the sphere hit
+  HitDistance hit;
+  REQUIRE(set.hit_distance(Ray(Point(0., 0., -5.), Vec(0., 0., 1.)), hit));
+  REQUIRE(hit.shape == &set);
+  REQUIRE(hit.face == 1);
+  REQUIRE(are_close(hit.t, 4.));
+
+  sphere->transformation = rotation_z(10.);
+  REQUIRE(!set.update());
+
+  // Spheres sharing a material share its index
+  Material shared;
+  SphereSet materials_set({make_shared<Sphere>(translation(Vec(-2., 0., 0.)), shared), make_shared<Sphere>(),
+                           make_shared<Sphere>(translation(Vec(2., 0., 0.)), shared)});
+  REQUIRE(materials_set.materials.size() == 2);
+  REQUIRE(materials_set.material_id[0] == materials_set.material_id[2]);
+  REQUIRE(materials_set.material_id[1] != materials_set.material_id[0]);
+  REQUIRE(materials_set.materials[materials_set.material_id[0]].brdf == shared.brdf);
+}
+
+TEST_CASE("SphereSet: packed world", "[sphere_set]") {
+
+  PCG pcg;
+  vector<shared_ptr<Sphere>> spheres = random_spheres(300, pcg);
+  World world, packed;
+  for (auto sphere : spheres) {
+    world.add_shape(sphere);
+    packed.add_shape(sphere);
+  }
+  // Shapes that are not packed: a rotated sphere, a box and a plane
+  for (World *w : {&world, &packed}) {
+    w->add_shape(make_shared<Sphere>(rotation_x(20.) * scaling(Vec(0.5, 0.2, 0.3))));
+    w->add_shape(make_shared<Box>(Point(-3., -3., -3.), Point(-2.5, -2.5, -2.5)));
+    w->add_shape(make_shared<Plane>(translation(Vec(0., 0., -4.))));
+  }
+  world.build_accelerator(AcceleratorType::BVH);
+  packed.pack_spheres = true;
+  packed.build_accelerator(AcceleratorType::BVH);
+  REQUIRE(packed.sphere_sets.size() > 0);
+  REQUIRE(packed.bvh->primitives.size() < world.bvh->primitives.size());
+
+  auto compare = [&]() {
+    PCG ray_pcg;
+    for (int i{}; i < 2000; ++i) {
+      Ray ray = random_ray(spheres, ray_pcg, i);
+      HitRecord expected = world.ray_intersection(ray);
+      HitRecord hit = packed.ray_intersection(ray);
+      REQUIRE(hit.init == expected.init);
+      if (hit.init) REQUIRE(hit.t == expected.t);
+      REQUIRE(packed.check_if_intersection(ray) == world.check_if_intersection(ray));
+    }
+  };
+  compare();
+
+  // Moving the spheres: the sets are updated with the hierarchy...
+  for (auto sphere : spheres)
+    sphere->transformation = translation(Vec(0.05, 0., 0.)) * sphere->transformation;
+  world.update_bvh();
+  packed.update_bvh();
+  compare();
+
+  // ...and rebuilt if a sphere cannot be packed any more
+  shared_ptr<Sphere> member = packed.sphere_sets[0]->spheres[0];
+  member->transformation = member->transformation * rotation_y(10.);
+  world.update_bvh();
+  REQUIRE(packed.update_bvh());
+  compare();
+}
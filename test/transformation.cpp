@@ -121,6 +121,17 @@ TEST_CASE("Transformation inverse", "[transformation]") {
   REQUIRE(!prod.is_close(t));
 }
 
+TEST_CASE("Transformation inverse_apply", "[transformation]") {
+
+  Transformation tr = translation(Vec(1.0, -2.0, 3.0)) * rotation_y(30.0) * scaling(Vec(2.0, 0.5, 4.0));
+  Point p(3.0, 1.0, -2.0);
+  Vec v(-1.0, 4.0, 0.5);
+
+  REQUIRE(tr.inverse_apply(p).is_close(tr.inverse() * p));
+  REQUIRE(tr.inverse_apply(v).is_close(tr.inverse() * v));
+  REQUIRE(tr.inverse_apply(tr * p).is_close(p));
+}
+
 TEST_CASE("Transformation translation", "[transformation]") {
 
   Transformation tr1 = translation(Vec(1.0, 2.0, 3.0));
@@ -168,3 +179,38 @@ TEST_CASE("Transformation rotations", "[transformation]") {
   REQUIRE((ry2 * VEC_Z).is_close(VEC_X));
   REQUIRE((rz2 * VEC_X).is_close(VEC_Y));
 }
+
+TEST_CASE("Transformation kinds", "[transformation]") {
+
+  Transformation tr = translation(Vec(1.0, 2.0, 3.0));
+  Transformation sc = scaling(Vec(2.0, 3.0, 4.0));
+  Transformation rot = rotation_z(30.0);
+
+  REQUIRE(Transformation().kind == TransformationKind::IDENTITY);
+  REQUIRE(tr.kind == TransformationKind::TRANSLATION);
+  REQUIRE(sc.kind == TransformationKind::SCALING);
+  REQUIRE(rot.kind == TransformationKind::RIGID);
+  REQUIRE(Transformation(t.m, t.invm).kind == TransformationKind::GENERAL);
+
+  REQUIRE((Transformation() * tr).kind == TransformationKind::TRANSLATION);
+  REQUIRE((tr * tr).kind == TransformationKind::TRANSLATION);
+  REQUIRE((tr * sc).kind == TransformationKind::SCALING);
+  REQUIRE((sc * tr).kind == TransformationKind::SCALING);
+  REQUIRE((tr * rot).kind == TransformationKind::RIGID);
+  REQUIRE((rot * rot).kind == TransformationKind::RIGID);
+  REQUIRE((rot * sc).kind == TransformationKind::GENERAL);
+  REQUIRE((tr * sc).inverse().kind == TransformationKind::SCALING);
+
+  // The specialized kernels agree with the general ones
+  Point p(3.0, -1.0, 2.0);
+  Vec v(0.5, 2.0, -3.0);
+  Normal n(1.0, -2.0, 0.5);
+  for (Transformation x : {Transformation(), tr, sc, rot, tr * sc, tr * rot, tr * rot * sc}) {
+    Transformation general(x.m, x.invm);
+    REQUIRE((x * p).is_close(general * p));
+    REQUIRE((x * v).is_close(general * v));
+    REQUIRE((x * n).is_close(general * n));
+    REQUIRE(x.inverse_apply(p).is_close(general.inverse_apply(p)));
+    REQUIRE(with_kind(x.kind, [&](auto tag) { return x.inverse_apply<decltype(tag)::value>(v); }).is_close(general.inverse() * v));
+  }
+}
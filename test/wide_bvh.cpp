@@ -0,0 +1,136 @@
+/*
+Copyright (C) 2021 Adele Zaini, Elisa Legnani
+
+This file is part of PhotorealisticRendering.
+
+PhotorealisticRendering is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+PhotorealisticRendering is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "world.h"
+#include "random_scene.h"
+#include "catch_amalgamated.hpp"
+
+#define CATCH_CONFIG_MAIN
+
+// Setup: a random cloud of spheres and boxes of very different sizes, above a plane
+RandomScene varied_sizes() {
+  RandomScene scene;
+  scene.min_size = 0.01;
+  scene.max_size = 1.;
+  scene.plane = true;
+  return scene;
+}
+
+TEST_CASE("Wide BVH structure", "[wide_bvh]") {
+
+  REQUIRE(sizeof(WideBVHNode) == 64);
+  REQUIRE(alignof(WideBVHNode) == 64);
+
+  PCG pcg;
+  World world = random_world(1000, pcg, varied_sizes());
+  world.build_accelerator(AcceleratorType::WIDE_BVH);
+  WideBVH &wide = dynamic_cast<WideBVH &>(*world.accelerator);
+
+  // Every shape is referenced by exactly one leaf, and the quantized boxes contain the exact ones
+  REQUIRE(wide.primitives == world.bvh->primitives);
+  vector<int> references(wide.primitives.size(), 0);
+  for (auto &node : wide.nodes) {
+    REQUIRE(node.n_children >= 1);
+    REQUIRE(node.n_children <= WIDE_BVH_WIDTH);
+    for (int c{}; c < node.n_children; ++c) {
+      if (node.count[c] == 0) continue;
+      for (int p{node.child[c]}; p < node.child[c] + node.count[c]; ++p) {
+        references[p]++;
+        AABB box = wide.primitives[p]->bounding_box();
+        for (int a{}; a < 3; ++a) {
+          float scale = ldexp(1.f, node.exponent[a]);
+          REQUIRE(node.origin[a] + node.qmin[a][c] * scale <= coordinate(box.pmin, a));
+          REQUIRE(node.origin[a] + node.qmax[a][c] * scale >= coordinate(box.pmax, a));
+        }
+      }
+    }
+  }
+  for (int count : references)
+    REQUIRE(count == 1);
+
+  AABB box = wide.bounding_box();
+  REQUIRE(merge(box, world.bvh->bounding_box()).surface_area() == box.surface_area());
+
+  // Four children per node need fewer nodes, and they are smaller than two binary nodes
+  REQUIRE(wide.nodes.size() < world.bvh->nodes.size() / 2);
+  REQUIRE(wide.memory_footprint() < world.bvh->memory_footprint());
+}
+
+TEST_CASE("Wide BVH closest and any hit", "[wide_bvh]") {
+
+  PCG pcg;
+  World brute_force = random_world(1000, pcg, varied_sizes());
+  World world = brute_force;
+  world.build_accelerator(AcceleratorType::WIDE_BVH, BVHBuildMethod::BINNED_SAH);
+
+  for (int i{}; i < 2000; ++i) {
+    Ray ray = random_ray(pcg);
+    HitRecord expected = brute_force.ray_intersection(ray);
+    HitRecord hit = world.ray_intersection(ray);
+
+    REQUIRE(hit.init == expected.init);
+    if (expected.init) {
+      REQUIRE(are_close(hit.t, expected.t));
+      REQUIRE(hit.is_close(expected));
+    }
+
+    // A short ray, so that some of them are not occluded
+    Ray segment(ray.origin, ray.dir, 1e-5, 0.5, 0);
+    REQUIRE(world.check_if_intersection(segment) == brute_force.check_if_intersection(segment));
+  }
+
+  // Rays parallel to the axes (null components of the direction), aimed at the centers of the shapes
+  for (auto shape : world.bvh->primitives) {
+    Point center = shape->bounding_box().centroid();
+    for (Vec dir : {VEC_X, VEC_Y, -VEC_Z}) {
+      Ray ray(center - dir * 50, dir);
+      HitRecord hit = world.ray_intersection(ray);
+      HitRecord expected = brute_force.ray_intersection(ray);
+      REQUIRE(hit.init == expected.init);
+      if (expected.init)
+        REQUIRE(are_close(hit.t, expected.t));
+    }
+  }
+}
+
+TEST_CASE("Wide BVH refit", "[wide_bvh]") {
+
+  PCG pcg;
+  World world = random_world(500, pcg, varied_sizes());
+  world.build_accelerator(AcceleratorType::WIDE_BVH);
+  shared_ptr<Accelerator> old = world.accelerator;
+
+  for (auto shape : world.shapes)
+    shape->transformation = translation(Vec(0.0, 0.0, 0.05)) * shape->transformation;
+  REQUIRE(!world.update_bvh());
+  REQUIRE(world.accelerator != old);
+  REQUIRE(world.accelerator_type == AcceleratorType::WIDE_BVH);
+
+  World brute_force;
+  for (auto shape : world.shapes)
+    brute_force.add_shape(shape);
+  for (int i{}; i < 500; ++i) {
+    Ray ray = random_ray(pcg);
+    HitRecord expected = brute_force.ray_intersection(ray);
+    HitRecord hit = world.ray_intersection(ray);
+    REQUIRE(hit.init == expected.init);
+    if (expected.init)
+      REQUIRE(are_close(hit.t, expected.t));
+  }
+}
@@ -50,4 +50,105 @@ TEST_CASE("World methods", "[world]"){
   REQUIRE(world.is_point_visible(Point(0.0, 10.0, 0.0), Point(0.0, 0.0, 0.0)));
   REQUIRE(world.is_point_visible(Point(0.0, 0.0, 10.0), Point(0.0, 0.0, 0.0)));
 
+  // The same checks with the hierarchy and the batched version
+  world.build_bvh();
+  vector<Point> points = {Point(10.0, 0.0, 0.0), Point(5.0, 0.0, 0.0), Point(0.5, 0.0, 0.0), Point(0.0, 10.0, 0.0)};
+  vector<bool> visible = world.are_points_visible(points, Point(0.0, 0.0, 0.0));
+
+  REQUIRE(!world.is_point_visible(Point(10.0, 0.0, 0.0), Point(0.0, 0.0, 0.0)));
+  REQUIRE(world.is_point_visible(Point(5.0, 0.0, 0.0), Point(4.0, 0.0, 0.0)));
+  REQUIRE(visible == vector<bool>{false, false, true, true});
+
+  // Buffers reused from a previous check are overwritten, whatever their size
+  vector<Ray> rays;
+  world.are_points_visible(points, Point(0.0, 0.0, 0.0), rays, visible);
+  REQUIRE(visible == vector<bool>{false, false, true, true});
+  world.are_points_visible({Point(5.0, 0.0, 0.0), Point(10.0, 0.0, 0.0)}, Point(4.0, 0.0, 0.0), rays, visible);
+  REQUIRE(visible == vector<bool>{true, false});
+  REQUIRE(rays.size() == 2);
+
+}
+
+TEST_CASE("World bounds", "[world]"){
+
+  World world;
+  REQUIRE(world.bounding_box().is_empty());
+
+  world.add_shape(make_shared<Sphere>(translation(VEC_X * 2)));
+  world.add_shape(make_shared<Box>(Point(-1, -1, -1), Point(0, 0, 0)));
+  world.build_bvh();
+
+  AABB box = world.bounding_box();
+  REQUIRE(box.pmin.is_close(Point(-1.0, -1.0, -1.0)));
+  REQUIRE(box.pmax.is_close(Point(3.0, 1.0, 1.0)));
+
+  // Rays are clipped to the populated region...
+  Ray ray(Point(-10.0, 0.5, 0.5), VEC_X);
+  REQUIRE(world.clip_ray(ray));
+  REQUIRE(are_close(ray.tmin, 9.0, 1e-2));
+  REQUIRE(are_close(ray.tmax, 13.0, 1e-2));
+
+  // ...and the ones missing it are discarded
+  Ray missing(Point(-10.0, 5.0, 0.5), VEC_X);
+  REQUIRE(!world.clip_ray(missing));
+  REQUIRE(!world.ray_intersection(missing).init);
+
+  // A plane makes the world unbounded, so nothing is clipped
+  world.add_shape(make_shared<Plane>(translation(Vec(0.0, 0.0, -5.0))));
+  world.build_bvh();
+  REQUIRE(!world.bounding_box().is_bounded());
+  Ray ray2(Point(-10.0, 5.0, 0.5), VEC_X);
+  REQUIRE(world.clip_ray(ray2));
+  REQUIRE(ray2.tmax == INFINITY);
+}
+
+TEST_CASE("World typed storage", "[world]"){
+
+  // A cloud of shapes of every type, plus an instance kept among the other shapes
+  PCG pcg;
+  World world;
+  shared_ptr<ShapeGroup> group = make_shared<ShapeGroup>();
+  group->add_shape(make_shared<Box>(Point(-0.2, -0.2, -0.2), Point(0.2, 0.2, 0.2)));
+  group->build_bvh();
+  for (int i{}; i < 200; ++i) {
+    Vec position(10. * pcg.random_float() - 5., 10. * pcg.random_float() - 5., 10. * pcg.random_float());
+    if (i % 2 == 0)
+      world.add_shape(make_shared<Sphere>(translation(position) * scaling(Vec(0.3, 0.3, 0.3))));
+    else
+      world.add_shape(make_shared<Box>(Point(0, 0, 0), Point(0.3, 0.5, 0.3), translation(position) * rotation_z(30.)));
+  }
+  world.add_shape(make_shared<Instance>(group, translation(Vec(0.0, 0.0, 5.0))));
+  world.add_shape(make_shared<Plane>(translation(Vec(0.0, 0.0, -1.0))));
+  World reference = world;
+
+  for (AcceleratorType type : {AcceleratorType::NONE, AcceleratorType::BVH}) {
+    world.typed_storage = true;
+    world.build_accelerator(type);
+    reference.build_accelerator(type);
+
+    REQUIRE(world.typed_shapes);
+    REQUIRE(world.typed_shapes->planes.size() == 1);
+    REQUIRE(world.typed_shapes->others.size() == (type == AcceleratorType::NONE ? 1 : 0));
+    REQUIRE(world.typed_shapes->size() == (type == AcceleratorType::NONE ? 202 : 1));
+
+    for (int i{}; i < 300; ++i) {
+      Ray ray(Point(10. * pcg.random_float() - 5., 10. * pcg.random_float() - 5., 12.),
+              Vec(pcg.random_float() - 0.5, pcg.random_float() - 0.5, -1.0));
+      HitRecord hit = world.ray_intersection(ray);
+      HitRecord expected = reference.ray_intersection(ray);
+      REQUIRE(hit.init == expected.init);
+      REQUIRE(world.check_if_intersection(ray) == reference.check_if_intersection(ray));
+      if (expected.init) {
+        REQUIRE(hit.is_close(expected));
+        REQUIRE(hit.material.brdf == expected.material.brdf);
+      }
+    }
+  }
+
+  // The copies follow the shapes once the world is updated
+  world.shapes.back()->transformation = translation(Vec(0.0, 0.0, 20.0));
+  world.update_bvh();
+  HitRecord hit = world.ray_intersection(Ray(Point(50.0, 50.0, 30.0), -VEC_Z));
+  REQUIRE(hit.init);
+  REQUIRE(hit.world_point.is_close(Point(50.0, 50.0, 20.0)));
 }